@@ -1,4 +1,7 @@
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // fallocate
+#endif
 #include "log.h"
 
 /* ---------------------- logdict private prototypes ---------------------------- */
@@ -28,16 +31,29 @@ static bool         _logsys_mutetype = DF_LOGSYS_MUTETYPE;  // 系统日志静
 static size_t       _logsys_filesize = DF_LOGSYS_FILESIZE;  // 系统日志大小, 默认为 1 M
 static logdict*     _logsys_dic      = DF_LOGSYS_DIC;       // 日志系统维护的日志结构字典
 static logdictType* _logsys_dictype  = DF_LOGSYS_DICTYPE;   // 日志字典类型
+static int          _logsys_timeprec = DF_LOGSYS_TIMEPREC;  // 日志时间前缀的精度(秒后的小数位数)
+static bool         _logsys_async    = DF_LOGSYS_ASYNC;     // 用户日志异步模式, 默认关闭
+static int          _logsys_level    = DF_LOGSYS_LEVEL;     // 系统日志 和 新建日志 的调式信息级别
+static int          _logsys_dump     = DF_LOGSYS_DUMP;      // 定时写入计数器的间隔(秒), 为 0 时不定时写入
+static bool         _logsys_stats    = DF_LOGSYS_STATS;     // 是否统计写入调用的耗时
+static bool         _logsys_console  = DF_LOGSYS_CONSOLE;   // 异步控制台输出, 默认关闭
+int                 _logsys_maxlevel = DF_LOGSYS_LEVEL;     // 所有日志中最高的调式信息级别, 供调式宏提前返回
+static int          _level_counts[LOG_LV_INFO + 1];         // 各级别的用户日志数量, 只在持有 _dictLocker 时修改
+static void         _logLevelUpdate();                      // 重新计算 _logsys_maxlevel, 须持有 _dictLocker
 
-static pthread_mutex_t consoleLocker;    // 控制台锁
-static pthread_mutex_t sysfileLocker;    // 系统日志文件锁
-static pthread_mutex_t fileLocker;       // 用户日志文件锁
+static pthread_mutex_t consoleLocker = PTHREAD_MUTEX_INITIALIZER;  // 控制台锁, 静态初始化, 日志系统未初始化时 logShow* 也可以使用
 
 
 
 #define TS_LOG  0
 #define TS_FILE 1
-static char* _timeStr(int type);                            // 返回一个存储当前本地时间的静态字符串指针
+static char* _timeStr(int type);                            // 返回一个存储当前本地时间的线程局部字符串指针
+static char* _timeLogStr(size_t* len);                      // 返回线程局部缓存的日志时间前缀, 只在秒变化时重新渲染
+static size_t _timeRender(char* buf, time_t sec, long nsec, long gmtoff, int prec);  // 渲染日志时间前缀到 buf 中, buf 至少 40 字节
+static long  _timeGmtoff(time_t sec);                       // 返回线程局部缓存的 UTC 偏移, 每 15 分钟更新一次
+static char* _timeFormat(char* buf, size_t cap, int type, time_t t);  // 按 type 格式化指定时间到 buf 中
+static time_t _timeNow();                                   // 获取当前时间(秒), 使用 vDSO 粗粒度时钟, 没有系统调用
+static time_t _timeNextBoundary(time_t now, int interval);  // 计算下一个按本地时间对齐的轮转时间点
 
 typedef int status;
 #define FILE_NOTEXIST   0
@@ -49,17 +65,196 @@ static status _GetFileStatus(constr path);                     // 获取文件
 static char* _logPath(constr dir, constr name);           // 获取一个临时的 path 字串, 不要 free
 
 static void _mkdir(constr name, constr path, mode_t mode);// 根据路径依次创建文件夹, 直到文件的最底层
-static void _logFileShrink(LogPtr log);                             // 若 日志文件 已达上限, 则清空文件
+static void _logFileShrink(LogFilePtr file);                             // 若 日志文件 已达上限, 则轮转或清空文件
+static int  _logFileRotate(LogFilePtr file, constr suffix);              // 轮转日志文件: path -> path.1 -> ... -> path.N 或 path -> path+suffix
 static LogPtr _logGenerate(constr name, constr path, bool mutetype);
 static void _logReset(LogPtr log);
-static size_t _logFileSize(LogPtr log);
-static int _logFlieEmpty(LogPtr log);
+static size_t _logFileSize(LogFilePtr file);
+static void _logCount(LogFilePtr file, int n);                           // 累加已写入文件的字节数
+static size_t _logFileStatSize(FILE* fp);                           // 通过 fstat 获取文件大小
+static void _logFileIdentity(LogFilePtr file);                           // 通过 fstat 记录当前文件的 dev/inode
+static LogFilePtr _logFileOpen(constr name, constr path);           // 打开日志文件, 创建引用数为 1 的日志文件结构
+static void _logFileClose(LogFilePtr file);                         // 关闭日志文件, 释放日志文件结构
+static LogFilePtr _logFileFind(constr path);                        // 查找已打开 path 所指文件的日志文件结构, 须持有 _dictLocker
+static LogPtr _logShare(constr name, bool mutetype, LogFilePtr file);   // 创建一个共享 file 的日志结构, 须持有 _dictLocker
+static int _logFlieEmpty(LogFilePtr file);
+static void _logVWrite(LogPtr log, bool console, bool timed, bool flush, constr prefix, constr text, va_list ap);  // 用户日志统一写入入口
+static void _logWrite(LogPtr log, bool console, bool timed, constr text, ...);
+static void _logVEmit(LogPtr log, bool console, bool timed, bool flush, constr prefix, constr text, va_list ap, uint64_t begin); // 写入一条记录, 不经过重复记录合并
+static void _logEmit(LogPtr log, bool console, bool timed, constr text, ...);
+static void _logDedupVWrite(LogPtr log, bool console, bool timed, bool flush, constr prefix, constr text, va_list ap, uint64_t begin);    // 合并连续重复的记录
+static void _logDedupFlush(LogPtr log);                             // 写入被合并记录的摘要行, 须持有 log->dlocker
+static bool _logDedupHash(constr prefix, constr text, bool binary, va_list ap, uint32_t* hash, size_t* len);  // 计算记录(不含时间) 的 hash, 不拷贝参数
+static void _logCountLine(LogPtr log, uint64_t bytes);              // 累加已写入文件的记录数和字节数, 须持有 log->file->locker
+static void _logCountFlush(LogPtr log, uint64_t n);                 // 累加日志触发的写出次数, 须持有 log->file->locker
+static void _logsysVWrite(constr name, bool console, bool timed, constr prefix, constr text, va_list ap);   // 系统日志统一写入入口
+
+static __thread char _line_buf[DF_LOG_LINE_SIZE];   // 同时输出到文件和控制台的记录只渲染一次, 渲染到这里
+static __thread bool _line_busy = false;            // _line_buf 是否正在使用, 写入文件出错时可能嵌套调用 logsysAdd
+static char* _logLineV(size_t* len, size_t* tlen, bool timed, constr prefix, constr text, va_list ap);   // 渲染一条记录, 过长或嵌套时使用堆内存
+static void  _logLineEnd(char* line);                               // 结束使用 _logLineV 的结果
+static void _logDumpCounters(LogPtr log);                           // 把日志的计数器写入系统日志
+
+#define MAX_DEBUG_PREFIX    512
+static constr _logDebugPrefix(char* buf, constr text, constr file, int line, constr func, int err, constr* format);  // 在栈缓冲区中渲染调式信息前缀
+
+/* ---------------------- rcu private prototypes ---------------------------- */
+static _logSnap*    _logsys_snap     = NULL;    // 日志名字典的只读快照, 读者只访问这里
+static _logReader*  _rcu_readers     = NULL;    // 已注册的读者链表, 只增不减, 线程退出后槽位可复用
+static _logRetired* _rcu_retired     = NULL;    // 等待宽限期结束后释放的对象
+static size_t       _rcu_epoch       = 1;       // 全局纪元, 每次替换对象后递增
+static pthread_mutex_t _dictLocker   = PTHREAD_MUTEX_INITIALIZER;  // 字典写锁, 只有 logCreate/logDestroy 使用
+static pthread_key_t   _rcu_key;
+static pthread_once_t  _rcu_once     = PTHREAD_ONCE_INIT;
+static __thread _logReader* _rcu_self = NULL;   // 当前线程的读者槽位
+static int          _rcu_fallback    = 0;       // 没有读者槽位(分配失败) 的线程中处于读临界区的数量, 不为 0 时不回收任何对象
+static __thread int _rcu_fbdepth     = 0;       // 当前线程没有读者槽位时的读临界区嵌套深度
+static _logHandleSlot _logsys_handles[MAX_LOG_HANDLES];    // 句柄槽位, 只在持有 _dictLocker 时修改
+
+static void   _logReadLock();                   // 进入读临界区, 之后查找到的日志结构在退出前都不会被释放
+static void   _logReadUnlock();                 // 退出读临界区
+static LogPtr _logSnapFind(constr name);        // 在快照中查找日志结构, 必须在读临界区内调用
+static int    _logSnapPublish();                // 根据字典重建快照并发布, 旧快照延迟释放, 失败时保留旧快照, 须持有 _dictLocker
+static void   _logRetire(void* ptr, void (*destructor)(void*));  // 把对象加入延迟释放链表, 须持有 _dictLocker
+static void   _logReclaim();                    // 释放宽限期已结束的对象, 须持有 _dictLocker
+static void   _logSynchronize();                // 等待当前所有读者离开读临界区
+static void   _logHandleClose(LogPtr log);      // 释放日志的句柄槽位, 使旧句柄失效, 须持有 _dictLocker
+
+/* ---------------------- async private prototypes ---------------------------- */
+static _logRecord*  _async_queue     = NULL;    // 异步队列
+static size_t       _async_enqueue   = 0;       // 生产者位置
+static size_t       _async_dequeue   = 0;       // 消费者位置, 只有写线程访问
+static size_t       _async_done      = 0;       // 已写入文件的记录数
+static size_t       _async_dropped   = 0;       // 因队列满而丢弃的记录数
+static bool         _async_running   = false;   // 写线程是否在运行, 原子读写
+static int          _async_inflight  = 0;       // 正在入队或等待写入的线程数, _logAsyncStop 等待它归零后才释放队列
+static pthread_mutex_t _async_ctl       = PTHREAD_MUTEX_INITIALIZER;    // 串行化 _logAsyncStart/_logAsyncStop
+static bool         _async_stop      = false;   // 通知写线程退出
+static bool         _async_sleeping  = false;   // 写线程是否在休眠
+static pthread_t    _async_writer;              // 后台写线程
+static pthread_mutex_t _async_locker    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  _async_cond      = PTHREAD_COND_INITIALIZER;    // 唤醒写线程
+static pthread_cond_t  _async_flushcond = PTHREAD_COND_INITIALIZER;    // 通知记录已写入
+
+static size_t _logRender(char* buf, size_t cap, size_t* tlen, bool timed, constr prefix, constr text, va_list ap);  // 渲染 时间, 前缀 和 text 到 buf 中
+static void   _logAsyncPush(LogPtr log, bool console, bool timed, bool flush, constr prefix, constr text, va_list ap);  // 生产者: 渲染记录并放入队列
+static size_t _logAsyncDrain();                 // 消费者: 批量写入队列中的记录
+static int    _logAsyncStart();                 // 启动后台写线程
+static void   _logAsyncStop();                  // 写完队列中的记录并停止后台写线程
+static void   _logAsyncFlush();                 // 等待已入队的记录全部写入
+static bool   _logAsyncEnter();                 // 写线程在运行时登记为 in-flight 并返回 true, 之后可以访问队列
+static void   _logAsyncLeave();                 // 结束 _logAsyncEnter 的登记
+static void   _logAsyncReport();                // 报告因队列满而丢弃的记录数, 由定时线程限速调用
+
+/* ---------------------- console private prototypes ---------------------------- */
+static char*        _console_buf[2]  = {NULL, NULL};    // 控制台双缓冲区, 一个接收输出, 另一个可能正在由控制台线程写出
+static size_t       _console_len     = 0;       // 接收缓冲区已使用的长度, 以下 _console_* 须持有 consoleLocker
+static int          _console_cur     = 0;       // 接收缓冲区序号
+static size_t       _console_dropped = 0;       // 因缓冲区满而丢弃的输出条数
+static bool         _console_running = false;   // 控制台线程是否在运行
+static bool         _console_stop    = false;   // 通知控制台线程退出
+static pthread_t    _console_writer;            // 控制台线程
+static pthread_cond_t _console_cond  = PTHREAD_COND_INITIALIZER;   // 唤醒控制台线程
+
+static uint64_t _logConsoleWritev(struct iovec* iov, int cnt);     // 输出到控制台, 控制台线程运行时只放入缓冲区, 返回等待控制台锁的时间(ns)
+static uint64_t _logConsoleV(constr head, constr name, constr sep, constr prefix, constr text, va_list ap);  // 输出 head "[name" sep prefix text 到控制台
+static uint64_t _logConsole(constr head, constr name, constr sep, constr prefix, constr text, ...);
+static void*    _logConsoleWriter(void* arg);   // 控制台线程, 批量写出缓冲区
+static int      _logConsoleStart();             // 启动控制台线程
+static void     _logConsoleStop();              // 写完缓冲区中的输出并停止控制台线程
+
+/* ---------------------- stats private prototypes ---------------------------- */
+static unsigned          _stat_threads = 0;     // 已分配统计分片序号的线程数
+static __thread unsigned _stat_self    = 0;     // 当前线程的分片序号 + 1, 为 0 表示还未分配
+
+static uint64_t _logNsNow();                    // 单调时钟(ns)
+static uint64_t _logLockTimed(pthread_mutex_t* m);  // 加锁, 发生竞争时返回等待的时间(ns), 否则返回 0
+static void     _logStatAdd(LogPtr log, uint64_t begin, uint64_t lockwait, uint64_t consolewait);  // 记录到当前线程的分片, begin 为 0 时不计入直方图
+static void     _logStatsCollect(LogPtr log, LogStats* st);    // 累加日志的计数器和所有分片到 st
+static unsigned _logHistIndex(uint64_t ns);     // 耗时对应的直方图桶
+static uint64_t _logHistValue(unsigned idx);    // 直方图桶的上界(ns)
+
+/* ---------------------- flush private prototypes ---------------------------- */
+static bool         _flush_running   = false;   // 定时 fflush 线程是否在运行
+static bool         _flush_stop      = false;   // 通知定时线程退出
+static pthread_t    _flush_ticker;              // 定时 fflush 线程
+static pthread_mutex_t _flush_locker = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  _flush_cond   = PTHREAD_COND_INITIALIZER;   // 唤醒定时线程退出
+static _logSite*    _logsys_sites    = NULL;    // 限速的调用点链表, 只增不减, 调用点是 static 变量, 总是有效的
+
+static void     _logFlushCheck(LogFilePtr file);     // 按 fflush 策略决定是否 fflush, 须持有 file->locker
+static void     _logFlush(LogPtr log);          // 立即 fflush, 异步模式下先等待已入队的记录写入
+static int      _logFlushStart();               // 启动定时 fflush 线程
+static void     _logFlushStop();                // 停止定时 fflush 线程
+static uint64_t _logMsNow();                    // 获取单调时钟(毫秒), 使用 vDSO 粗粒度时钟
+static void     _logSiteFlush();                // 报告窗口已结束的限速调用点被抑制的条数
+
+/* ---------------------- io engine private prototypes ---------------------------- */
+static void     _logFileWrite(LogFilePtr file, const char* data, size_t len);   // 按写入引擎写入一段数据, 须持有 file->locker
+static void     _logFileFlush(LogFilePtr file);      // 按写入引擎写出缓冲的内容, 须持有 file->locker
+static void     _logDirectVWrite(LogFilePtr file, bool timed, constr prefix, constr text, va_list ap);  // 渲染一条记录到当前缓冲区, 须持有 file->locker
+static void     _logDirectSubmit(LogFilePtr file, const char* extra, size_t elen);  // 交换缓冲区, 在锁外 writev 写满的缓冲区和 extra, LOG_IO_URING 交给 io_uring
+static void     _logDirectWait(LogFilePtr file);     // 等待正在进行的 writev 和 io_uring 写入完成, 须持有 file->locker
+static ssize_t  _logWritev(int fd, struct iovec* iov, int cnt);            // writev 直到全部写入或出错
+static void     _logFileDetach(LogFilePtr file);     // 写出缓冲的内容并结束引擎对当前文件的使用, LOG_IO_MMAP 截断到实际长度, 须持有 file->locker
+static int      _logFileAttach(LogFilePtr file);     // 引擎开始使用当前文件, LOG_IO_MMAP 预分配并映射, 失败时退回 stdio, 须持有 file->locker
+static size_t   _logMmapTrim(LogFilePtr file);       // 截掉进程崩溃时残留在文件末尾的预分配 '\0', 返回截掉的字节数, 须持有 file->locker
+static void     _logMmapVWrite(LogFilePtr file, bool timed, constr prefix, constr text, va_list ap);   // 渲染一条记录到映射窗口, 须持有 file->locker
+static void     _logMmapWrite(LogFilePtr file, const char* data, size_t len);   // 拷贝数据到映射窗口, 窗口写满时推进, 须持有 file->locker
+static int      _logMmapMap(LogFilePtr file);        // fallocate 预分配并映射 moff 处的窗口
+
+/* ---------------------- uring private prototypes ---------------------------- */
+#ifdef LOG_HAVE_URING
+static _logUring       _uring        = {.fd = -1};  // 所有 LOG_IO_URING 日志共享的 io_uring 实例
+static pthread_mutex_t _uring_locker = PTHREAD_MUTEX_INITIALIZER;  // 保护 _uring 和各日志的 uiov
+#endif
+static __thread bool   _uring_defer  = false;       // 为 true 时放入提交队列后不立即提交, 由写线程在批次结束时统一提交
+
+static int  _logUringInit();                    // 创建共享的 io_uring 实例, 已创建时直接返回, 内核不支持时返回 LOG_ERR
+static void _logUringRelease();                 // 释放共享的 io_uring 实例
+static int  _logUringQueue(LogFilePtr file, char* buf, size_t len);  // 把缓冲区放入提交队列并置 ubusy, 须持有 file->locker
+static void _logUringSubmit();                  // 提交队列中的所有项, 并处理已完成的项
+static void _logUringWait(LogFilePtr file);          // 等待日志正在由 io_uring 写入的缓冲区完成, 须持有 file->locker
+#ifdef LOG_HAVE_URING
+static int  _logUringPrep(LogFilePtr file);          // 把 file->uiov 放入提交队列, 须持有 _uring_locker
+static int  _logUringEnter(unsigned wait);      // 提交队列中的项, wait 为 1 时等待至少一项完成, 须持有 _uring_locker
+static void _logUringReap();                    // 处理已完成的项, 短写时重新提交剩余部分, 须持有 _uring_locker
+#endif
+
+/* ---------------------- binary private prototypes ---------------------------- */
+static _logFormat*  _fmt_slots[DF_LOG_FORMATS * 2]; // 以格式化字串指针为 key 的开放地址 hash 表, 只增不减, 无锁读取
+static _logFormat*  _fmt_list[DF_LOG_FORMATS + 1];  // 按 id 索引的格式化字串
+static unsigned     _fmt_count       = 0;           // 已记录的格式化字串数量
+static pthread_mutex_t _fmt_locker   = PTHREAD_MUTEX_INITIALIZER;  // 添加格式化字串时使用
+static int          _fmt_full        = 0;           // 表已满: 1 待报告, 2 已报告
+static uintptr_t    _fmt_ranges[DF_LOG_FMT_RANGES][2];  // 已加载模块的只读段 [起始, 结束), 字面量格式化字串只会在其中
+static int          _fmt_nranges     = -1;          // 只读段数量, -1 表示还未收集
+
+static _logFormat* _logFmtFind(constr key);     // 查找或添加格式化字串, 不能使用二进制记录时返回 NULL
+static _logFormat* _logFmtCreate(constr fmt);   // 解析格式化字串, 创建 _logFormat
+static int    _logFmtParse(constr fmt, _logFmtSpec* specs, int max);    // 解析格式化字串中的转换说明, 有不支持的转换说明时返回 -1
+static void   _logFmtRelease();                 // 释放所有格式化字串
+static bool   _logFmtLiteral(constr key);       // 格式化字串是否位于只读段中(字面量)
+static int    _logFmtRange(struct dl_phdr_info* info, size_t size, void* arg);    // dl_iterate_phdr 回调, 收集只读段
+static void   _logFmtReport();                  // 报告格式化字串表已满, 由定时线程调用
+static size_t _logBinEncode(char* buf, size_t cap, bool timed, constr prefix, constr text, va_list ap);   // 编码一条二进制记录到 buf 中
+static size_t _logBinRender(char* buf, size_t cap, size_t* tlen, const char* rec, size_t len, const _logFormat* f);  // 把二进制记录渲染为文本
+static const _logFormat* _logBinLookup(const char* rec);   // 返回二进制记录使用的格式化字串, 没有时返回 NULL
+static void   _logBinVWrite(LogFilePtr file, bool timed, constr prefix, constr text, va_list ap);   // 编码一条二进制记录并写入, 须持有 file->locker
+static void   _logBinWrite(LogFilePtr file, const char* rec, size_t len); // 写入一条二进制记录, 需要时先写入段标记和格式化字串定义, 须持有 file->locker
+static void   _logBinEnd(LogFilePtr file);           // 结束当前二进制段, 须持有 file->locker
+
+/* ---------------------- blackbox private prototypes ---------------------------- */
+static LogBox* _logBoxOpen(constr path, size_t size);   // 打开或创建黑匣子文件并映射, 大小相同时保留已有记录
+static void    _logBoxWrite(LogBox* box, const char* data, size_t len);    // 原子预留 head 并 memcpy 到环形缓冲区, 不需要锁
+static void    _logBoxUnmap(void* box);         // 解除黑匣子的映射, 作为 _logRetire 的析构函数
 
 /* ---------------------- logcheck private prototypes ---------------------------- */
 static int _check_logsys(constr name, constr tag);         // 检查服务是否开启, 并输出相应提示信息
 static int _check_name(constr name, constr tag);           // 检查 name 是否合法, 并输出相应提示信息
 static int _check_path(constr path, constr tag);           // 检查 path 是否合法, 并输出相应提示信息
 static LogPtr _check_log(constr name, constr tag);         // 检查 log 是否存在, 并输出相应提示信息
+static LogPtr _check_handle(LogHandle h);                  // 检查句柄是否有效, 不输出提示信息
 static int _check_size_mb(size_t size_mb, constr name, constr tag);  // 检查 log 是否存在, 并输出相应提示信息
 
 
@@ -463,6 +658,7 @@ unsigned int _loghashFunction (const void *key)
 
 void _valDestructor( void *obj)
 {
+    if(!obj)    return;
     _logReset(obj);
     free(obj);
 }
@@ -483,7 +679,7 @@ int logsysInit()
         if(!_sys_log)
         {   logShow("log system init err!\n");   return LOG_ERR;  }
     }
-    _sys_log->maxsize = _logsys_filesize << 20;      // 设置内部日志文件最大限制, 默认为 1 MB
+    _sys_log->file->maxsize = _logsys_filesize << 20;      // 设置内部日志文件最大限制, 默认为 1 MB
     _logsys_service = true;
 
     logsysAddText(NULL, "\n");
@@ -510,12 +706,20 @@ int logsysInit()
         }
     }
 
-    /* 初始化互斥量 */
-    pthread_mutex_init(&consoleLocker, 0);
-    pthread_mutex_init(&sysfileLocker, 0);
-    pthread_mutex_init(&fileLocker, 0);
-
     logsysAddText(NULL, " ok\n");
+
+    /* 如有需要, 启动控制台线程 */
+    if(_logsys_console && LOG_ERR == _logConsoleStart())
+        logsysAddNMute(NULL, "--Starting console writer... err: %s\n", strerror(errno));
+
+    /* 如有需要, 启动异步写线程 */
+    if(__atomic_load_n(&_logsys_async, __ATOMIC_RELAXED) && LOG_ERR == _logAsyncStart())
+        logsysAddNMute(NULL, "--Starting async writer... err: %s\n", strerror(errno));
+
+    /* 如有需要, 启动定时线程写入计数器, 报告限速调用点被抑制的条数 */
+    if((_logsys_dump || __atomic_load_n(&_logsys_sites, __ATOMIC_ACQUIRE)) && LOG_ERR == _logFlushStart())
+        logsysAddNMute(NULL, "--Starting counters dumper... err: %s\n", strerror(errno));
+
     logsysAdd(NULL, "[-------------- log system initial ok -----------------]\n");
     return LOG_OK;
 }
@@ -527,7 +731,10 @@ void logsysStop()
 {
     if(!_logsys_service)  return;
 
+    _logAsyncStop();
+    _logFlushStop();
     logsysAdd(NULL, "[______________ log system stoped! ____________________]\n\n");
+    _logConsoleStop();
     _logsys_service = false;
     _logReset(_sys_log);
     free(_sys_log);
@@ -543,15 +750,24 @@ void logsysRelease()
 
     if(_logsys_dic)
     {
+        /* 撤下快照, 等待所有读者离开后释放所有日志 */
+        pthread_mutex_lock(&_dictLocker);
+        for(unsigned int i = 0; i < MAX_LOG_HANDLES; i++)
+            if(_logsys_handles[i].log)  _logHandleClose(_logsys_handles[i].log);
+        _logRetire(__atomic_exchange_n(&_logsys_snap, NULL, __ATOMIC_ACQ_REL), free);
+        _logSynchronize();
+        _logReclaim();
+        memset(_level_counts, 0, sizeof(_level_counts));
+        _logLevelUpdate();
+        pthread_mutex_unlock(&_dictLocker);
+
         _logdictRelease(_logsys_dic);   // _logdictRelease 最后会释放 _logsys_dic 本身, 不需要进一步 free
         _logsys_dic = NULL;
         free(_logsys_dictype);
         _logsys_dictype = NULL;
     }
-
-    pthread_mutex_destroy(&consoleLocker);
-    pthread_mutex_destroy(&sysfileLocker);
-    pthread_mutex_destroy(&fileLocker);
+    _logUringRelease();
+    _logFmtRelease();
 }
 
 /**
@@ -582,7 +798,7 @@ int logsysSetFileSize(size_t size_mb)
 
     if(_logsys_service)
     {
-        _sys_log->maxsize = _logsys_filesize;
+        _sys_log->file->maxsize = _logsys_filesize;
         logsysAdd(NULL, "--Set logsys filesize to [%d]\n", _logsys_filesize);
     }
 
@@ -600,7 +816,11 @@ int  logsysFlieEmpty()
         return LOG_ERR;
     }
 
-    if(0 == _logFlieEmpty(_sys_log)){
+    int ret;
+    pthread_mutex_lock(&_sys_log->file->locker);
+    ret = _logFlieEmpty(_sys_log->file);
+    pthread_mutex_unlock(&_sys_log->file->locker);
+    if(0 == ret){
         logsysAdd(NULL, "--Empty logsys file... ok: Log file had been truncated \n");
         return LOG_OK;
     }
@@ -611,6 +831,193 @@ int  logsysFlieEmpty()
     }
 }
 
+/**
+ * @brief logsysSetAsync - 设置用户日志的异步模式, 程序运行期间一直有效
+ * @param async 为 true 时, logAdd* 只把渲染好的记录放入有界无锁队列, 由后台线程批量写入文件;
+ *              为 false 时, 写完队列中剩余的记录后, 恢复为同步写入
+ * @return 成功返回 LOG_OK; 写线程启动失败返回 LOG_ERR
+ * @note   队列满时记录会被丢弃, 丢弃数量会记录到系统日志中
+ */
+int logsysSetAsync(bool async)
+{
+    __atomic_store_n(&_logsys_async, async, __ATOMIC_RELAXED);
+    if(!_logsys_service)    return LOG_OK;
+
+    if(async)
+    {
+        if(LOG_ERR == _logAsyncStart()){
+            logsysAdd(NULL, "--Set logsys async mode... err: %s\n", strerror(errno));
+            return logsysShow("--Set logsys async mode... err: %s\n", strerror(errno));
+        }
+        logsysAdd(NULL, "--Set logsys async mode to [ON]\n");
+    }
+    else
+    {
+        _logAsyncStop();
+        logsysAdd(NULL, "--Set logsys async mode to [OFF]\n");
+    }
+    return LOG_OK;
+}
+
+/**
+ * @brief logsysSetConsoleAsync - 设置控制台输出的异步模式, 程序运行期间一直有效, 对所有日志生效
+ * @param async 开启后控制台输出只在锁内 memcpy 到缓冲区, 由后台线程合并后批量写出, 缓冲区满时丢弃
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ */
+int logsysSetConsoleAsync(bool async)
+{
+    _logsys_console = async;
+    if(!_logsys_service)    return LOG_OK;
+
+    if(async)
+    {
+        if(LOG_ERR == _logConsoleStart()){
+            logsysAdd(NULL, "--Set logsys console async mode... err: %s\n", strerror(errno));
+            return logsysShow("--Set logsys console async mode... err: %s\n", strerror(errno));
+        }
+        logsysAdd(NULL, "--Set logsys console async mode to [ON]\n");
+    }
+    else
+    {
+        _logConsoleStop();
+        logsysAdd(NULL, "--Set logsys console async mode to [OFF]\n");
+    }
+    return LOG_OK;
+}
+
+/**
+ * @brief logsysSetTimePrecision - 设置日志时间前缀的精度, 程序运行期间一直有效, 对所有日志生效
+ * @param prec  LOG_TS_SEC: "[%Y-%m-%d %H:%M:%S] "; LOG_TS_MSEC: 附加毫秒(默认); LOG_TS_USEC: 附加微秒
+ * @return 成功返回 LOG_OK; 参数不合法返回 LOG_ERR
+ */
+int logsysSetTimePrecision(int prec)
+{
+    if(LOG_TS_SEC != prec && LOG_TS_MSEC != prec && LOG_TS_USEC != prec)
+    {
+        logsysAdd(NULL, "--Set logsys time precision... err: precision %d is illegal\n", prec);
+        return logsysShow("--Set logsys time precision... err: precision %d is illegal\n", prec);
+    }
+
+    _logsys_timeprec = prec;
+    logsysAdd(NULL, "--Set logsys time precision to [%d]\n", prec);
+    return LOG_OK;
+}
+
+/**
+ * @brief logsysSetLevel - 设置系统日志的调式信息级别, 同时作为之后新建日志的默认级别
+ * @param level LOG_LV_OFF / LOG_LV_ERR / LOG_LV_WARNING / LOG_LV_INFO(默认)
+ * @return 成功返回 LOG_OK; 参数不合法返回 LOG_ERR
+ * @note   已创建的日志不受影响, 请使用 logSetLevel() 单独设置
+ */
+int logsysSetLevel(int level)
+{
+    if(level < LOG_LV_OFF || level > LOG_LV_INFO)
+    {
+        logsysAdd(NULL, "--Set logsys level... err: level %d is illegal\n", level);
+        return logsysShow("--Set logsys level... err: level %d is illegal\n", level);
+    }
+
+    pthread_mutex_lock(&_dictLocker);
+    __atomic_store_n(&_logsys_level, level, __ATOMIC_RELAXED);
+    _logLevelUpdate();
+    pthread_mutex_unlock(&_dictLocker);
+    logsysAdd(NULL, "--Set logsys level to [%d]\n", level);
+    return LOG_OK;
+}
+
+/**
+ * @brief logsysSetDumpInterval - 设置定时把用户日志计数器写入系统日志的间隔, 程序运行期间一直有效
+ * @param seconds 间隔(秒), 为 0 时不定时写入(默认)
+ * @return 成功返回 LOG_OK; 参数不合法或定时线程启动失败返回 LOG_ERR
+ * @note   由定时 fflush 线程顺带完成, 不会额外创建线程
+ */
+int logsysSetDumpInterval(int seconds)
+{
+    if(seconds < 0)
+    {
+        logsysAdd(NULL, "--Set logsys dump interval... err: interval %d is illegal\n", seconds);
+        return logsysShow("--Set logsys dump interval... err: interval %d is illegal\n", seconds);
+    }
+
+    __atomic_store_n(&_logsys_dump, seconds, __ATOMIC_RELAXED);
+    if(!_logsys_service)    return LOG_OK;
+
+    if(seconds && LOG_ERR == _logFlushStart())
+    {
+        logsysAdd(NULL, "--Set logsys dump interval... err: %s\n", strerror(errno));
+        return logsysShow("--Set logsys dump interval... err: %s\n", strerror(errno));
+    }
+    logsysAdd(NULL, "--Set logsys dump interval to [%d]\n", seconds);
+    return LOG_OK;
+}
+
+/**
+ * @brief logsysDump - 立即把所有用户日志的计数器写入系统日志
+ * @return 成功返回 LOG_OK; 服务未开启返回 LOG_ERR
+ */
+int logsysDump()
+{
+    _logSnap* snap;
+    unsigned long i;
+
+    if(!_logsys_service)    return logsysShow("--Dump counters... err: logsys serve is off\n");
+
+    _logReadLock();
+    if((snap = __atomic_load_n(&_logsys_snap, __ATOMIC_ACQUIRE)))
+        for(i = 0; i <= snap->sizemask; i++)
+            if(snap->slots[i].v)    _logDumpCounters(snap->slots[i].v);
+    _logReadUnlock();
+    return LOG_OK;
+}
+
+/**
+ * @brief logsysSetStats - 设置是否统计写入调用的耗时, 程序运行期间一直有效, 对所有日志生效
+ * @param on    为 true 时(默认), 每次写入调用前后各读一次单调时钟, 耗时记录到直方图中
+ * @return LOG_OK
+ * @note   计数器 和 锁等待时间不受影响, 始终统计
+ */
+int logsysSetStats(bool on)
+{
+    __atomic_store_n(&_logsys_stats, on, __ATOMIC_RELAXED);
+    if(_logsys_service)
+        logsysAdd(NULL, "--Set logsys stats to [%s]\n", on ? "ON" : "OFF");
+    return LOG_OK;
+}
+
+/**
+ * @brief logsysStats - 获取所有用户日志统计信息的总和
+ * @param st    输出
+ * @return 成功返回 LOG_OK; 服务未开启或 st 为 NULL 返回 LOG_ERR
+ */
+int logsysStats(LogStats* st)
+{
+    _logSnap* snap;
+    unsigned long i;
+
+    if(!st)                 return LOG_ERR;
+    if(!_logsys_service)    return logsysShow("--Get logsys stats... err: logsys serve is off\n");
+
+    bzero(st, sizeof(*st));
+    _logReadLock();
+    if((snap = __atomic_load_n(&_logsys_snap, __ATOMIC_ACQUIRE)))
+        for(i = 0; i <= snap->sizemask; i++)
+            if(snap->slots[i].v)    _logStatsCollect(snap->slots[i].v, st);
+    _logReadUnlock();
+    return LOG_OK;
+}
+
+/**
+ * @brief _logLevelUpdate - 重新计算所有日志中最高的调式信息级别
+ * @note  须持有 _dictLocker; 调式宏只读取这个值, 所以级别降低后, 被关闭的调用点只需一次原子读
+ */
+static void _logLevelUpdate()
+{
+    int level = LOG_LV_INFO;
+
+    while(level > _logsys_level && !_level_counts[level])   level--;
+    __atomic_store_n(&_logsys_maxlevel, level, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief logsysShowTime - logsys 的纯输出函数, 输出时间
  * @return LOG_ERR
@@ -623,12 +1030,12 @@ int logsysShowTime()
 {
     // 如果服务未开启, logsys*不会有输出, 所以强制输出
     if(!_logsys_service){
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
+        _logConsole(_timeStr(TS_LOG), NULL, NULL, NULL, NULL);
         return LOG_ERR;
     }
     // 服务开启, 且是 静默模式, logsys*不会有输出, 所以输出
     if(_logsys_mutetype)
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
+        _logConsole(_timeStr(TS_LOG), NULL, NULL, NULL, NULL);
 
     return LOG_ERR;
 }
@@ -641,17 +1048,13 @@ int logsysShowText(constr text, ...)
 
     // 如果服务未开启, logsys*不会有输出, 所以强制输出
     if(!_logsys_service){
-        pthread_mutex_lock(&consoleLocker);
-        vfprintf(stderr, text, argptr);
-        pthread_mutex_unlock(&consoleLocker);
+        _logConsoleV(NULL, NULL, NULL, NULL, text, argptr);
         va_end(argptr);
         return LOG_ERR;
     }
     // 服务开启, 且是 静默模式, logsys*不会有输出, 所以输出
     if(_logsys_mutetype){
-        pthread_mutex_lock(&consoleLocker);
-        vfprintf(stderr, text, argptr);
-        pthread_mutex_unlock(&consoleLocker);
+        _logConsoleV(NULL, NULL, NULL, NULL, text, argptr);
         va_end(argptr);
         return LOG_ERR;
     }
@@ -666,25 +1069,56 @@ int logsysShow(constr text, ...)
 
     // 如果服务未开启, logsys*不会有输出, 所以强制输出
     if(!_logsys_service){
-        pthread_mutex_lock(&consoleLocker);
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
-        vfprintf(stderr, text, argptr);
-        pthread_mutex_unlock(&consoleLocker);
+        _logConsoleV(_timeStr(TS_LOG), NULL, NULL, NULL, text, argptr);
         va_end(argptr);
         return LOG_ERR;
     }
     // 服务开启, 且是 静默模式, logsys*不会有输出, 所以输出
     if(_logsys_mutetype){
-        pthread_mutex_lock(&consoleLocker);
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
-        vfprintf(stderr, text, argptr);
-        pthread_mutex_unlock(&consoleLocker);
+        _logConsoleV(_timeStr(TS_LOG), NULL, NULL, NULL, text, argptr);
         va_end(argptr);
         return LOG_ERR;
     }
     return LOG_ERR;
 }
 
+/**
+ * @brief _logsysVWrite - 系统日志的统一写入入口, 所有 logsysAdd* 最终都调用这里
+ * @param name      标记, 写在时间之后, 可以为 NULL
+ * @param console   是否同时输出到控制台
+ * @param timed     是否添加时间前缀
+ * @note  只渲染一次, 文件和控制台输出相同的内容
+ */
+static void _logsysVWrite(constr name, bool console, bool timed, constr prefix, constr text, va_list ap)
+{
+    size_t len, tlen, nlen = name ? strlen(name) : 0;
+    char* line;
+
+    _logFileShrink(_sys_log->file);
+    if(!(line = _logLineV(&len, &tlen, timed, prefix, text, ap)))
+        return;
+
+    /* 写入日志到 系统日志 中 */
+    pthread_mutex_lock(&_sys_log->file->locker);
+    _logFileWrite(_sys_log->file, line, tlen);
+    if(name)
+    {
+        _logFileWrite(_sys_log->file, "[", 1);
+        _logFileWrite(_sys_log->file, name, nlen);
+        _logFileWrite(_sys_log->file, "] ", 2);
+    }
+    _logFileWrite(_sys_log->file, line + tlen, len - tlen);
+    _logFlushCheck(_sys_log->file);
+    pthread_mutex_unlock(&_sys_log->file->locker);
+    /* 如果需要, 输出日志到 控制台 中 */
+    if(console && name)
+        _logConsoleWritev((struct iovec[]){{line, tlen}, {"[", 1}, {(void*)name, nlen}, {"] ", 2}, {line + tlen, len - tlen}}, 5);
+    else if(console)
+        _logConsoleWritev(&(struct iovec){line, len}, 1);
+
+    _logLineEnd(line);
+}
+
 /**
  * @brief logsysAddText - 添加 Text 到系统日志
  * @param name  日志名, 这里其实为标记, 用以区分不同的日志, logsys 默认为日志系统内部使用, 所以不检测存在性
@@ -694,70 +1128,27 @@ void logsysAddText(constr name, constr text, ...)
 {
     if(!_logsys_service || !_sys_log || !text || !(*text))  return;
 
-    _logFileShrink(_sys_log);
-
     va_list argptr;
     va_start(argptr, text);
-
-    /* 写入日志到 系统日志 中 */
-    pthread_mutex_lock(&sysfileLocker);
-    if(name)    fprintf(_sys_log->fp, "[%s] ", name);
-    vfprintf(_sys_log->fp, text, argptr);
-    fflush(_sys_log->fp);
-    pthread_mutex_unlock(&sysfileLocker);
-    /* 如果需要, 输出日志到控制台 */
-    if(!_sys_log->mutetype)
-    {
-        pthread_mutex_lock(&consoleLocker);
-        va_start(argptr, text);
-        if(name)    fprintf(stderr, "[%s] ", name);
-        vfprintf(stderr, text, argptr);
-        pthread_mutex_unlock(&consoleLocker);
-    }
-
+    _logsysVWrite(name, !_sys_log->mutetype, false, NULL, text, argptr);
     va_end(argptr);
 }
 void logsysAddTextMute(constr name, constr text, ...)
 {
     if(!_logsys_service || !_sys_log || !text || !(*text))  return;
 
-    _logFileShrink(_sys_log);
-
     va_list argptr;
     va_start(argptr, text);
-
-    /* 写入日志到 系统日志 中 */
-    pthread_mutex_lock(&sysfileLocker);
-    if(name)    fprintf(_sys_log->fp, "[%s] ", name);
-    vfprintf(_sys_log->fp, text, argptr);
-    fflush(_sys_log->fp);
-    pthread_mutex_unlock(&sysfileLocker);
-
+    _logsysVWrite(name, false, false, NULL, text, argptr);
     va_end(argptr);
 }
 void logsysAddTextNMute(constr name, constr text, ...)
 {
     if(!_logsys_service || !_sys_log || !text || !(*text))  return;
 
-    _logFileShrink(_sys_log);
-
     va_list argptr;
     va_start(argptr, text);
-
-    /* 写入日志到 系统日志 中 */
-    pthread_mutex_lock(&sysfileLocker);
-    if(name)    fprintf(_sys_log->fp, "[%s] ", name);
-    vfprintf(_sys_log->fp, text, argptr);
-    fflush(_sys_log->fp);
-    pthread_mutex_unlock(&sysfileLocker);
-
-    /* 输出日志到 控制台 中 */
-    pthread_mutex_lock(&consoleLocker);
-    va_start(argptr, text);
-    if(name)    fprintf(stderr, "[%s] ", name);
-    vfprintf(stderr, text, argptr);
-    pthread_mutex_unlock(&consoleLocker);
-
+    _logsysVWrite(name, true, false, NULL, text, argptr);
     va_end(argptr);
 }
 
@@ -770,29 +1161,9 @@ void logsysAdd(constr name, constr text, ...)
 {
     if(!_logsys_service || !_sys_log || !text || !(*text))  return;
 
-    _logFileShrink(_sys_log);
-
     va_list argptr;
     va_start(argptr, text);
-
-    /* 写入日志到 系统日志 中 */
-    pthread_mutex_lock(&sysfileLocker);
-    fprintf(_sys_log->fp, "%s", _timeStr(TS_LOG));
-    if(name) fprintf(_sys_log->fp, "[%s] ", name);
-    vfprintf(_sys_log->fp, text, argptr);
-    fflush(_sys_log->fp);
-    pthread_mutex_unlock(&sysfileLocker);
-    /* 输出日志到 控制台 中 */
-    if(!_sys_log->mutetype)
-    {
-        pthread_mutex_lock(&consoleLocker);
-        va_start(argptr, text);
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
-        if(name) fprintf(stderr, "[%s] ", name);
-        vfprintf(stderr, text, argptr);
-        pthread_mutex_unlock(&consoleLocker);
-    }
-
+    _logsysVWrite(name, !_sys_log->mutetype, true, NULL, text, argptr);
     va_end(argptr);
 }
 
@@ -805,19 +1176,9 @@ void logsysAddMute(constr name, constr text, ...)
 {
     if(!_logsys_service || !_sys_log || !text || !(*text))  return;
 
-    _logFileShrink(_sys_log);
-
     va_list argptr;
     va_start(argptr, text);
-
-    /* 写入日志到 系统日志 中 */
-    pthread_mutex_lock(&sysfileLocker);
-    fprintf(_sys_log->fp, "%s", _timeStr(TS_LOG));
-    if(name)    fprintf(_sys_log->fp, "[%s] ", name);
-    vfprintf(_sys_log->fp, text, argptr);
-    fflush(_sys_log->fp);
-    pthread_mutex_unlock(&sysfileLocker);
-
+    _logsysVWrite(name, false, true, NULL, text, argptr);
     va_end(argptr);
 }
 /**
@@ -829,27 +1190,37 @@ void logsysAddNMute(constr name, constr text, ...)
 {
     if(!_logsys_service || !_sys_log || !text || !(*text))  return;
 
-    _logFileShrink(_sys_log);
-
     va_list argptr;
     va_start(argptr, text);
+    _logsysVWrite(name, true, true, NULL, text, argptr);
+    va_end(argptr);
+}
 
-    /* 写入日志到 系统日志 中 */
-    pthread_mutex_lock(&sysfileLocker);
-    fprintf(_sys_log->fp, "%s", _timeStr(TS_LOG));
-    if(name)    fprintf(_sys_log->fp, "[%s] ", name);
-    vfprintf(_sys_log->fp, text, argptr);
-    fflush(_sys_log->fp);
-    pthread_mutex_unlock(&sysfileLocker);
-
-    /* 输出日志到 控制台 中 */
-    va_start(argptr, text);
-    pthread_mutex_lock(&consoleLocker);
-    fprintf(stderr, "%s", _timeStr(TS_LOG));
-    if(name)    fprintf(stderr, "[%s] ", name);
-    vfprintf(stderr, text, argptr);
-    pthread_mutex_unlock(&consoleLocker);
+/**
+ * @brief logsysAddDebug - 系统调式日志 API, 供 logsysErr/logsysWarning/logsysInfo 使用
+ * @param name  日志名, 仅作为标记
+ * @param level 本条信息的级别, 高于系统日志级别时直接返回
+ * @param text  宏在编译期拼接好的前缀格式, 后跟 file, line, func, errno, 用户格式化字串 和 用户参数
+ */
+void logsysAddDebug(constr name, int level, constr text, ...)
+{
+    if(!_logsys_service || !_sys_log)  return;
+    if(level > __atomic_load_n(&_logsys_level, __ATOMIC_RELAXED))  return;
+
+    char prefix[MAX_DEBUG_PREFIX];
+    va_list argptr;
+    constr file, func, format;
+    int line, err;
 
+    va_start(argptr, text);
+    file   = va_arg(argptr, constr);
+    line   = va_arg(argptr, int);
+    func   = va_arg(argptr, constr);
+    err    = va_arg(argptr, int);
+    format = va_arg(argptr, constr);
+    _logDebugPrefix(prefix, text, file, line, func, err, &format);
+
+    _logsysVWrite(name, !_sys_log->mutetype, true, prefix, format, argptr);
     va_end(argptr);
 }
 
@@ -860,7 +1231,7 @@ void logsysAddNMute(constr name, constr text, ...)
  */
 void logShowTime()
 {
-    fprintf(stderr, "%s", _timeStr(TS_LOG));
+    _logConsole(_timeStr(TS_LOG), NULL, NULL, NULL, NULL);
 }
 /**
  * @brief logShowText - 显示 text 到控制台
@@ -873,7 +1244,7 @@ void logShowText(constr text, ...)
     va_list argptr;
     va_start(argptr, text);
 
-    vfprintf(stderr, text, argptr);
+    _logConsoleV(NULL, NULL, NULL, NULL, text, argptr);
 
     va_end(argptr);
 }
@@ -888,45 +1259,111 @@ void logShow(constr text, ...)     // 打印时间和内容到控制台
     va_list argptr;
     va_start(argptr, text);
 
-    logShowTime();
-    vfprintf(stderr, text, argptr);
+    _logConsoleV(_timeStr(TS_LOG), NULL, NULL, NULL, text, argptr);
 
     va_end(argptr);
 }
 
 void _logReset(LogPtr log)
 {
+    /* 写入剩余的摘要行, 异步模式下写线程可能晚于释放才写入, 直接丢弃(logDestroy 已先写入) */
+    if(log->dupcount && log->file && log->file->fp && !__atomic_load_n(&_async_running, __ATOMIC_ACQUIRE))
+        _logDedupFlush(log);
+    /* 文件被其他日志共享时只释放引用, 由最后一个共享者关闭 */
+    if(log->file && !--log->file->refs)
+        _logFileClose(log->file);
     if(log->name)   free(log->name);
-    if(log->path)   free(log->path);
-    if(log->fp)     fclose(log->fp);
+    free(log->stats);
+    pthread_mutex_destroy(&log->dlocker);
     bzero(log, sizeof(*log));
 }
 
+/**
+ * @brief _logFileOpen - 打开日志文件, 创建日志文件结构
+ * @param name      打开它的日志的名称, 用于提示
+ * @param path      路径
+ * @return 成功返回引用数为 1 的日志文件结构; 失败返回 NULL, errno 为打开失败的原因
+ */
+static LogFilePtr _logFileOpen(constr name, constr path)
+{
+    LogFilePtr file;
+    FILE* fp;
+
+    if(!path || !*path) return NULL;
+    _mkdir(name, path, 0755);
+    if(!(fp = fopen(path, "a+")))   return NULL;
+    if(!(file = calloc(sizeof(*file), 1)))
+    {
+        fclose(fp);
+        return NULL;
+    }
+    pthread_mutex_init(&file->locker, 0);
+    pthread_cond_init(&file->wcond, 0);
+    if(name && *name) file->name = strdup(name);
+    file->path     = strdup(path);
+    file->fp       = fp;
+    file->cursize  = _logFileStatSize(fp);
+    _logFileIdentity(file);
+    file->maxsize  = DF_LOG_SIZE << 20;             // 默认日志文件大小 DF_LOG_SIZE MB
+    file->rotate   = DF_LOG_ROTATE;
+    file->segstart = _timeNow();
+    file->flush    = DF_LOG_FLUSH;
+    file->engine   = DF_LOG_ENGINE;
+    file->refs     = 1;
+    return file;
+}
+
+/**
+ * @brief _logFileClose - 关闭日志文件, 释放日志文件结构
+ */
+static void _logFileClose(LogFilePtr file)
+{
+    if(file->fp && (LOG_IO_STDIO != file->engine || file->binseg))
+    {
+        pthread_mutex_lock(&file->locker);
+        _logFileDetach(file);
+        pthread_mutex_unlock(&file->locker);
+    }
+    if(file->name)  free(file->name);
+    if(file->path)  free(file->path);
+    if(file->fp)    fclose(file->fp);
+    if(file->box)   _logBoxUnmap(file->box);
+    free(file->wbuf[0]);
+    free(file->wbuf[1]);
+    free(file->bindef);
+    pthread_mutex_destroy(&file->locker);
+    pthread_cond_destroy(&file->wcond);
+    free(file);
+}
+
 /**
  * @brief _logInit - 根据传入参数初始化 log 结构体
  * @param log       要初始化的log结构体指针
  * @param name      名称
  * @param path      路径
  * @param mutetype  静默模式
+ * @param file      要共享的日志文件, 为 NULL 时打开 path
  * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
  * @note   如果返回 LOG_OK, 说明 路径一定合法, 并且已成功打开
  */
-static int _logInit(LogPtr log, constr name, constr path, bool mutetype)
+static int _logInit(LogPtr log, constr name, constr path, bool mutetype, LogFilePtr file)
 {
+    pthread_mutex_init(&log->dlocker, 0);
+    if(!posix_memalign((void**)&log->stats, __alignof__(*log->stats), LOG_STAT_SHARDS * sizeof(*log->stats)))
+        bzero(log->stats, LOG_STAT_SHARDS * sizeof(*log->stats));
+    else
+        log->stats = NULL;  // 分配失败时不统计耗时, 不影响写入
     if(name && *name) log->name = strdup(name);
-    if(path && *path)
-    {
-        _mkdir(log->name, path, 0755);
-        log->path     = strdup(path);
-        log->fp       = fopen(log->path, "a+");
-        log->maxsize  = DF_LOG_SIZE << 20;          // 默认日志文件大小 DF_LOG_SIZE MB
-        log->mutetype = mutetype;
-    }
-    if(!path || !log->fp)
+    log->level    = _logsys_level;
+    log->mutetype = mutetype;
+    if(file)
+        file->refs++;
+    else if(!(file = _logFileOpen(name, path)))
     {
         logsysWarning(name, "Can not Create file \"%s\", %s\n", path, strerror(errno));
         return LOG_ERR;
     }
+    log->file = file;
 
     return LOG_OK;
 }
@@ -937,7 +1374,7 @@ static int _logInit(LogPtr log, constr name, constr path, bool mutetype)
  * @param path      文件路径, 日志信息会存到此处; 若不可读写, 会在 DF_LOG_DIR 下创建一个临时文件
  * @param mutetype  所创建日志的静默属性
  * @return 创建的日志结构指针, 若失败, 则返回 NULL
- * @note   只要返回值不为 NULL, 那么 path 和 fp 肯定不是 NULL
+ * @note   只要返回值不为 NULL, 那么 file 和它的 path, fp 肯定不是 NULL
  */
 LogPtr _logGenerate(constr name, constr path, bool mutetype)
 {
@@ -949,26 +1386,60 @@ LogPtr _logGenerate(constr name, constr path, bool mutetype)
         case FILE_CANWRITE:
         case FILE_NOTEXIST:
             /* 使用指定的文件路径初始化, 如果成功, 跳出返回  */
-            if(LOG_OK == _logInit(r_log, name, path, mutetype))
+            if(LOG_OK == _logInit(r_log, name, path, mutetype, NULL))
                 break;
             /* 如果失败, 重置log, 继续执行 FILE_NOTWRITE 分支 */
             _logReset(r_log);
         case FILE_NOTWRITE:
             /* 在程序目录下产生临时文件进行初始化, 如果失败, 那么销毁 log, 返回 null  */
             logsysWarning(name, "Generating log struct err: file open err -> try to create a temp file...\n");
-            if(LOG_ERR == _logInit(r_log, name, _logPath(DF_LOG_DIR, name), mutetype))
+            if(LOG_ERR == _logInit(r_log, name, _logPath(DF_LOG_DIR, name), mutetype, NULL))
             {
-                logsysErr(name, "Generating log struct err: cannot create temp file \"%s\"]", r_log->path);
+                logsysErr(name, "Generating log struct err: cannot create temp file \"%s\"]", _logPath(DF_LOG_DIR, name));
                 _logReset(r_log);
                 free(r_log);
                 return r_log = NULL;
             }
-            logsysInfo(name, "Create temp file \"%s\"\n", r_log->path);
+            logsysInfo(name, "Create temp file \"%s\"\n", r_log->file->path);
     }
     logsysAdd(name, "Generating log struct ok\n");
     return r_log;
 }
 
+/**
+ * @brief _logFileFind - 查找已打开 path 所指文件(按 dev/inode 判断) 的日志文件结构
+ * @return 该日志文件结构; 没有日志打开该文件时返回 NULL
+ * @note   须持有 _dictLocker, 快照只在持有它时替换
+ */
+static LogFilePtr _logFileFind(constr path)
+{
+    _logSnap* snap = __atomic_load_n(&_logsys_snap, __ATOMIC_ACQUIRE);
+    struct stat st;
+    unsigned long i;
+    LogFilePtr f;
+
+    if(!snap || stat(path, &st))    return NULL;
+    for(i = 0; i <= snap->sizemask; i++)
+        if(snap->slots[i].v && (f = snap->slots[i].v->file)
+           && __atomic_load_n(&f->dev, __ATOMIC_RELAXED) == st.st_dev && __atomic_load_n(&f->ino, __ATOMIC_RELAXED) == st.st_ino)
+            return f;
+    return NULL;
+}
+
+/**
+ * @brief _logShare - 创建一个共享 file 的日志结构, 名称, 静默属性, 级别 和 计数器是自己的
+ * @note   须持有 _dictLocker
+ */
+static LogPtr _logShare(constr name, bool mutetype, LogFilePtr file)
+{
+    LogPtr log = calloc(sizeof(*log), 1);
+
+    if(!log)    return NULL;
+    _logInit(log, name, NULL, mutetype, file);
+    logsysAdd(name, "Sharing file \"%s\" of log [%s]\n", file->path, file->name);
+    return log;
+}
+
 int logCreate(constr name, constr path, bool mutetype)
 {
     logsysAdd(NULL, "[%s] --CreateLog... \n", name);
@@ -976,27 +1447,46 @@ int logCreate(constr name, constr path, bool mutetype)
     if(LOG_ERR == _check_name(name, "--Creating"))      return LOG_ERR;
     if(LOG_ERR == _check_path(name, "--Creating"))      return LOG_ERR;
 
+    /* 字典只在这里和 logDestroy 中修改, 读取都通过快照进行 */
+    pthread_mutex_lock(&_dictLocker);
+
     /* key 已存在, 返回 err */
     logdictEntry *entry = _logdictAddRaw(_logsys_dic, name);
     if (!entry)    {
+        pthread_mutex_unlock(&_dictLocker);
         logsysAdd(NULL, "[%s] --Creating... err: \"%s\" has already exist \n", name, name);
         return logsysShow("[%s] --Creating... err: \"%s\" has already exist \n", name, name);
     }
 
-    /* 获取日志结构失败, 返回 err */
-    LogPtr log = _logGenerate(name, path, mutetype);
+    /* 获取日志结构失败, 返回 err; 文件已被其他日志打开时共享它 */
+    LogFilePtr file = _logFileFind(path);
+    LogPtr log = file ? _logShare(name, mutetype, file) : _logGenerate(name, path, mutetype);
     if(!log)    {
         // 运行到这里, 说明 name 已经插入到字典中, 所以需要先设置值为 NULL, 再从字典中删除
         logdictSetVal(_logsys_dic, entry, NULL);    // 这一步时必要的, _logdictAddRaw 内部使用 malloc, 不置 NULL 可能引起段错误
         _logdictDelete(_logsys_dic, name);
+        pthread_mutex_unlock(&_dictLocker);
         logsysAdd(NULL, "[%s] --Creating... err: Generating log struct failed \n", name);
         return LOG_ERR;
     }
 
-    /* 设置值 */
+    /* 设置值, 并发布新的快照; 发布失败时日志还没有被任何读者看到, 直接释放 */
     logdictSetVal(_logsys_dic, entry, log);
-    logsysAdd(name, "--CreateLog... ok: link file \"%s\" \n", log->path);
+    if(LOG_ERR == _logSnapPublish())    {
+        logdictSetVal(_logsys_dic, entry, NULL);
+        _logdictDelete(_logsys_dic, name);
+        _logReset(log);
+        free(log);
+        pthread_mutex_unlock(&_dictLocker);
+        logsysAdd(NULL, "[%s] --Creating... err: can not publish snapshot \n", name);
+        return logsysShow("[%s] --Creating... err: can not publish snapshot \n", name);
+    }
+    _level_counts[log->level]++;
+    _logLevelUpdate();
+    _logReclaim();
+    logsysAdd(name, "--CreateLog... ok: link file \"%s\" \n", log->file->path);
     logAddTextMute(log->name, "\n");
+    pthread_mutex_unlock(&_dictLocker);
 
     return LOG_OK;
 }
@@ -1010,12 +1500,38 @@ int logDestroy(constr name)
     if(LOG_ERR == _check_logsys(name, "--DestroyLog"))    return LOG_ERR;
     if(LOG_ERR == _check_name(name, "--DestroyLog"))      return LOG_ERR;
 
+    pthread_mutex_lock(&_dictLocker);
+
     /* 未找到指定的 log, 返回 err */
-    if(LOGDICT_ERR == _logdictDelete(_logsys_dic, name)){
+    LogPtr log = _logdictFetchValue(_logsys_dic, name);
+    if(!log){
+        pthread_mutex_unlock(&_dictLocker);
         logsysAdd(NULL, "[%s] --DestroyLog... err: log not exist \n", name);
         return logsysShow("[%s] --DestroyLog... err: log not exist \n", name);
     }
 
+    /* 从字典中移除(不释放日志结构), 发布新快照, 其他线程可能仍在使用该日志, 延迟到宽限期结束后再释放
+     * 值为 NULL 的项不会进入快照, 先发布再删除, 发布失败时恢复原值, 日志保持可用 */
+    logdictEntry* entry = _logdictFind(_logsys_dic, name);
+    logdictSetVal(_logsys_dic, entry, NULL);
+    if(LOG_ERR == _logSnapPublish()){
+        logdictSetVal(_logsys_dic, entry, log);
+        pthread_mutex_unlock(&_dictLocker);
+        logsysAdd(NULL, "[%s] --DestroyLog... err: can not publish snapshot \n", name);
+        return logsysShow("[%s] --DestroyLog... err: can not publish snapshot \n", name);
+    }
+    _logdictDelete(_logsys_dic, name);
+    _level_counts[log->level]--;
+    _logLevelUpdate();
+    _logHandleClose(log);
+    pthread_mutex_lock(&log->dlocker);
+    _logDedupFlush(log);        // 结束当前的重复
+    pthread_mutex_unlock(&log->dlocker);
+    _logDumpCounters(log);      // 销毁前写入最终的计数器
+    _logRetire(log, _valDestructor);
+    _logReclaim();
+    pthread_mutex_unlock(&_dictLocker);
+
     logsysAdd(NULL, "[%s] --DestroyLog... ok: log destroied\n", name);
     return LOG_OK;
 }
@@ -1028,12 +1544,16 @@ int logDestroy(constr name)
 size_t logFileSize(constr name)
 {
     LogPtr log;
+    LogFilePtr file;
     /* 检测未通过, 返回 err */
     if(LOG_ERR == _check_logsys(name, "--GetFileSize")) return LOG_ERR;
     if(LOG_ERR == _check_name(name, "--GetFileSize")) return LOG_ERR;
     if(!(log = _check_log(name, "--GetFileSize"))) return LOG_ERR;
+    file = log->file;
 
-    return _logFileSize(log);
+    size_t size = _logFileSize(file);
+    _logReadUnlock();
+    return size;
 }
 
 /**
@@ -1045,15 +1565,20 @@ size_t logFileSize(constr name)
 int logSetFileSize(constr name, size_t size_mb)
 {
     LogPtr log;
+    LogFilePtr file;
     /* 检测未通过, 返回 err */
     if(LOG_ERR == _check_logsys(name, "--SetFileSize")) return LOG_ERR;
     if(LOG_ERR == _check_name(name, "--SetFileSize")) return LOG_ERR;
     if(LOG_ERR == _check_size_mb(size_mb, name, "SetFileSize")) return LOG_ERR;
     if(!(log = _check_log(name, "--SetFileSize"))) return LOG_ERR;
-
-    log->maxsize = size_mb << 20;
-    logsysAdd(name, "--SetFileSize... ok: set file max size to %d \n", log->maxsize);
-    return log->maxsize;
+    file = log->file;
+
+    pthread_mutex_lock(&file->locker);
+    file->maxsize = size_mb << 20;
+    pthread_mutex_unlock(&file->locker);
+    _logReadUnlock();
+    logsysAdd(name, "--SetFileSize... ok: set file max size to %d \n", size_mb << 20);
+    return size_mb << 20;
 }
 
 /**
@@ -1069,7 +1594,10 @@ void logSetMutetype(constr name, bool mutetype)
     if(LOG_ERR == _check_name(name, "--SetMutetype")) return;
     if(!(log = _check_log(name, "--SetMutetype"))) return;
 
+    pthread_mutex_lock(&log->file->locker);
     log->mutetype = mutetype;
+    pthread_mutex_unlock(&log->file->locker);
+    _logReadUnlock();
     if(mutetype)
         logsysAdd(name, "--SetMutetype... ok: set mutetype to MUTE \n");
     else
@@ -1077,91 +1605,468 @@ void logSetMutetype(constr name, bool mutetype)
 }
 
 /**
- * @brief logFlieEmpty  - 清空日志结构所指文件
+ * @brief logSetLevel - 设置日志的调式信息级别
  * @param name
- * @return
+ * @param level LOG_LV_OFF / LOG_LV_ERR / LOG_LV_WARNING / LOG_LV_INFO
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ * @note   运行期间可随时修改, 高于该级别的 logErr/logWarning/logInfo 在格式化之前返回
  */
-int logFlieEmpty(constr name)
+int logSetLevel(constr name, int level)
 {
     LogPtr log;
     /* 检测未通过, 返回 err */
-    if(LOG_ERR == _check_logsys(name, "--EmptyFile")) return LOG_ERR;
-    if(LOG_ERR == _check_name(name, "--EmptyFile")) return LOG_ERR;
-    if(!(log = _check_log(name, "--EmptyFile"))) return LOG_ERR;
-
-    if(0 == _logFlieEmpty(log)){
-        logsysAdd(name, "--EmptyFile... ok: Log file had been truncated \n");
-        return LOG_OK;
+    if(LOG_ERR == _check_logsys(name, "--SetLevel")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--SetLevel")) return LOG_ERR;
+    if(level < LOG_LV_OFF || level > LOG_LV_INFO){
+        logsysAdd(NULL, "[%s] --SetLevel() err: level %d is illegal \n", name, level);
+        return LOG_ERR;
     }
-    else{
-        logsysAdd(name, "--EmptyFile... err: %s \n", strerror(errno));
-        logsysShow("--EmptyFile... err: %s \n", strerror(errno));
+
+    /* 级别计数和字典一样只在 _dictLocker 下修改 */
+    pthread_mutex_lock(&_dictLocker);
+    if(!(log = _logdictFetchValue(_logsys_dic, name)))
+    {
+        pthread_mutex_unlock(&_dictLocker);
+        logsysAdd(name, "--SetLevel() err: log not exist \n");
         return LOG_ERR;
     }
+    _level_counts[log->level]--;
+    _level_counts[level]++;
+    __atomic_store_n(&log->level, level, __ATOMIC_RELAXED);
+    _logLevelUpdate();
+    pthread_mutex_unlock(&_dictLocker);
+
+    logsysAdd(name, "--SetLevel... ok: set level to %d \n", level);
+    return LOG_OK;
 }
 
 /**
- * @brief logAddTime - 添加当前时间到 日志 中, 由 (*log).mute 决定是否静默处理
+ * @brief logSetFlush - 设置日志文件的 fflush 策略
  * @param name
+ * @param policy    LOG_FLUSH_LINE:   每行 fflush 一次(默认)
+ *                  LOG_FLUSH_BYTES:  未 fflush 的字节数达到 arg 时 fflush
+ *                  LOG_FLUSH_TIME:   由后台定时线程每 arg 毫秒 fflush 一次
+ *                  LOG_FLUSH_MANUAL: 只在 logErr 或 logFlush() 时 fflush
+ * @param arg       LOG_FLUSH_BYTES 时为字节数, LOG_FLUSH_TIME 时为毫秒数, 必须大于 0; 其他策略忽略
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ * @note   除 LOG_FLUSH_LINE 外, 文件流缓冲区满时 stdio 仍会自动写出; logErr/logErrH 的信息总是立即 fflush
  */
-void logAddTime(constr name)
+int logSetFlush(constr name, int policy, size_t arg)
 {
     LogPtr log;
+    LogFilePtr file;
     /* 检测未通过, 返回 err */
-    if(LOG_ERR == _check_logsys(name, "AddTimeStr")) return;
-    if(LOG_ERR == _check_name(name, "AddTimeStr")) return;
-    if(!(log = _check_log(name, "AddTimeStr"))) return;
-
-    _logFileShrink(log);
-
-    fprintf(log->fp, "%s", _timeStr(TS_LOG));   // 写入文件流
-    if(!log->mutetype)                          // 如果需要, 输出到控制台
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
-
-    logsysAdd(name, "add time\n");
+    if(LOG_ERR == _check_logsys(name, "--SetFlush")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--SetFlush")) return LOG_ERR;
+    if(policy < LOG_FLUSH_LINE || policy > LOG_FLUSH_MANUAL || ((LOG_FLUSH_BYTES == policy || LOG_FLUSH_TIME == policy) && !arg)){
+        logsysAdd(NULL, "[%s] --SetFlush() err: policy %d with arg %zu is illegal \n", name, policy, arg);
+        return LOG_ERR;
+    }
+    if(!(log = _check_log(name, "--SetFlush"))) return LOG_ERR;
+    if(LOG_FLUSH_TIME == policy && LOG_ERR == _logFlushStart()){
+        _logReadUnlock();
+        logsysAdd(name, "--SetFlush... err: can not start flush ticker \n");
+        return logsysShow("[%s] --SetFlush... err: can not start flush ticker \n", name);
+    }
+    file = log->file;
+
+    /* 切换策略时先写出已缓冲的内容 */
+    pthread_mutex_lock(&file->locker);
+    _logFileFlush(file);
+    _logCountFlush(log, 1);
+    file->flusharg  = arg;
+    file->flushtime = _logMsNow();
+    __atomic_store_n(&file->flush, policy, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&file->locker);
+    _logReadUnlock();
+    logsysAdd(name, "--SetFlush... ok: set flush policy to %d, arg %zu \n", policy, arg);
+    return LOG_OK;
 }
 
 /**
- * @brief logAddTimeMute - 添加当前时间到 日志 中, 强制静默处理
+ * @brief logSetDedup - 设置是否合并连续重复的记录
  * @param name
+ * @param timeout_ms    重复持续超过该时间(毫秒) 时也写入一行摘要, 为 0 时不合并
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ * @note   格式化字串和参数都相同的连续记录(logAdd/logErr 等带时间的记录) 只写入第一条,
+ *         之后写入一行 "last message repeated N times in S.SSSs", 超时由定时线程检查
  */
-void logAddTimeMute(constr name)
+int logSetDedup(constr name, int timeout_ms)
 {
     LogPtr log;
     /* 检测未通过, 返回 err */
-    if(LOG_ERR == _check_logsys(name, "logAddTimeMute")) return;
-    if(LOG_ERR == _check_name(name, "logAddTimeMute")) return;
-    if(!(log = _check_log(name, "logAddTimeMute"))) return;
-
-    _logFileShrink(log);
-
-    fprintf(log->fp, "%s", _timeStr(TS_LOG));     // 写入文件流
+    if(LOG_ERR == _check_logsys(name, "--SetDedup")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--SetDedup")) return LOG_ERR;
+    if(timeout_ms < 0){
+        logsysAdd(NULL, "[%s] --SetDedup() err: timeout %d is illegal \n", name, timeout_ms);
+        return LOG_ERR;
+    }
+    if(!(log = _check_log(name, "--SetDedup"))) return LOG_ERR;
+    if(timeout_ms && LOG_ERR == _logFlushStart()){
+        _logReadUnlock();
+        logsysAdd(name, "--SetDedup... err: can not start flush ticker \n");
+        return logsysShow("[%s] --SetDedup... err: can not start flush ticker \n", name);
+    }
 
-    logsysAdd(name, "add timestr in mute mode\n");
+    /* 关闭或修改时先结束当前的重复 */
+    pthread_mutex_lock(&log->dlocker);
+    _logDedupFlush(log);
+    log->dupfmt = NULL;
+    __atomic_store_n(&log->dedup, timeout_ms, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&log->dlocker);
+    _logReadUnlock();
+    logsysAdd(name, "--SetDedup... ok: set dedup timeout to %d ms \n", timeout_ms);
+    return LOG_OK;
 }
 
 /**
- * @brief logAddTimeNMute - 添加当前时间到 日志 中, 强制非静默处理
+ * @brief logFlush - 立即把日志文件的缓冲内容写出
  * @param name
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ * @note   异步模式下会先等待目前已入队的记录全部写入, 开启了 logSetDedup() 时先写入当前重复的摘要行
  */
-void logAddTimeNMute(constr name)
+int logFlush(constr name)
 {
     LogPtr log;
     /* 检测未通过, 返回 err */
-    if(LOG_ERR == _check_logsys(name, "logAddTimeNMute")) return;
-    if(LOG_ERR == _check_name(name, "logAddTimeNMute")) return;
-    if(!(log = _check_log(name, "logAddTimeNMute"))) return;
-
-    _logFileShrink(log);
-
-    fprintf(log->fp, "%s", _timeStr(TS_LOG));   // 写入文件流
-    fprintf(stderr, "%s", _timeStr(TS_LOG));    // 输出到控制台
-
-    logsysAdd(name, "add timestr in nmute mode\n");
+    if(LOG_ERR == _check_logsys(name, "--Flush")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--Flush")) return LOG_ERR;
+    if(!(log = _check_log(name, "--Flush"))) return LOG_ERR;
+
+    pthread_mutex_lock(&log->dlocker);
+    _logDedupFlush(log);
+    pthread_mutex_unlock(&log->dlocker);
+    _logFlush(log);
+    _logReadUnlock();
+    return LOG_OK;
 }
 
 /**
- * @brief logAddText - 添加 text 到 日志 中, 由 (*log).mute 决定是否静默处理
+ * @brief logStats - 获取日志的统计信息
+ * @param name
+ * @param st    输出
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ */
+int logStats(constr name, LogStats* st)
+{
+    LogPtr log;
+    /* 检测未通过, 返回 err */
+    if(!st) return LOG_ERR;
+    if(LOG_ERR == _check_logsys(name, "--Stats")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--Stats")) return LOG_ERR;
+    if(!(log = _check_log(name, "--Stats"))) return LOG_ERR;
+
+    bzero(st, sizeof(*st));
+    _logStatsCollect(log, st);
+    _logReadUnlock();
+    return LOG_OK;
+}
+
+/**
+ * @brief logStatsPercentile - 从统计信息的耗时直方图中读取百分位数
+ * @param st
+ * @param pct   百分比, 0 ~ 100, 如 50, 99, 99.9
+ * @return 不小于该比例样本的耗时上界(ns), 相对误差不超过 25%; 没有样本时返回 0
+ */
+uint64_t logStatsPercentile(const LogStats* st, double pct)
+{
+    uint64_t total = 0, need, seen = 0;
+    unsigned i;
+
+    if(!st) return 0;
+    for(i = 0; i < LOG_HIST_BUCKETS; i++)   total += st->hist[i];
+    if(!total)  return 0;
+
+    if(pct < 0)     pct = 0;
+    if(pct > 100)   pct = 100;
+    need = (uint64_t)(pct / 100 * total + 0.5);
+    if(!need)   need = 1;
+    for(i = 0; i < LOG_HIST_BUCKETS; i++)
+        if((seen += st->hist[i]) >= need)
+            break;
+    return _logHistValue(i < LOG_HIST_BUCKETS ? i : LOG_HIST_BUCKETS - 1);
+}
+
+/**
+ * @brief logSetEngine - 设置日志的写入引擎
+ * @param name
+ * @param engine    LOG_IO_STDIO:  通过 stdio 的 FILE* 写入(默认)
+ *                  LOG_IO_DIRECT: 记录直接格式化到日志自己的双缓冲区, 缓冲区写满或按 fflush 策略需要写出时,
+ *                                 交换缓冲区, 在锁外用 writev 写入文件, 其他线程可以继续向另一个缓冲区写入
+ *                  LOG_IO_MMAP:   文件按 bufsize 大小的块 fallocate 预分配并 mmap, 记录直接渲染/拷贝到映射窗口中,
+ *                                 窗口写满时推进到下一块, 写入没有系统调用; fflush 策略对它没有意义
+ * @param bufsize   LOG_IO_DIRECT 每个缓冲区的大小, 为 0 时使用 DF_LOG_BUFSIZE;
+ *                  LOG_IO_MMAP 映射窗口的大小, 为 0 时使用 DF_LOG_MMAPSIZE, 向上按页对齐;
+ *                  均不能小于 MIN_LOG_BUFSIZE; LOG_IO_STDIO 忽略
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ * @note   切换前会写出当前引擎中缓冲的内容; LOG_IO_DIRECT 中超过缓冲区大小的单条记录会和当前缓冲区一起 writev
+ *         LOG_IO_MMAP 在关闭, 轮转, 清空 和 切换引擎时把文件截断到实际长度, 进程崩溃时文件末尾会残留预分配的 '\0', 下次映射时截掉;
+ *         映射失败时自动退回 LOG_IO_STDIO 并返回 LOG_ERR
+ */
+int logSetEngine(constr name, int engine, size_t bufsize)
+{
+    LogPtr log;
+    LogFilePtr file;
+    char* buf[2] = {NULL, NULL}, * old[2];
+    size_t page = sysconf(_SC_PAGESIZE);
+    int ret;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "--SetEngine")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--SetEngine")) return LOG_ERR;
+    if(LOG_IO_STDIO == engine)  bufsize = 0;
+    else if(!bufsize)           bufsize = LOG_IO_MMAP == engine ? DF_LOG_MMAPSIZE : DF_LOG_BUFSIZE;
+    if(LOG_IO_MMAP == engine)   bufsize = (bufsize + page - 1) / page * page;   // 映射窗口按页对齐
+    if(engine < LOG_IO_STDIO || engine > LOG_IO_URING || (LOG_IO_STDIO != engine && bufsize < MIN_LOG_BUFSIZE)){
+        logsysAdd(NULL, "[%s] --SetEngine() err: engine %d with bufsize %zu is illegal \n", name, engine, bufsize);
+        return LOG_ERR;
+    }
+    if((LOG_IO_DIRECT == engine || LOG_IO_URING == engine) && (!(buf[0] = malloc(bufsize)) || !(buf[1] = malloc(bufsize)))){
+        free(buf[0]);
+        logsysAdd(name, "--SetEngine... err: %s \n", strerror(errno));
+        return logsysShow("[%s] --SetEngine... err: %s \n", name, strerror(errno));
+    }
+    if(!(log = _check_log(name, "--SetEngine"))) {free(buf[0]); free(buf[1]); return LOG_ERR;}
+    file = log->file;
+
+    /* 结束当前引擎对文件的使用后再切换, _logFileDetach 返回时没有正在进行的 writev 和 io_uring 写入, 映射也已解除 */
+    pthread_mutex_lock(&file->locker);
+    _logFileDetach(file);
+    old[0] = file->wbuf[0];
+    old[1] = file->wbuf[1];
+    file->wbuf[0] = buf[0];
+    file->wbuf[1] = buf[1];
+    file->wcap    = buf[0] ? bufsize : 0;
+    file->wlen    = 0;
+    file->wcur    = 0;
+    file->mlen    = LOG_IO_MMAP == engine ? bufsize : 0;
+    file->engine  = engine;
+    ret = _logFileAttach(file);
+    pthread_mutex_unlock(&file->locker);
+    _logReadUnlock();
+
+    free(old[0]);
+    free(old[1]);
+    if(LOG_ERR == ret)
+        return logsysShow("[%s] --SetEngine... err: engine %d is not available, fall back to stdio \n", name, engine);
+    logsysAdd(name, "--SetEngine... ok: set engine to %d, bufsize %zu \n", engine, bufsize);
+    return LOG_OK;
+}
+
+/**
+ * @brief logSetBinary - 设置是否使用二进制记录
+ * @param name
+ * @param binary    为 true 时, logAdd* 只保存格式化字串 id, 时间和参数的原始字节, 不调用 vfprintf, 文件由 logDecode() 或 logdecode 工具还原为文本;
+ *                  为 false 时恢复文本记录, 当前二进制段以 'E' 结束
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ * @note   只记录字面量格式化字串(位于只读段中), 以指针为 key, 其他格式化字串 和 表满后新的格式化字串都写入渲染好的文本, 所以结果总是正确的;
+ *         非静默日志的控制台输出仍为文本, 异步模式下由后台写线程格式化
+ */
+int logSetBinary(constr name, bool binary)
+{
+    LogPtr log;
+    LogFilePtr file;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "--SetBinary")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--SetBinary")) return LOG_ERR;
+    if(!(log = _check_log(name, "--SetBinary"))) return LOG_ERR;
+    file = log->file;
+
+    if(binary && LOG_ERR == _logFlushStart())  // 格式化字串表已满时由定时线程报告
+        logsysAdd(name, "--SetBinary... err: can not start flush ticker \n");
+    pthread_mutex_lock(&file->locker);
+    if(!binary) _logBinEnd(file);
+    __atomic_store_n(&file->binary, binary, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&file->locker);
+    _logReadUnlock();
+    logsysAdd(name, "--SetBinary... ok: set binary to %d \n", binary);
+    return LOG_OK;
+}
+
+/**
+ * @brief logSetBlackBox - 设置日志的黑匣子
+ * @param name
+ * @param size_mb   环形缓冲区的大小, 单位为 MB, 为 0 时关闭; 文件为 日志文件路径 + LOG_BOX_SUFFIX
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ * @note   每条记录在写入文件之前以文本形式 memcpy 到 MAP_SHARED 映射的环形缓冲区中, 没有系统调用,
+ *         进程崩溃或被 SIGKILL 时最近 size_mb 的记录仍在页缓存中, 由 logBoxExtract() 或 logbox 工具按顺序取出;
+ *         大小不变时保留文件中已有的记录(例如上次崩溃前的记录), 改变大小时重新创建文件
+ */
+int logSetBlackBox(constr name, size_t size_mb)
+{
+    LogPtr log;
+    LogFilePtr file;
+    LogBox* box = NULL;
+    char path[PATH_MAX];
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "--SetBlackBox")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--SetBlackBox")) return LOG_ERR;
+    if(LOG_ERR == _check_size_mb(size_mb, name, "SetBlackBox")) return LOG_ERR;
+
+    /* 旧的映射可能正在被其他线程写入, 替换后延迟到宽限期结束再解除映射 */
+    pthread_mutex_lock(&_dictLocker);
+    if(!(log = _logdictFetchValue(_logsys_dic, name))){
+        pthread_mutex_unlock(&_dictLocker);
+        logsysAdd(NULL, "[%s] --SetBlackBox... err: log not exist \n", name);
+        return logsysShow("[%s] --SetBlackBox... err: log not exist \n", name);
+    }
+    file = log->file;
+    snprintf(path, sizeof(path), "%s%s", file->path, LOG_BOX_SUFFIX);
+    if(size_mb && !(box = _logBoxOpen(path, size_mb << 20)))
+    {
+        pthread_mutex_unlock(&_dictLocker);
+        logsysAdd(name, "--SetBlackBox... err: can not map \"%s\", %s \n", path, strerror(errno));
+        return logsysShow("[%s] --SetBlackBox... err: can not map \"%s\", %s \n", name, path, strerror(errno));
+    }
+    _logRetire(__atomic_exchange_n(&file->box, box, __ATOMIC_ACQ_REL), _logBoxUnmap);
+    _logReclaim();
+    pthread_mutex_unlock(&_dictLocker);
+    logsysAdd(name, "--SetBlackBox... ok: set black box to %zu MB \n", size_mb);
+    return LOG_OK;
+}
+
+/**
+ * @brief logSetRotate - 设置日志文件的轮转数量
+ * @param name
+ * @param count 保留的旧文件数量, 文件达到大小上限时, 依次重命名为 path.1 ... path.count;
+ *              为 0 时不轮转, 直接清空文件(默认)
+ * @return 失败返回 LOG_ERR, 成功返回设置后的数量
+ */
+int logSetRotate(constr name, int count)
+{
+    LogPtr log;
+    LogFilePtr file;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "--SetRotate")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--SetRotate")) return LOG_ERR;
+    if(count < 0 || count > MAX_LOG_ROTATE){
+        logsysAdd(NULL, "[%s] --SetRotate() err: rotate count %d is illegal \n", name, count);
+        return LOG_ERR;
+    }
+    if(!(log = _check_log(name, "--SetRotate"))) return LOG_ERR;
+    file = log->file;
+
+    pthread_mutex_lock(&file->locker);
+    file->rotate = count;
+    pthread_mutex_unlock(&file->locker);
+    _logReadUnlock();
+    logsysAdd(name, "--SetRotate... ok: set rotate count to %d \n", count);
+    return count;
+}
+
+/**
+ * @brief logSetRotateTime - 设置日志文件按时间轮转
+ * @param name
+ * @param interval  轮转间隔(秒), 可使用 LOG_ROTATE_HOURLY / LOG_ROTATE_DAILY, 为 0 时关闭按时间轮转(默认)
+ *                  若间隔能整除一天, 轮转时间点按本地时间对齐, 如每小时整点, 每天零点
+ * @return 失败返回 LOG_ERR, 成功返回设置后的间隔
+ * @note   到达轮转时间点后, 当前文件重命名为 path-%Y-%m-%d_%H:%M:%S.out(本段开始的时间), 然后打开新文件
+ *         每次写入时只和缓存的下一个轮转时间点比较, 不会调用 time()
+ */
+int logSetRotateTime(constr name, int interval)
+{
+    LogPtr log;
+    LogFilePtr file;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "--SetRotateTime")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--SetRotateTime")) return LOG_ERR;
+    if(interval < 0){
+        logsysAdd(NULL, "[%s] --SetRotateTime() err: rotate interval %d is illegal \n", name, interval);
+        return LOG_ERR;
+    }
+    if(!(log = _check_log(name, "--SetRotateTime"))) return LOG_ERR;
+    file = log->file;
+
+    pthread_mutex_lock(&file->locker);
+    if(interval)
+        __atomic_store_n(&file->rotatetime, _timeNextBoundary(_timeNow(), interval), __ATOMIC_RELAXED);
+    file->interval = interval;
+    pthread_mutex_unlock(&file->locker);
+    _logReadUnlock();
+    logsysAdd(name, "--SetRotateTime... ok: set rotate interval to %d s \n", interval);
+    return interval;
+}
+
+/**
+ * @brief logFlieEmpty  - 清空日志结构所指文件
+ * @param name
+ * @return
+ */
+int logFlieEmpty(constr name)
+{
+    LogPtr log;
+    LogFilePtr file;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "--EmptyFile")) return LOG_ERR;
+    if(LOG_ERR == _check_name(name, "--EmptyFile")) return LOG_ERR;
+    if(!(log = _check_log(name, "--EmptyFile"))) return LOG_ERR;
+    file = log->file;
+
+    int ret;
+    pthread_mutex_lock(&file->locker);
+    ret = _logFlieEmpty(file);
+    pthread_mutex_unlock(&file->locker);
+    _logReadUnlock();
+    if(0 == ret){
+        logsysAdd(name, "--EmptyFile... ok: Log file had been truncated \n");
+        return LOG_OK;
+    }
+    else{
+        logsysAdd(name, "--EmptyFile... err: %s \n", strerror(errno));
+        logsysShow("--EmptyFile... err: %s \n", strerror(errno));
+        return LOG_ERR;
+    }
+}
+
+/**
+ * @brief logAddTime - 添加当前时间到 日志 中, 由 (*log).mute 决定是否静默处理
+ * @param name
+ */
+void logAddTime(constr name)
+{
+    LogPtr log;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "AddTimeStr")) return;
+    if(LOG_ERR == _check_name(name, "AddTimeStr")) return;
+    if(!(log = _check_log(name, "AddTimeStr"))) return;
+
+    _logWrite(log, !log->mutetype, true, NULL);
+    _logReadUnlock();
+}
+
+/**
+ * @brief logAddTimeMute - 添加当前时间到 日志 中, 强制静默处理
+ * @param name
+ */
+void logAddTimeMute(constr name)
+{
+    LogPtr log;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "logAddTimeMute")) return;
+    if(LOG_ERR == _check_name(name, "logAddTimeMute")) return;
+    if(!(log = _check_log(name, "logAddTimeMute"))) return;
+
+    _logWrite(log, false, true, NULL);
+    _logReadUnlock();
+}
+
+/**
+ * @brief logAddTimeNMute - 添加当前时间到 日志 中, 强制非静默处理
+ * @param name
+ */
+void logAddTimeNMute(constr name)
+{
+    LogPtr log;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "logAddTimeNMute")) return;
+    if(LOG_ERR == _check_name(name, "logAddTimeNMute")) return;
+    if(!(log = _check_log(name, "logAddTimeNMute"))) return;
+
+    _logWrite(log, true, true, NULL);
+    _logReadUnlock();
+}
+
+/**
+ * @brief logAddText - 添加 text 到 日志 中, 由 (*log).mute 决定是否静默处理
  * @param name
  * @param text  内容
  */
@@ -1174,28 +2079,11 @@ void logAddText(constr name, constr text, ...)
     if(LOG_ERR == _check_name(name, "logAddText")) return;
     if(!(log = _check_log(name, "logAddText"))) return;
 
-    _logFileShrink(log);
-
     va_list argptr;
-
-    // 写入文件流
-    pthread_mutex_lock(&fileLocker);
     va_start(argptr, text);
-    vfprintf(log->fp, text, argptr);
-    fflush(log->fp);
-    pthread_mutex_unlock(&fileLocker);
-    // 如果需要, 输出到控制台
-    if(!log->mutetype)
-    {
-        pthread_mutex_lock(&consoleLocker);
-        va_start(argptr, text);
-        vfprintf(stderr, text, argptr);
-        pthread_mutex_unlock(&consoleLocker);
-    } 
-
-    logsysAdd(name, "add a text \n");
-
+    _logVWrite(log, !log->mutetype, false, false, NULL, text, argptr);
     va_end(argptr);
+    _logReadUnlock();
 }
 /**
  * @brief logAddTextMute - 添加 text 到 日志 中, 强制静默处理
@@ -1211,20 +2099,11 @@ void logAddTextMute(constr name, constr text, ...)
     if(LOG_ERR == _check_name(name, "logAddTextMute")) return;
     if(!(log = _check_log(name, "logAddTextMute"))) return;
 
-    _logFileShrink(log);
-
     va_list argptr;
-
-    // 写入文件流
-    pthread_mutex_lock(&fileLocker);
     va_start(argptr, text);
-    vfprintf(log->fp, text, argptr);
-    fflush(log->fp);
-    pthread_mutex_unlock(&fileLocker);
-
-    logsysAdd(name, "add a text in mute mode\n");
-
+    _logVWrite(log, false, false, false, NULL, text, argptr);
     va_end(argptr);
+    _logReadUnlock();
 }
 /**
  * @brief logAddTextNMute - 添加 text 到 日志 中, 强制非静默处理
@@ -1240,186 +2119,2992 @@ void logAddTextNMute(constr name, constr text, ...)
     if(LOG_ERR == _check_name(name, "logAddTextNMute")) return;
     if(!(log = _check_log(name, "logAddTextNMute"))) return;
 
-    _logFileShrink(log);
+    va_list argptr;
+    va_start(argptr, text);
+    _logVWrite(log, true, false, false, NULL, text, argptr);
+    va_end(argptr);
+    _logReadUnlock();
+}
+
+
+/**
+ * @brief logAdd - 添加 时间 和 text 到 日志中, 由 (*log).mute 决定是否静默处理
+ * @param name
+ * @param text
+ */
+void logAdd(constr name, constr text, ...)
+{
+    if(!text || !(*text))   return;
+    LogPtr log;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "logAdd")) return;
+    if(LOG_ERR == _check_name(name, "logAdd")) return;
+    if(!(log = _check_log(name, "logAdd"))) return;
 
     va_list argptr;
+    va_start(argptr, text);
+    _logVWrite(log, !log->mutetype, true, false, NULL, text, argptr);
+    va_end(argptr);
+    _logReadUnlock();
+}
+void logAddMute(constr name, constr text, ...)     // 添加 时间 和 text 到 日志中, 强制静默处理
+{
+    if(!text || !(*text))   return;
+    LogPtr log;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "logAddMute")) return;
+    if(LOG_ERR == _check_name(name, "logAddMute")) return;
+    if(!(log = _check_log(name, "logAddMute"))) return;
 
-    // 写入文件流
-    pthread_mutex_lock(&fileLocker);
+    va_list argptr;
     va_start(argptr, text);
-    vfprintf(log->fp, text, argptr);
-    fflush(log->fp);
-    pthread_mutex_unlock(&fileLocker);
-    // 输出到控制台
-    pthread_mutex_lock(&consoleLocker);
+    _logVWrite(log, false, true, false, NULL, text, argptr);
+    va_end(argptr);
+    _logReadUnlock();
+}
+/**
+ * @brief logAddNMute - 添加 时间 和 text 到 日志中, 强制非静默处理
+ * @param name
+ * @param text
+ */
+void logAddNMute(constr name, constr text, ...)
+{
+    if(!text || !(*text))   return;
+    LogPtr log;
+    /* 检测未通过, 返回 err */
+    if(LOG_ERR == _check_logsys(name, "logAddNMute")) return;
+    if(LOG_ERR == _check_name(name, "logAddNMute")) return;
+    if(!(log = _check_log(name, "logAddNMute"))) return;
+
+    va_list argptr;
     va_start(argptr, text);
-    vfprintf(stderr, text, argptr);
-    pthread_mutex_unlock(&consoleLocker);
+    _logVWrite(log, true, true, false, NULL, text, argptr);
+    va_end(argptr);
+    _logReadUnlock();
+}
+
+/**
+ * @brief logAddDebug - 调式日志 API, 供 logErr/logWarning/logInfo 使用
+ * @param name
+ * @param level 本条信息的级别, 高于日志级别时在格式化之前返回
+ * @param text  宏在编译期拼接好的前缀格式, 后跟 file, line, func, errno, 用户格式化字串 和 用户参数
+ * @note  前缀在栈上渲染, 整个调用过程没有堆内存分配
+ */
+void logAddDebug(constr name, int level, constr text, ...)
+{
+    char prefix[MAX_DEBUG_PREFIX];
+    va_list argptr;
+    LogPtr log;
+    constr file, func, format;
+    int line, err;
 
-    logsysAdd(name, "add a text in nmute mode \n");
+    if(!_logLevelOn(level)) return;
+
+    va_start(argptr, text);
+    file   = va_arg(argptr, constr);    // 获取文件名
+    line   = va_arg(argptr, int);       // 获取行
+    func   = va_arg(argptr, constr);    // 获取函数名
+    err    = va_arg(argptr, int);       // 获取调用处的 errno
+    format = va_arg(argptr, constr);    // 获取用户格式化字串, 之后 argptr 指向用户参数
+    /* 检查不成功 返回 */
+    if(!_logsys_service){/* 服务未开启, 输出调式信息到控制台, 返回 err */
+        va_end(argptr);
+        logsysShow("[logsys err]:%s(%d)-%s: logsys service is off \n", file, line, func);
+        return;
+    }
+    if(!name || !*name) {/* 字串不合法, 添加调式信息到系统日志, 返回 */
+        va_end(argptr);
+        logsysAdd(name, "[name err]:%s(%d)-%s: name is NULL or empty \n", file, line, func);
+        return ;
+    }
+    _logReadLock();
+    log = _logSnapFind(name);
+    if(!log){/* log 不存在, 添加调式信息到系统日志, 返回 */
+        _logReadUnlock();
+        va_end(argptr);
+        logsysAdd(name, "[log err]:%s(%d)-%s: log \"%s\" not exist \n", file, line, func, name);
+        return ;
+    }
+    if(level > __atomic_load_n(&log->level, __ATOMIC_RELAXED)){/* 级别被关闭, 返回 */
+        _logReadUnlock();
+        va_end(argptr);
+        return ;
+    }
 
+    _logDebugPrefix(prefix, text, file, line, func, err, &format);
+    _logVWrite(log, !log->mutetype, true, LOG_LV_ERR == level, prefix, format, argptr);
     va_end(argptr);
+    if(LOG_LV_ERR == level)
+        __atomic_add_fetch(&log->errs, 1, __ATOMIC_RELAXED);
+    _logReadUnlock();
+}
+
+/**
+ * @brief logOpen - 获取日志的句柄
+ * @param name
+ * @return 句柄, 失败返回 0
+ * @note   句柄在日志销毁前一直有效, 同一日志多次获取返回相同的句柄;
+ *         日志销毁后句柄失效, 使用失效句柄只会在系统日志中记录错误, 不会访问已释放的内存
+ */
+LogHandle logOpen(constr name)
+{
+    LogPtr log;
+    unsigned int i;
+    LogHandle h = 0;
+
+    if(LOG_ERR == _check_logsys(name, "--OpenLog")) return 0;
+    if(LOG_ERR == _check_name(name, "--OpenLog")) return 0;
+
+    pthread_mutex_lock(&_dictLocker);
+    if(!(log = _logdictFetchValue(_logsys_dic, name)))
+    {
+        pthread_mutex_unlock(&_dictLocker);
+        logsysAdd(name, "--OpenLog() err: log not exist \n");
+        return 0;
+    }
+    if(!log->hslot)
+    {
+        for(i = 0; i < MAX_LOG_HANDLES && _logsys_handles[i].log; i++);
+        if(i < MAX_LOG_HANDLES)
+        {
+            log->hslot = i + 1;
+            __atomic_store_n(&_logsys_handles[i].log, log, __ATOMIC_RELEASE);
+        }
+    }
+    if(log->hslot)
+        h = (LogHandle)_logsys_handles[log->hslot - 1].gen << 32 | log->hslot;
+    pthread_mutex_unlock(&_dictLocker);
+
+    if(!h)
+    {
+        logsysAdd(name, "--OpenLog... err: too many handles, max is %d \n", MAX_LOG_HANDLES);
+        logsysShow("[%s] --OpenLog... err: too many handles, max is %d \n", name, MAX_LOG_HANDLES);
+        return 0;
+    }
+    logsysAdd(name, "--OpenLog... ok: handle %#llx \n", (unsigned long long)h);
+    return h;
+}
+
+/**
+ * @brief logAddTextH - 同 logAddText, 通过句柄添加
+ * @param h     logOpen() 返回的句柄
+ * @param text  内容
+ */
+void logAddTextH(LogHandle h, constr text, ...)
+{
+    if(!text || !(*text)) return;
+    LogPtr log;
+    /* 句柄无效, 返回 */
+    if(!(log = _check_handle(h))){
+        logsysAdd(NULL, "logAddTextH() err: handle %#llx is invalid \n", (unsigned long long)h);
+        return;
+    }
+
+    va_list argptr;
+    va_start(argptr, text);
+    _logVWrite(log, !log->mutetype, false, false, NULL, text, argptr);
+    va_end(argptr);
+    _logReadUnlock();
+}
+
+/**
+ * @brief logAddH - 同 logAdd, 通过句柄添加
+ * @param h     logOpen() 返回的句柄
+ * @param text  内容
+ */
+void logAddH(LogHandle h, constr text, ...)
+{
+    if(!text || !(*text)) return;
+    LogPtr log;
+    /* 句柄无效, 返回 */
+    if(!(log = _check_handle(h))){
+        logsysAdd(NULL, "logAddH() err: handle %#llx is invalid \n", (unsigned long long)h);
+        return;
+    }
+
+    va_list argptr;
+    va_start(argptr, text);
+    _logVWrite(log, !log->mutetype, true, false, NULL, text, argptr);
+    va_end(argptr);
+    _logReadUnlock();
+}
+
+/**
+ * @brief logAddDebugH - 调式日志 API, 供 logErrH/logWarningH/logInfoH 使用
+ * @param h
+ * @param level 本条信息的级别, 高于日志级别时在格式化之前返回
+ * @param text
+ */
+void logAddDebugH(LogHandle h, int level, constr text, ...)
+{
+    char prefix[MAX_DEBUG_PREFIX];
+    va_list argptr;
+    LogPtr log;
+    constr file, func, format;
+    int line, err;
+
+    if(!_logLevelOn(level)) return;
+
+    va_start(argptr, text);
+    file   = va_arg(argptr, constr);    // 获取文件名
+    line   = va_arg(argptr, int);       // 获取行
+    func   = va_arg(argptr, constr);    // 获取函数名
+    err    = va_arg(argptr, int);       // 获取调用处的 errno
+    format = va_arg(argptr, constr);    // 获取用户格式化字串, 之后 argptr 指向用户参数
+    /* 句柄无效, 添加调式信息到系统日志, 返回 */
+    if(!(log = _check_handle(h))){
+        va_end(argptr);
+        logsysAdd(NULL, "[handle err]:%s(%d)-%s: handle %#llx is invalid \n", file, line, func, (unsigned long long)h);
+        return ;
+    }
+    if(level > __atomic_load_n(&log->level, __ATOMIC_RELAXED)){/* 级别被关闭, 返回 */
+        _logReadUnlock();
+        va_end(argptr);
+        return ;
+    }
+
+    _logDebugPrefix(prefix, text, file, line, func, err, &format);
+    _logVWrite(log, !log->mutetype, true, LOG_LV_ERR == level, prefix, format, argptr);
+    va_end(argptr);
+    if(LOG_LV_ERR == level)
+        __atomic_add_fetch(&log->errs, 1, __ATOMIC_RELAXED);
+    _logReadUnlock();
+}
+
+/**
+ * @brief _logDebugPrefix - 在 buf 中渲染调式信息前缀 "[tag]: file(line)-func: "
+ * @param buf    至少 MAX_DEBUG_PREFIX 字节的缓冲区, 通常在调用者的栈上
+ * @param text   宏在编译期拼接好的前缀格式, 如 "[err]: " D_F_STR
+ * @param format 用户格式化字串, 若为 NULL 或空串, 在前缀后追加 strerror(err), 并把 *format 置为 NULL
+ * @return buf
+ */
+static constr _logDebugPrefix(char* buf, constr text, constr file, int line, constr func, int err, constr* format)
+{
+    int n = snprintf(buf, MAX_DEBUG_PREFIX, text, file, line, func);
+
+    if(!*format || !**format)
+    {
+        if(n < 0) n = 0;
+        if(n < MAX_DEBUG_PREFIX) snprintf(buf + n, MAX_DEBUG_PREFIX - n, "%s\n", strerror(err));
+        *format = NULL;
+    }
+    return buf;
+}
+
+/* ----------------------------- write implementation ------------------------- */
+
+/**
+ * @brief _logVWrite - 用户日志的统一写入入口, 所有 logAdd* 最终都调用这里
+ * @param log       目标日志结构
+ * @param console   是否同时输出到控制台
+ * @param timed     是否添加时间前缀, 控制台输出时还会在时间后附加 "[name] :"
+ * @param flush     写入后是否立即写出(logErr), 不受 fflush 策略限制; 异步模式下由写线程在写入这条记录后写出, 调用者不等待
+ * @param text      内容, 为 NULL 时只写入时间
+ * @param ap        参数列表
+ * @note  开启了 logSetDedup() 时先经过重复记录合并
+ */
+static void _logVWrite(LogPtr log, bool console, bool timed, bool flush, constr prefix, constr text, va_list ap)
+{
+    uint64_t begin = __atomic_load_n(&_logsys_stats, __ATOMIC_RELAXED) ? _logNsNow() : 0;
+
+    if(__atomic_load_n(&log->dedup, __ATOMIC_RELAXED))
+        _logDedupVWrite(log, console, timed, flush, prefix, text, ap, begin);
+    else
+        _logVEmit(log, console, timed, flush, prefix, text, ap, begin);
+}
+
+/**
+ * @brief _logVEmit - 写入一条记录, 参数同 _logVWrite
+ * @param begin     调用开始的时间(ns), 为 0 时不统计耗时
+ * @note  异步模式下只把渲染好的记录放入队列, 由后台写线程写入文件
+ */
+static void _logVEmit(LogPtr log, bool console, bool timed, bool flush, constr prefix, constr text, va_list ap, uint64_t begin)
+{
+    uint64_t lockwait, consolewait = 0;
+    LogFilePtr f = log->file;   // 多个日志指向同一文件时共享
+    uint64_t written, flushes;
+    LogBox* box;
+    size_t len, tlen;
+    char* line = NULL;
+    va_list cp;
+
+    if(_logAsyncEnter())
+    {
+        _logAsyncPush(log, console, timed, flush, prefix, text, ap);
+        _logAsyncLeave();
+        _logStatAdd(log, begin, 0, 0);
+        return;
+    }
+
+    _logFileShrink(f);
+
+    /* 需要输出到控制台或黑匣子时只渲染一次, 文件, 控制台和黑匣子使用同一份内容, 时间前缀也相同; 黑匣子在写入文件之前写入 */
+    box = __atomic_load_n(&f->box, __ATOMIC_ACQUIRE);
+    if(console || box)
+        line = _logLineV(&len, &tlen, timed, prefix, text, ap);
+    if(box && line)
+        _logBoxWrite(box, line, len);
+
+    // 写入文件流
+    lockwait = _logLockTimed(&f->locker);
+    written  = f->written;
+    flushes  = f->flushes;
+    if(f->binary)
+        _logBinVWrite(f, timed, prefix, text, ap);
+    else if(line)
+        _logFileWrite(f, line, len);
+    else if(LOG_IO_DIRECT == f->engine || LOG_IO_URING == f->engine)
+        _logDirectVWrite(f, timed, prefix, text, ap);
+    else if(LOG_IO_MMAP == f->engine)
+        _logMmapVWrite(f, timed, prefix, text, ap);
+    else
+    {
+        if(timed)   _logCount(f, fprintf(f->fp, "%s", _timeStr(TS_LOG)));
+        if(prefix)  _logCount(f, fprintf(f->fp, "%s", prefix));
+        if(text)    {va_copy(cp, ap); _logCount(f, vfprintf(f->fp, text, cp)); va_end(cp);}
+    }
+    _logCountLine(log, f->written - written);
+    if(flush && LOG_FLUSH_LINE != f->flush)
+        _logFileFlush(f);
+    else
+        _logFlushCheck(f);
+    _logCountFlush(log, f->flushes - flushes);     // 轮转等写入前的写出也计入
+    pthread_mutex_unlock(&f->locker);
+    // 如果需要, 输出到控制台
+    if(console && line && timed && (prefix || text))
+        consolewait = _logConsoleWritev((struct iovec[]){{line, tlen}, {"[", 1}, {log->name, strlen(log->name)}, {"] :", 3}, {line + tlen, len - tlen}}, 5);
+    else if(console && line)
+        consolewait = _logConsoleWritev(&(struct iovec){line, len}, 1);
+    else if(console)
+        consolewait = _logConsoleV(timed ? _timeStr(TS_LOG) : NULL, timed && (prefix || text) ? log->name : NULL, "] :", prefix, text, ap);
+    if(line)    _logLineEnd(line);
+    _logStatAdd(log, begin, lockwait, consolewait);
+}
+static void _logWrite(LogPtr log, bool console, bool timed, constr text, ...)
+{
+    va_list argptr;
+    va_start(argptr, text);
+    _logVWrite(log, console, timed, false, NULL, text, argptr);
+    va_end(argptr);
+}
+static void _logEmit(LogPtr log, bool console, bool timed, constr text, ...)
+{
+    va_list argptr;
+    va_start(argptr, text);
+    _logVEmit(log, console, timed, false, NULL, text, argptr, 0);
+    va_end(argptr);
+}
+
+/* ----------------------------- dedup implementation ------------------------- */
+/*  开启 logSetDedup() 后, 每条带时间的记录按格式化字串的转换说明把参数(不含时间, 不调用 vfprintf) 直接累加到 hash 中,
+ *  与上一条记录的 格式化字串指针, 参数字节数 和 hash 比较, 相同时只计数, 不写入;
+ *  遇到不同的记录, 或者第一条被合并的记录之后已超过设置的时间, 写入一行摘要, 之后的重复重新计数:
+ *      last message repeated N times in S.SSSs
+ *  被合并的记录在 dlocker 内只比较和计数; 摘要和新记录在 dlocker 内写入, 所以摘要总是紧跟在它合并的记录之后, 在打断这次重复的记录之前
+ *  格式化字串只在日志使用二进制记录时才记录到全局的格式化字串表中(编码时本来就会记录), 否则每次解析, 不占用表
+ */
+
+#define LOG_DEDUP_BUF   512
+
+/**
+ * @brief _logHashPut - 把 data 累加到 FNV-1a hash 中, 用法同 _logBinPut
+ * @return 累加后的总字节数
+ */
+static inline size_t _logHashPut(uint32_t* hash, size_t total, const void* data, size_t len)
+{
+    const unsigned char* p = data;
+    uint32_t h = *hash;
+    size_t n = len;
+
+    while(n--)  h = (h ^ *p++) * 16777619u;
+    *hash = h;
+    return total + len;
+}
+
+/**
+ * @brief _logDedupHash - 计算记录(不含时间) 的 hash, 参数和字串内容按转换说明直接累加, 不编码也不拷贝
+ * @param binary    日志是否使用二进制记录, 是时使用格式化字串表中的 id, 否则在栈上解析格式化字串, 格式化字串本身参与 hash
+ * @param hash      输出参数
+ * @param len       输出参数, 参与 hash 的字节数, 与 hash 一起比较
+ * @return 可以参与合并时返回 true; 含有不支持的转换说明 并且 渲染结果超过 LOG_DEDUP_BUF 时返回 false
+ */
+static bool _logDedupHash(constr prefix, constr text, bool binary, va_list ap, uint32_t* hash, size_t* len)
+{
+    _logFormat* f = binary ? _logFmtFind(text) : NULL;
+    _logFmtSpec local[MAX_FORMAT_SPECS];
+    const _logFmtSpec* specs = local;
+    char buf[LOG_DEDUP_BUF];
+    uint32_t h = 2166136261u, u32;
+    size_t total = 0, n;
+    int32_t iv = 0;
+    int64_t lv;
+    double dv;
+    long double ldv;
+    uint64_t pv;
+    constr str;
+    va_list cp;
+    int i, s, sp, nspecs;
+
+    if(prefix)  total = _logHashPut(&h, total, prefix, strlen(prefix));
+    if(f)
+    {
+        nspecs = f->nspecs;
+        specs  = f->specs;
+        total  = _logHashPut(&h, total, &f->id, sizeof(f->id));
+    }
+    else if((nspecs = _logFmtParse(text, local, MAX_FORMAT_SPECS)) >= 0)
+        total = _logHashPut(&h, total, text, strlen(text));     // 同一地址的内容可能改变
+    va_copy(cp, ap);
+    if(nspecs < 0)
+    {   /* 含有不支持的转换说明, 比较渲染结果 */
+        i = vsnprintf(buf, sizeof(buf), text, cp);
+        va_end(cp);
+        if(i < 0 || i >= (int)sizeof(buf))    return false;
+        total = _logHashPut(&h, total, buf, (size_t)i);
+        *hash = h;
+        *len  = total;
+        return true;
+    }
+    for(i = 0; i < nspecs; i++)
+    {
+        for(s = 0; s < specs[i].star; s++)
+        {
+            iv = va_arg(cp, int);
+            total = _logHashPut(&h, total, &iv, 4);
+        }
+        switch(specs[i].kind)
+        {
+            case LOG_ARG_INT:       iv = va_arg(cp, int);           total = _logHashPut(&h, total, &iv, 4);   break;
+            case LOG_ARG_LONG:      lv = va_arg(cp, long);          total = _logHashPut(&h, total, &lv, 8);   break;
+            case LOG_ARG_LLONG:     lv = va_arg(cp, long long);     total = _logHashPut(&h, total, &lv, 8);   break;
+            case LOG_ARG_INTMAX:    lv = va_arg(cp, intmax_t);      total = _logHashPut(&h, total, &lv, 8);   break;
+            case LOG_ARG_SIZE:      lv = va_arg(cp, size_t);        total = _logHashPut(&h, total, &lv, 8);   break;
+            case LOG_ARG_PTRDIFF:   lv = va_arg(cp, ptrdiff_t);     total = _logHashPut(&h, total, &lv, 8);   break;
+            case LOG_ARG_DOUBLE:    dv = va_arg(cp, double);        total = _logHashPut(&h, total, &dv, 8);   break;
+            case LOG_ARG_PTR:       pv = (uintptr_t)va_arg(cp, void*);  total = _logHashPut(&h, total, &pv, 8);   break;
+            case LOG_ARG_LDOUBLE:
+                memset(&ldv, 0, sizeof(ldv));   // 填充字节也参与 hash, 清零
+                ldv = va_arg(cp, long double);
+                total = _logHashPut(&h, total, &ldv, sizeof(ldv));
+                break;
+            case LOG_ARG_STR:
+                sp  = -2 == specs[i].prec ? iv : specs[i].prec;
+                str = va_arg(cp, constr);
+                n   = !str ? UINT32_MAX : sp >= 0 ? strnlen(str, sp) : strlen(str);
+                u32 = n;
+                total = _logHashPut(&h, total, &u32, 4);
+                if(str) total = _logHashPut(&h, total, str, n);
+                break;
+        }
+    }
+    va_end(cp);
+    *hash = h;
+    *len  = total;
+    return true;
+}
+
+/**
+ * @brief _logDedupVWrite - 合并连续重复的记录, 参数同 _logVEmit
+ * @note  不带时间的记录(logAddText*) 不参与合并, 但会结束当前的重复
+ */
+static void _logDedupVWrite(LogPtr log, bool console, bool timed, bool flush, constr prefix, constr text, va_list ap, uint64_t begin)
+{
+    bool dedup, same;
+    uint32_t hash = 0;
+    size_t len = 0;
+
+    dedup = timed && text && _logDedupHash(prefix, text, __atomic_load_n(&log->file->binary, __ATOMIC_RELAXED), ap, &hash, &len);
+
+    /* 重复的记录只计数; 摘要 和 打断重复的新记录在锁内写入, 其他线程的重复只能在新记录写入之后计数 */
+    pthread_mutex_lock(&log->dlocker);
+    same = dedup && text == log->dupfmt && len == log->duplen && hash == log->duphash && console == log->dupconsole;
+    if(same)
+    {
+        log->duplast = _logMsNow();
+        if(!log->dupcount++)
+            log->dupfirst = log->duplast;
+    }
+    if(!same || log->duplast - log->dupfirst >= (uint64_t)__atomic_load_n(&log->dedup, __ATOMIC_RELAXED))
+        _logDedupFlush(log);
+    if(!same)
+    {
+        log->dupfmt     = dedup ? text : NULL;
+        log->duplen     = len;
+        log->duphash    = hash;
+        log->dupconsole = console;
+        _logVEmit(log, console, timed, flush, prefix, text, ap, begin);
+    }
+    pthread_mutex_unlock(&log->dlocker);
+
+    if(same)    _logStatAdd(log, begin, 0, 0);
+}
+
+/**
+ * @brief _logDedupFlush - 如果有被合并的记录, 写入一行摘要, 须持有 log->dlocker
+ */
+static void _logDedupFlush(LogPtr log)
+{
+    if(!log->dupcount)  return;
+
+    _logEmit(log, log->dupconsole, true, "last message repeated %llu times in %.3fs\n",
+             (unsigned long long)log->dupcount, (log->duplast - log->dupfirst) / 1000.0);
+    log->dupcount = 0;
+}
+
+/* ----------------------------- rcu implementation ------------------------- */
+/*  日志名字典的无锁读取:
+ *      读者(所有 logAdd* 等 API) 不再直接访问 redisdic, 而是读取一个不可变的快照, 只需一次原子读, 没有锁也没有 rehash 副作用
+ *      logCreate/logDestroy 在 _dictLocker 保护下修改字典, 然后重建整个快照并原子替换(copy-on-write)
+ *
+ *  旧快照和被销毁的日志结构不能立即释放, 因为可能还有读者在使用, 这里使用基于纪元的延迟回收:
+ *      每个线程拥有一个独占缓存行的读者槽位, 进入读临界区时记录当前全局纪元, 离开时清零
+ *      被替换的对象标记为替换后的纪元, 当所有读者的纪元都为 0 或不小于该纪元时, 才真正释放
+ */
+
+static void _logReaderExit(void* reader)
+{
+    _logReader* r = reader;
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->used, false, __ATOMIC_RELEASE);
+}
+static void _logReaderKeyInit()
+{
+    pthread_key_create(&_rcu_key, _logReaderExit);
+}
+
+/**
+ * @brief _logReaderRegister - 为当前线程分配读者槽位, 优先复用已退出线程的槽位
+ */
+static _logReader* _logReaderRegister()
+{
+    _logReader* r;
+    bool unused;
+
+    pthread_once(&_rcu_once, _logReaderKeyInit);
+    for(r = __atomic_load_n(&_rcu_readers, __ATOMIC_ACQUIRE); r; r = r->next)
+    {
+        unused = false;
+        if(__atomic_compare_exchange_n(&r->used, &unused, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    if(!r)
+    {
+        if(posix_memalign((void**)&r, sizeof(*r), sizeof(*r)))
+            return NULL;
+        bzero(r, sizeof(*r));
+        r->used = true;
+        r->next = __atomic_load_n(&_rcu_readers, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&_rcu_readers, &r->next, r, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(_rcu_key, r);
+    return _rcu_self = r;
+}
+
+/**
+ * @brief _logReadLock - 进入读临界区, 可嵌套
+ * @note  只写当前线程独占的缓存行, 多个线程之间没有竞争;
+ *        分配读者槽位失败时改为累加 _rcu_fallback, 期间写者不回收任何对象, 读者仍然受保护
+ *        (不使用 _dictLocker, 持有它的 logCreate 等也会进入读临界区)
+ */
+void _logReadLock()
+{
+    _logReader* r = _rcu_self;
+
+    if(!r && !_rcu_fbdepth) r = _logReaderRegister();  // 嵌套在退回的读临界区中时不再注册, 保证进入和退出方式相同
+    if(!r)
+    {
+        if(!_rcu_fbdepth++)
+        {
+            __atomic_add_fetch(&_rcu_fallback, 1, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        }
+        return;
+    }
+    if(r->depth++)  return;
+    __atomic_store_n(&r->epoch, __atomic_load_n(&_rcu_epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);    // 保证纪元先于快照的读取对写者可见
+}
+void _logReadUnlock()
+{
+    _logReader* r = _rcu_self;
+
+    if(_rcu_fbdepth)
+    {
+        if(!--_rcu_fbdepth) __atomic_sub_fetch(&_rcu_fallback, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    if(!r || --r->depth)    return;
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief _logSnapFind - 在快照中查找日志结构
+ * @param name
+ * @return 找到的日志结构, 若不存在返回 NULL
+ */
+LogPtr _logSnapFind(constr name)
+{
+    _logSnap* snap = __atomic_load_n(&_logsys_snap, __ATOMIC_ACQUIRE);
+    unsigned int h;
+    unsigned long i;
+
+    if(!snap || !name)  return NULL;
+    h = _loghashFunction(name);
+    for(i = h & snap->sizemask; snap->slots[i].v; i = (i + 1) & snap->sizemask)
+        if(snap->slots[i].hash == h && !strcmp(snap->slots[i].v->name, name))
+            return snap->slots[i].v;
+    return NULL;
+}
+
+/**
+ * @brief _logSnapPublish - 根据当前字典重建快照(开放地址法, 装载因子不超过 1/2)并发布
+ * @return 成功返回 LOG_OK; 分配失败返回 LOG_ERR, 此时旧快照保持不变
+ */
+int _logSnapPublish()
+{
+    unsigned long used = _logsys_dic->ht[0].used + _logsys_dic->ht[1].used, size = DICT_HT_INITIAL_SIZE, i, j;
+    logdictEntry* he;
+    _logSnap* snap;
+    unsigned int h;
+    int table;
+
+    while(size < used * 2)  size <<= 1;
+    if(!(snap = calloc(sizeof(*snap) + size * sizeof(snap->slots[0]), 1)))
+    {
+        logsysAdd(NULL, "--Publishing snapshot... err: %s \n", strerror(errno));
+        return LOG_ERR;
+    }
+    snap->sizemask = size - 1;
+    for(table = 0; table <= 1; table++)
+        for(i = 0; i < _logsys_dic->ht[table].size; i++)
+            for(he = _logsys_dic->ht[table].table[i]; he; he = he->next)
+            {
+                if(!logdictGetVal(he))  continue;
+                h = logdictHashKey(_logsys_dic, he->key);
+                for(j = h & snap->sizemask; snap->slots[j].v; j = (j + 1) & snap->sizemask);
+                snap->slots[j].hash = h;
+                snap->slots[j].v    = logdictGetVal(he);
+            }
+
+    _logRetire(__atomic_exchange_n(&_logsys_snap, snap, __ATOMIC_ACQ_REL), free);
+    return LOG_OK;
+}
+
+/**
+ * @brief _logRetire - 推进全局纪元, 并把对象标记为新纪元, 加入延迟释放链表
+ * @note  调用前对象必须已经从快照中撤下; 分配链表节点失败时等待宽限期结束后直接释放
+ */
+void _logRetire(void* ptr, void (*destructor)(void*))
+{
+    _logRetired* node;
+
+    if(!ptr)    return;
+    if(!(node = malloc(sizeof(*node))))
+    {
+        _logSynchronize();
+        if(_valDestructor == destructor)    _logAsyncFlush();
+        destructor(ptr);
+        return;
+    }
+    node->ptr        = ptr;
+    node->destructor = destructor;
+    node->epoch      = __atomic_add_fetch(&_rcu_epoch, 1, __ATOMIC_SEQ_CST);
+    node->next       = _rcu_retired;
+    _rcu_retired     = node;
+}
+
+/**
+ * @brief _logReclaim - 释放所有宽限期已结束的对象
+ * @note  被释放的日志结构在异步队列中可能还有记录, 释放前先写完
+ */
+void _logReclaim()
+{
+    _logRetired** pp = &_rcu_retired, * node;
+    size_t oldest = SIZE_MAX, epoch;
+    _logReader* r;
+
+    if(__atomic_load_n(&_rcu_fallback, __ATOMIC_SEQ_CST))
+        return;     // 有没有读者槽位的读者, 无法判断它们进入的纪元
+    for(r = __atomic_load_n(&_rcu_readers, __ATOMIC_ACQUIRE); r; r = r->next)
+        if((epoch = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST)) && epoch < oldest)
+            oldest = epoch;
+
+    while((node = *pp))
+    {
+        if(node->epoch > oldest)    {pp = &node->next; continue;}
+
+        if(_valDestructor == node->destructor)  _logAsyncFlush();
+        node->destructor(node->ptr);
+        *pp = node->next;
+        free(node);
+    }
+}
+
+/**
+ * @brief _logHandleClose - 清空日志的句柄槽位, 并递增代数, 使该日志的所有旧句柄失效
+ * @note  必须在 _logRetire(log) 之前调用, 这样读到旧槽位内容的读者一定在宽限期内
+ */
+void _logHandleClose(LogPtr log)
+{
+    _logHandleSlot* slot;
+
+    if(!log->hslot) return;
+    slot = &_logsys_handles[log->hslot - 1];
+    __atomic_store_n(&slot->gen, slot->gen + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&slot->log, NULL, __ATOMIC_RELEASE);
+    log->hslot = 0;
+}
+
+/**
+ * @brief _logSynchronize - 等待所有在此之前进入读临界区的读者离开
+ */
+void _logSynchronize()
+{
+    size_t target = __atomic_add_fetch(&_rcu_epoch, 1, __ATOMIC_SEQ_CST), epoch;
+    _logReader* r;
+
+    for(r = __atomic_load_n(&_rcu_readers, __ATOMIC_ACQUIRE); r; r = r->next)
+        while((epoch = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST)) && epoch < target)
+            sched_yield();
+    while(__atomic_load_n(&_rcu_fallback, __ATOMIC_SEQ_CST))
+        sched_yield();
+}
+
+/* ----------------------------- async implementation ------------------------- */
+/*  异步模式:
+ *      生产者(调用 logAdd* 的线程) 只负责把渲染好的记录拷贝到一个有界的无锁多生产者队列中,
+ *      后台写线程从队列中批量取出记录, 写入各自日志结构的文件, 每批次每个文件只 fflush 一次
+ *
+ *  队列为 Dmitry Vyukov 的有界 MPMC 队列, 这里只有一个消费者(写线程), 所以出队不需要 CAS
+ *  每个槽位有一个序号 seq:
+ *      seq == pos        槽位空闲, 生产者可以占用
+ *      seq == pos + 1    槽位已写入, 消费者可以读取
+ *  队列满时丢弃记录并计数, 由写线程定期报告到系统日志中, 生产者永远不会阻塞
+ */
+
+/**
+ * @brief _logRender - 把 时间前缀, prefix 和 格式化后的 text 渲染到 buf 中
+ * @param buf   目标缓冲区
+ * @param cap   缓冲区大小
+ * @param tlen  输出参数, 时间前缀的长度
+ * @return 完整渲染所需的长度(不含 '\0'), 若大于等于 cap, 说明 buf 中的内容被截断
+ */
+static size_t _logRender(char* buf, size_t cap, size_t* tlen, bool timed, constr prefix, constr text, va_list ap)
+{
+    size_t len = 0;
+    va_list cp;
+    int n;
+
+    *tlen = 0;
+    if(timed)
+    {
+        constr ts = _timeLogStr(&len);
+        *tlen = len;
+        memcpy(buf, ts, len < cap ? len : cap);
+    }
+    if(prefix)
+    {
+        size_t plen = strlen(prefix);
+        if(len < cap) memcpy(buf + len, prefix, plen < cap - len ? plen : cap - len);
+        len += plen;
+    }
+    if(text)
+    {
+        va_copy(cp, ap);
+        n = vsnprintf(buf + (len < cap ? len : cap), len < cap ? cap - len : 0, text, cp);
+        va_end(cp);
+        if(n > 0)   len += n;
+    }
+    return len;
+}
+
+/**
+ * @brief _logLineV - 把 时间前缀, prefix 和 格式化后的 text 渲染到线程局部缓冲区, 同一份内容交给文件和控制台
+ * @param len   输出参数, 总长度
+ * @param tlen  输出参数, 时间前缀的长度
+ * @return 渲染结果, 用完后调用 _logLineEnd(); 内存不足时返回 NULL
+ * @note  超出缓冲区或缓冲区正在使用(嵌套调用) 时使用堆内存
+ */
+static char* _logLineV(size_t* len, size_t* tlen, bool timed, constr prefix, constr text, va_list ap)
+{
+    char* line, probe[1];
+
+    if(!_line_busy)
+    {
+        *len = _logRender(_line_buf, sizeof(_line_buf), tlen, timed, prefix, text, ap);
+        if(*len < sizeof(_line_buf))
+        {
+            _line_busy = true;
+            return _line_buf;
+        }
+    }
+    else
+        *len = _logRender(probe, sizeof(probe), tlen, timed, prefix, text, ap);
+
+    if((line = malloc(*len + 1)))
+        *len = _logRender(line, *len + 1, tlen, timed, prefix, text, ap);
+    return line;
+}
+static void _logLineEnd(char* line)
+{
+    if(line == _line_buf)   _line_busy = false;
+    else                    free(line);
+}
+
+/**
+ * @brief _logAsyncPush - 生产者: 占用一个队列槽位, 渲染记录到槽位中并发布
+ * @note  队列已满时丢弃记录, 并增加丢弃计数
+ */
+static void _logAsyncPush(LogPtr log, bool console, bool timed, bool flush, constr prefix, constr text, va_list ap)
+{
+    _logRecord* rec;
+    LogBox* box;
+    size_t pos, seq, len, tlen;
+    char* line;
+
+    pos = __atomic_load_n(&_async_enqueue, __ATOMIC_RELAXED);
+    for(;;)
+    {
+        rec = &_async_queue[pos & (DF_ASYNC_QUEUE_SIZE - 1)];
+        seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if(seq == pos)
+        {
+            if(__atomic_compare_exchange_n(&_async_enqueue, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if((intptr_t)(seq - pos) < 0)
+        {   /* 队列已满 */
+            __atomic_add_fetch(&_async_dropped, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&log->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+            pos = __atomic_load_n(&_async_enqueue, __ATOMIC_RELAXED);
+    }
+
+    /* 渲染记录到槽位的内联缓冲区中, 若放不下, 使用堆内存重新渲染; 二进制记录同理, 只是编码而不格式化 */
+    rec->log     = log;
+    rec->console = console;
+    rec->flush   = flush;
+    rec->tagged  = timed && (prefix || text);
+    rec->binary  = __atomic_load_n(&log->file->binary, __ATOMIC_RELAXED);
+    rec->msg     = rec->buf;
+    if(rec->binary)
+    {
+        len = _logBinEncode(rec->buf, sizeof(rec->buf), timed, prefix, text, ap);
+        if(len >= sizeof(rec->buf) && !(rec->msg = malloc(len + 1)))
+            rec->binary = false;    // 内存不足, 改为截断的文本记录
+        else if(len >= sizeof(rec->buf))
+            _logBinEncode(rec->msg, len + 1, timed, prefix, text, ap);
+    }
+    if(!rec->binary)
+    {
+        rec->msg = rec->buf;
+        len = _logRender(rec->buf, sizeof(rec->buf), &rec->tlen, timed, prefix, text, ap);
+        if(len >= sizeof(rec->buf) && (rec->msg = malloc(len + 1)))
+            len = _logRender(rec->msg, len + 1, &rec->tlen, timed, prefix, text, ap);
+        if(!rec->msg)
+        {
+            rec->msg = rec->buf;
+            len = sizeof(rec->buf) - 1;
+        }
+    }
+    rec->len = len;
+
+    /* 黑匣子在入队时写入, 进程崩溃时队列中的记录也不会丢失; 二进制记录为黑匣子另外渲染一份文本 */
+    if((box = __atomic_load_n(&log->file->box, __ATOMIC_ACQUIRE)))
+    {
+        if(!rec->binary)
+            _logBoxWrite(box, rec->msg, len);
+        else if((line = _logLineV(&len, &tlen, timed, prefix, text, ap)))
+        {
+            _logBoxWrite(box, line, len);
+            _logLineEnd(line);
+        }
+    }
+
+    /* 发布记录, 若写线程正在休眠, 唤醒它 */
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&_async_sleeping, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_lock(&_async_locker);
+        pthread_cond_signal(&_async_cond);
+        pthread_mutex_unlock(&_async_locker);
+    }
+}
+
+/**
+ * @brief _logAsyncDrain - 消费者: 批量取出队列中的记录并写入文件
+ * @return 本批次处理的记录数
+ */
+static size_t _logAsyncDrain()
+{
+    static LogPtr touched[DF_ASYNC_BATCH];     // 本批次写入过的文件(各取最后一条记录的日志), 批次结束时统一按策略 fflush, 只有写线程访问
+    size_t ntouched = 0, n = 0, i, len, tlen;
+    char text[DF_ASYNC_MSG_SIZE], * msg;
+    uint64_t lockwait, consolewait, written, flushes;
+    _logRecord* rec;
+    LogFilePtr f;
+
+    _uring_defer = true;    // LOG_IO_URING 的缓冲区在批次结束时统一提交
+    while(n < DF_ASYNC_BATCH)
+    {
+        rec = &_async_queue[_async_dequeue & (DF_ASYNC_QUEUE_SIZE - 1)];
+        if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != _async_dequeue + 1)
+            break;
+
+        /* 写入文件流, 批次结束时再按策略 fflush */
+        f = rec->log->file;
+        _logFileShrink(f);
+        lockwait    = _logLockTimed(&f->locker);
+        consolewait = 0;
+        written     = f->written;
+        flushes     = f->flushes;
+        if(rec->binary) _logBinWrite(f, rec->msg, rec->len);
+        else            _logFileWrite(f, rec->msg, rec->len);
+        _logCountLine(rec->log, f->written - written);
+        if(rec->flush && LOG_FLUSH_LINE != f->flush)
+            _logFileFlush(f);       // logErr 的记录写入后立即写出, 不等批次结束
+        _logCountFlush(rec->log, f->flushes - flushes);
+        pthread_mutex_unlock(&f->locker);
+        for(i = 0; i < ntouched && touched[i]->file != f; i++);
+        touched[i] = rec->log;
+        if(i == ntouched)   ntouched++;
+
+        /* 如果需要, 输出到控制台, 二进制记录在这里格式化 */
+        if(rec->console)
+        {
+            msg  = rec->msg;
+            len  = rec->len;
+            tlen = rec->tlen;
+            if(rec->binary)
+            {
+                msg = text;
+                len = _logBinRender(text, sizeof(text), &tlen, rec->msg, rec->len, _logBinLookup(rec->msg));
+                if(len >= sizeof(text) && (msg = malloc(len + 1)))
+                    _logBinRender(msg, len + 1, &tlen, rec->msg, rec->len, _logBinLookup(rec->msg));
+                if(!msg)
+                {
+                    msg = text;
+                    len = sizeof(text) - 1;
+                }
+            }
+            if(rec->tagged)
+                consolewait = _logConsoleWritev((struct iovec[]){{msg, tlen}, {"[", 1}, {rec->log->name, strlen(rec->log->name)}, {"] :", 3}, {msg + tlen, len - tlen}}, 5);
+            else
+                consolewait = _logConsoleWritev(&(struct iovec){msg, len}, 1);
+            if(msg != text && msg != rec->msg)  free(msg);
+        }
+        _logStatAdd(rec->log, 0, lockwait, consolewait);   // 写线程的等待也计入, 调用耗时已由生产者记录
+
+        /* 释放槽位 */
+        if(rec->msg != rec->buf)    free(rec->msg);
+        __atomic_store_n(&rec->seq, _async_dequeue + DF_ASYNC_QUEUE_SIZE, __ATOMIC_RELEASE);
+        _async_dequeue++;
+        n++;
+    }
+    for(i = 0; i < ntouched; i++)
+    {
+        f = touched[i]->file;
+        pthread_mutex_lock(&f->locker);
+        flushes = f->flushes;
+        _logFlushCheck(f);
+        _logCountFlush(touched[i], f->flushes - flushes);
+        pthread_mutex_unlock(&f->locker);
+    }
+    _uring_defer = false;
+    _logUringSubmit();
+
+    /* 通知等待中的 _logAsyncFlush() */
+    if(n)
+    {
+        pthread_mutex_lock(&_async_locker);
+        __atomic_store_n(&_async_done, _async_dequeue, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&_async_flushcond);
+        pthread_mutex_unlock(&_async_locker);
+    }
+
+    return n;
+}
+
+/**
+ * @brief _logAsyncReport - 报告上次报告以来因队列满而丢弃的记录数
+ * @note  由定时线程每 DF_ASYNC_REPORT_MS 毫秒调用一次, 停止异步模式时再调用一次; 每条丢弃的记录都已计入所属日志的 dropped 计数器
+ */
+static void _logAsyncReport()
+{
+    size_t dropped;
+
+    if(!(dropped = __atomic_exchange_n(&_async_dropped, 0, __ATOMIC_RELAXED)))
+        return;
+    logsysAdd(NULL, "--Async queue is full, %zu records dropped\n", dropped);
+    logsysShow("--Async queue is full, %zu records dropped\n", dropped);
+}
+
+/**
+ * @brief _logAsyncWriter - 后台写线程, 队列为空时休眠, 直到被生产者唤醒或超时
+ */
+static void* _logAsyncWriter(void* arg)
+{
+    struct timespec ts;
+    _logRecord* rec;
+
+    for(;;)
+    {
+        if(_logAsyncDrain())    continue;
+        if(__atomic_load_n(&_async_stop, __ATOMIC_ACQUIRE))
+            break;
+
+        pthread_mutex_lock(&_async_locker);
+        __atomic_store_n(&_async_sleeping, true, __ATOMIC_SEQ_CST);
+        rec = &_async_queue[_async_dequeue & (DF_ASYNC_QUEUE_SIZE - 1)];
+        if(__atomic_load_n(&rec->seq, __ATOMIC_SEQ_CST) != _async_dequeue + 1 && !_async_stop)
+        {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += DF_ASYNC_WAIT_MS * 1000000L;
+            if(ts.tv_nsec >= 1000000000L)   {ts.tv_sec++; ts.tv_nsec -= 1000000000L;}
+            pthread_cond_timedwait(&_async_cond, &_async_locker, &ts);
+        }
+        __atomic_store_n(&_async_sleeping, false, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&_async_locker);
+    }
+    return arg;
+}
+
+/**
+ * @brief _logAsyncStart - 创建异步队列并启动后台写线程
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ */
+static int _logAsyncStart()
+{
+    size_t i;
+    int ret = LOG_OK;
+
+    pthread_mutex_lock(&_async_ctl);
+    if(!__atomic_load_n(&_async_running, __ATOMIC_RELAXED))
+    {
+        if(!_async_queue && !(_async_queue = calloc(DF_ASYNC_QUEUE_SIZE, sizeof(*_async_queue))))
+        {
+            pthread_mutex_unlock(&_async_ctl);
+            return LOG_ERR;
+        }
+        for(i = 0; i < DF_ASYNC_QUEUE_SIZE; i++)
+            _async_queue[i].seq = i;
+        _async_enqueue = _async_dequeue = _async_done = 0;
+        _async_stop = false;
+
+        if(pthread_create(&_async_writer, NULL, _logAsyncWriter, NULL))
+            ret = LOG_ERR;
+        else
+            __atomic_store_n(&_async_running, true, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&_async_ctl);
+
+    /* 丢弃的记录由定时线程限速报告 */
+    if(LOG_OK == ret && LOG_ERR == _logFlushStart())
+        logsysAdd(NULL, "--Start flush ticker for async drop report... err: %s\n", strerror(errno));
+    return ret;
+}
+
+/**
+ * @brief _logAsyncStop - 停止后台写线程, 停止前会写完队列中所有的记录
+ */
+static void _logAsyncStop()
+{
+    pthread_mutex_lock(&_async_ctl);
+    if(!__atomic_load_n(&_async_running, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_unlock(&_async_ctl);
+        return;
+    }
+
+    /* 新的记录不再入队, 直接同步写入; 等待已经通过检查的生产者和 _logAsyncFlush 离开, 之后没有线程会再访问队列 */
+    __atomic_store_n(&_async_running, false, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&_async_inflight, __ATOMIC_SEQ_CST))
+        sched_yield();
+
+    pthread_mutex_lock(&_async_locker);
+    __atomic_store_n(&_async_stop, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&_async_cond);
+    pthread_mutex_unlock(&_async_locker);
+    pthread_join(_async_writer, NULL);
+
+    /* 生产者都已离开, 写线程退出前已写完队列, 这里只是保险 */
+    while(__atomic_load_n(&_async_enqueue, __ATOMIC_ACQUIRE) != _async_dequeue)
+        if(!_logAsyncDrain())   sched_yield();
+
+    free(_async_queue);
+    _async_queue = NULL;
+    pthread_mutex_unlock(&_async_ctl);
+    _logAsyncReport();
+}
+
+/**
+ * @brief _logAsyncEnter - 写线程在运行时登记为 in-flight, 登记期间 _logAsyncStop 不会释放队列
+ * @return 写线程在运行时返回 true, 用完后须调用 _logAsyncLeave(); 否则返回 false, 不需要调用
+ * @note  与 _logAsyncStop 的 写 _async_running -> 读 _async_inflight 对称, 两边都使用 SEQ_CST, 总有一方能看到另一方
+ */
+static bool _logAsyncEnter()
+{
+    if(!__atomic_load_n(&_async_running, __ATOMIC_ACQUIRE))
+        return false;
+    __atomic_add_fetch(&_async_inflight, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&_async_running, __ATOMIC_SEQ_CST))
+        return true;
+    __atomic_sub_fetch(&_async_inflight, 1, __ATOMIC_RELEASE);
+    return false;
+}
+static void _logAsyncLeave()
+{
+    __atomic_sub_fetch(&_async_inflight, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief _logAsyncFlush - 等待目前已入队的所有记录都被写入文件
+ * @note  销毁日志结构前必须调用, 否则队列中可能还有指向该日志的记录
+ */
+static void _logAsyncFlush()
+{
+    size_t target;
+
+    if(!_logAsyncEnter())   return;
+
+    target = __atomic_load_n(&_async_enqueue, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&_async_locker);
+    while(__atomic_load_n(&_async_done, __ATOMIC_ACQUIRE) < target)
+    {
+        pthread_cond_signal(&_async_cond);
+        pthread_cond_wait(&_async_flushcond, &_async_locker);
+    }
+    pthread_mutex_unlock(&_async_locker);
+    _logAsyncLeave();
+}
+
+/* ----------------------------- flush implementation ------------------------- */
+/*  fflush 策略:
+ *      LOG_FLUSH_LINE 和 LOG_FLUSH_BYTES 在写入路径上(持有 file->locker)由 _logFlushCheck 判断
+ *      LOG_FLUSH_TIME 由定时线程处理: 每 DF_FLUSH_TICK_MS 毫秒遍历一次快照, fflush 已到期且有未写出内容的日志
+ *      LOG_FLUSH_MANUAL 只在 logErr 或 logFlush() 时 fflush
+ *      logErr 的记录带有 flush 标记, 同步模式下写入后在锁内写出; 异步模式下由写线程写入这条记录后写出, 调用者不等待队列
+ *  定时线程在第一次设置 LOG_FLUSH_TIME 时启动, 在 logsysStop() 中停止
+ */
+
+/**
+ * @brief _logFlushCheck - 按日志文件的 fflush 策略决定是否 fflush
+ * @note  须持有 file->locker
+ */
+static void _logFlushCheck(LogFilePtr file)
+{
+    if(LOG_FLUSH_LINE != file->flush && (LOG_FLUSH_BYTES != file->flush || file->pending < file->flusharg))
+        return;
+    if(LOG_IO_URING == file->engine)
+    {   /* 只交给 io_uring, 不等待写入完成 */
+        if(file->wlen)   _logDirectSubmit(file, NULL, 0);
+        file->pending = 0;
+    }
+    else
+        _logFileFlush(file);
+}
+
+/**
+ * @brief _logFlush - 立即 fflush 日志文件
+ * @note  必须在读临界区内调用; 异步模式下先等待目前已入队的记录全部写入
+ */
+static void _logFlush(LogPtr log)
+{
+    LogFilePtr f = log->file;
+
+    _logAsyncFlush();       // 异步模式下先等待已入队的记录写入
+
+    pthread_mutex_lock(&f->locker);
+    _logFileFlush(f);
+    _logCountFlush(log, 1);
+    pthread_mutex_unlock(&f->locker);
+}
+
+/**
+ * @brief _logFlushTicker - 定时 fflush 线程, 同时负责定时写入计数器
+ */
+static void* _logFlushTicker(void* arg)
+{
+    struct timespec ts;
+    _logSnap* snap;
+    LogPtr log;
+    LogFilePtr f;
+    uint64_t now, dumptime = _logMsNow(), reporttime = dumptime;
+    unsigned long i;
+    int dump, dedup;
+
+    pthread_mutex_lock(&_flush_locker);
+    while(!_flush_stop)
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += DF_FLUSH_TICK_MS * 1000000L;
+        if(ts.tv_nsec >= 1000000000L)   {ts.tv_sec++; ts.tv_nsec -= 1000000000L;}
+        pthread_cond_timedwait(&_flush_cond, &_flush_locker, &ts);
+        if(_flush_stop) break;
+        pthread_mutex_unlock(&_flush_locker);
+
+        now = _logMsNow();
+        _logReadLock();
+        if((snap = __atomic_load_n(&_logsys_snap, __ATOMIC_ACQUIRE)))
+            for(i = 0; i <= snap->sizemask; i++)
+            {
+                if(!(log = snap->slots[i].v))
+                    continue;
+                if((dedup = __atomic_load_n(&log->dedup, __ATOMIC_RELAXED)))
+                {   /* 重复已超时 */
+                    pthread_mutex_lock(&log->dlocker);
+                    if(log->dupcount && now - log->dupfirst >= (uint64_t)dedup)
+                        _logDedupFlush(log);
+                    pthread_mutex_unlock(&log->dlocker);
+                }
+                f = log->file;      // fflush 策略属于文件, 共享的文件由先遍历到的日志写出并计数
+                if(LOG_FLUSH_TIME != __atomic_load_n(&f->flush, __ATOMIC_RELAXED))
+                    continue;
+                pthread_mutex_lock(&f->locker);
+                if(LOG_FLUSH_TIME == f->flush && now - f->flushtime >= f->flusharg)
+                {
+                    if(f->pending)  {_logFileFlush(f); _logCountFlush(log, 1);}
+                    f->flushtime = now;
+                }
+                pthread_mutex_unlock(&f->locker);
+            }
+        _logReadUnlock();
+        _logSiteFlush();
+
+        /* 顺带定时写入计数器 */
+        if(!(dump = __atomic_load_n(&_logsys_dump, __ATOMIC_RELAXED)))
+            dumptime = now;
+        else if(now - dumptime >= (uint64_t)dump * 1000)
+        {
+            logsysDump();
+            dumptime = now;
+        }
+
+        /* 限速报告异步队列丢弃的记录 */
+        if(now - reporttime >= DF_ASYNC_REPORT_MS)
+        {
+            _logAsyncReport();
+            _logFmtReport();
+            reporttime = now;
+        }
+
+        pthread_mutex_lock(&_flush_locker);
+    }
+    pthread_mutex_unlock(&_flush_locker);
+    return arg;
+}
+
+/**
+ * @brief _logFlushStart - 启动定时 fflush 线程, 已启动时直接返回
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ */
+static int _logFlushStart()
+{
+    int ret = LOG_OK;
+
+    pthread_mutex_lock(&_flush_locker);
+    if(!_flush_running)
+    {
+        _flush_stop = false;
+        if(pthread_create(&_flush_ticker, NULL, _logFlushTicker, NULL))
+            ret = LOG_ERR;
+        else
+            _flush_running = true;
+    }
+    pthread_mutex_unlock(&_flush_locker);
+    return ret;
+}
+
+/**
+ * @brief _logFlushStop - 停止定时 fflush 线程
+ */
+static void _logFlushStop()
+{
+    pthread_mutex_lock(&_flush_locker);
+    if(!_flush_running)
+    {
+        pthread_mutex_unlock(&_flush_locker);
+        return;
+    }
+    _flush_running = false;
+    _flush_stop    = true;
+    pthread_cond_signal(&_flush_cond);
+    pthread_mutex_unlock(&_flush_locker);
+    pthread_join(_flush_ticker, NULL);
+}
+
+/**
+ * @brief _logSiteLink - 把限速的调用点加入链表, 由 _logDebugSite 在调用点第一次输出时调用
+ * @param name  本次输出的日志名称, 定时线程的报告写入这个日志
+ * @note  多个线程同时调用时只有一个加入; 同时启动定时线程
+ */
+void _logSiteLink(_logSite* s, constr name, int level, constr text, constr file, int line, constr func)
+{
+    bool linked = false;
+
+    if(!_logsys_service || !name || !*name)   return;
+    if(!__atomic_compare_exchange_n(&s->linked, &linked, true, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+    s->name  = strdup(name);
+    s->level = level;
+    s->text  = text;
+    s->file  = file;
+    s->line  = line;
+    s->func  = func;
+    s->next  = __atomic_load_n(&_logsys_sites, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&_logsys_sites, &s->next, s, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if(LOG_ERR == _logFlushStart())
+        logsysAdd(name, "--Linking rate limited site... err: can not start flush ticker \n");
+}
+
+/**
+ * @brief _logSiteFlush - 报告窗口已结束的限速调用点被抑制的条数, 由定时线程调用
+ * @note  把上一个窗口的次数改为 limit, 之后调用者切换窗口时不再重复报告; 调用者先切换了窗口时不报告
+ */
+static void _logSiteFlush()
+{
+    uint64_t now = (uint32_t)time(NULL), v;
+    uint32_t limit;
+    _logSite* s;
+
+    for(s = __atomic_load_n(&_logsys_sites, __ATOMIC_ACQUIRE); s; s = s->next)
+    {
+        v     = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+        limit = __atomic_load_n(&s->limit, __ATOMIC_RELAXED);
+        if(v >> 32 == now || (uint32_t)v <= limit || !s->name)
+            continue;
+        if(__atomic_compare_exchange_n(&s->count, &v, (v >> 32) << 32 | limit, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            logAddDebug(s->name, s->level, s->text, s->file, s->line, s->func, 0,
+                        "%llu similar messages suppressed\n", (unsigned long long)((uint32_t)v - limit));
+    }
+}
+
+static uint64_t _logMsNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* ----------------------------- console implementation ------------------------- */
+/*  所有控制台输出(用户日志, 系统日志, logShow*) 都先渲染好, 每条只输出一次:
+ *      控制台线程未运行时, 持有 consoleLocker 直接 writev 到 stderr, 一条输出只有一次系统调用
+ *      控制台线程运行时(logsysSetConsoleAsync), 持有 consoleLocker 只做 memcpy 到接收缓冲区, 缓冲区满或单条输出超过缓冲区大小时丢弃并计数,
+ *      控制台线程交换双缓冲区后在锁外写出, 终端或管道读取缓慢时只有控制台线程被阻塞
+ */
+
+/**
+ * @brief _logConsoleWritev - 输出到控制台
+ * @return 等待控制台锁的时间(ns), 只在发生竞争时计时
+ * @note  iov 可能被修改
+ */
+static uint64_t _logConsoleWritev(struct iovec* iov, int cnt)
+{
+    uint64_t wait = _logLockTimed(&consoleLocker);
+    size_t len = 0;
+    int i;
+
+    for(i = 0; i < cnt; i++)    len += iov[i].iov_len;
+    if(!_console_running)
+        _logWritev(STDERR_FILENO, iov, cnt);
+    else if(_console_len + len > DF_CONSOLE_BUF_SIZE)
+        _console_dropped++;     // 超过缓冲区大小的输出也丢弃, 控制台线程运行时调用者从不写 stderr
+    else
+    {
+        for(i = 0; i < cnt; i++)
+        {
+            memcpy(_console_buf[_console_cur] + _console_len, iov[i].iov_base, iov[i].iov_len);
+            _console_len += iov[i].iov_len;
+        }
+        if(_console_len >= DF_CONSOLE_BUF_SIZE / 2 && _console_len - len < DF_CONSOLE_BUF_SIZE / 2)
+            pthread_cond_signal(&_console_cond);
+    }
+    pthread_mutex_unlock(&consoleLocker);
+    return wait;
+}
+
+/**
+ * @brief _logConsoleV - 输出 head, "[name" sep, prefix 和 格式化后的 text 到控制台, 为 NULL 的部分不输出
+ * @return 等待控制台锁的时间(ns)
+ */
+static uint64_t _logConsoleV(constr head, constr name, constr sep, constr prefix, constr text, va_list ap)
+{
+    char buf[DF_ASYNC_MSG_SIZE], * msg = buf;
+    struct iovec iov[6];
+    uint64_t wait;
+    va_list cp;
+    int cnt = 0, n = 0;
+
+    if(text)
+    {
+        va_copy(cp, ap); n = vsnprintf(buf, sizeof(buf), text, cp); va_end(cp);
+        if(n >= (int)sizeof(buf) && (msg = malloc(n + 1)))
+            {va_copy(cp, ap); vsnprintf(msg, n + 1, text, cp); va_end(cp);}
+        if(!msg)    {msg = buf; n = sizeof(buf) - 1;}
+        if(n < 0)   n = 0;
+    }
+    if(head)    iov[cnt++] = (struct iovec){(void*)head, strlen(head)};
+    if(name)
+    {
+        iov[cnt++] = (struct iovec){"[", 1};
+        iov[cnt++] = (struct iovec){(void*)name, strlen(name)};
+        iov[cnt++] = (struct iovec){(void*)sep, strlen(sep)};
+    }
+    if(prefix)  iov[cnt++] = (struct iovec){(void*)prefix, strlen(prefix)};
+    if(n)       iov[cnt++] = (struct iovec){msg, n};
+    wait = _logConsoleWritev(iov, cnt);
+
+    if(msg != buf)  free(msg);
+    return wait;
+}
+static uint64_t _logConsole(constr head, constr name, constr sep, constr prefix, constr text, ...)
+{
+    uint64_t wait;
+    va_list argptr;
+    va_start(argptr, text);
+    wait = _logConsoleV(head, name, sep, prefix, text, argptr);
+    va_end(argptr);
+    return wait;
+}
+
+/**
+ * @brief _logConsoleWriter - 控制台线程, 缓冲区为空时休眠, 直到超时或缓冲区超过一半
+ */
+static void* _logConsoleWriter(void* arg)
+{
+    struct timespec ts;
+    struct iovec iov;
+    size_t dropped;
+
+    pthread_mutex_lock(&consoleLocker);
+    for(;;)
+    {
+        if(!_console_len && !_console_dropped)
+        {
+            if(_console_stop)   break;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += DF_CONSOLE_WAIT_MS * 1000000L;
+            if(ts.tv_nsec >= 1000000000L)   {ts.tv_sec++; ts.tv_nsec -= 1000000000L;}
+            pthread_cond_timedwait(&_console_cond, &consoleLocker, &ts);
+            continue;
+        }
+
+        /* 交换缓冲区, 在锁外写出 */
+        iov.iov_base = _console_buf[_console_cur];
+        iov.iov_len  = _console_len;
+        dropped      = _console_dropped;
+        _console_cur ^= 1;
+        _console_len = _console_dropped = 0;
+        pthread_mutex_unlock(&consoleLocker);
+
+        _logWritev(STDERR_FILENO, &iov, 1);
+        if(dropped)
+        {
+            logsysAddMute(NULL, "--Console is too slow, %zu outputs dropped\n", dropped);
+            _logConsole(_timeStr(TS_LOG), NULL, NULL, NULL, "--Console is too slow, %zu outputs dropped\n", dropped);
+        }
+
+        pthread_mutex_lock(&consoleLocker);
+    }
+    pthread_mutex_unlock(&consoleLocker);
+    return arg;
+}
+
+/**
+ * @brief _logConsoleStart - 分配缓冲区并启动控制台线程, 已启动时直接返回
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ */
+static int _logConsoleStart()
+{
+    int ret = LOG_OK;
+
+    pthread_mutex_lock(&consoleLocker);
+    if(!_console_running)
+    {
+        if(!_console_buf[0])    _console_buf[0] = malloc(DF_CONSOLE_BUF_SIZE);
+        if(!_console_buf[1])    _console_buf[1] = malloc(DF_CONSOLE_BUF_SIZE);
+        _console_len = _console_dropped = 0;
+        _console_cur  = 0;
+        _console_stop = false;
+        if(!_console_buf[0] || !_console_buf[1] || pthread_create(&_console_writer, NULL, _logConsoleWriter, NULL))
+            ret = LOG_ERR;
+        else
+            _console_running = true;
+    }
+    pthread_mutex_unlock(&consoleLocker);
+    return ret;
+}
+
+/**
+ * @brief _logConsoleStop - 停止控制台线程, 停止前会写完缓冲区中的输出
+ */
+static void _logConsoleStop()
+{
+    pthread_mutex_lock(&consoleLocker);
+    if(!_console_running)
+    {
+        pthread_mutex_unlock(&consoleLocker);
+        return;
+    }
+    _console_stop = true;
+    pthread_cond_signal(&_console_cond);
+    pthread_mutex_unlock(&consoleLocker);
+    pthread_join(_console_writer, NULL);
+
+    /* 控制台线程退出后, 新的输出直接写入 */
+    pthread_mutex_lock(&consoleLocker);
+    if(_console_len)
+        _logWritev(STDERR_FILENO, &(struct iovec){_console_buf[_console_cur], _console_len}, 1);
+    _console_running = false;
+    free(_console_buf[0]);
+    free(_console_buf[1]);
+    _console_buf[0] = _console_buf[1] = NULL;
+    _console_len = 0;
+    pthread_mutex_unlock(&consoleLocker);
+}
+
+/* ----------------------------- stats implementation ------------------------- */
+/*  计数器(lines bytes flushes) 在持有 log->file->locker 时更新, 其他线程只做原子读取, 不需要原子累加
+ *  调用耗时和锁等待时间记录在 LOG_STAT_SHARDS 个分片中, 每个线程第一次记录时分配一个序号, 按序号选择分片,
+ *  线程数不超过分片数时, 各线程只写自己的缓存行, 统计本身不会引入竞争; 读取时累加所有分片
+ *  耗时直方图类似 HdrHistogram: 桶按 2 的幂划分, 每个区间再等分为 2^LOG_HIST_SUB_BITS 个子区间
+ */
+
+static uint64_t _logNsNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief _logLockTimed - 加锁, 先 trylock, 只有发生竞争时才读时钟
+ * @return 等待的时间(ns), 没有竞争时返回 0
+ */
+static uint64_t _logLockTimed(pthread_mutex_t* m)
+{
+    uint64_t t;
+
+    if(!pthread_mutex_trylock(m))   return 0;
+    t = _logNsNow();
+    pthread_mutex_lock(m);
+    return _logNsNow() - t;
+}
+
+/**
+ * @brief _logStatAdd - 把一次写入调用记录到当前线程的分片中
+ * @param begin       调用开始的时间, 为 0 时只记录锁等待时间
+ * @param lockwait    等待日志文件锁的时间
+ * @param consolewait 等待控制台锁的时间
+ */
+static void _logStatAdd(LogPtr log, uint64_t begin, uint64_t lockwait, uint64_t consolewait)
+{
+    _logStatShard* s;
+
+    if(!log->stats) return;
+    if(!_stat_self) _stat_self = __atomic_add_fetch(&_stat_threads, 1, __ATOMIC_RELAXED);
+    s = &log->stats[(_stat_self - 1) & (LOG_STAT_SHARDS - 1)];
+
+    if(lockwait)    __atomic_add_fetch(&s->lockwait, lockwait, __ATOMIC_RELAXED);
+    if(consolewait) __atomic_add_fetch(&s->consolewait, consolewait, __ATOMIC_RELAXED);
+    if(begin)
+    {
+        __atomic_add_fetch(&s->calls, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->hist[_logHistIndex(_logNsNow() - begin)], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief _logStatsCollect - 把日志的计数器和所有分片累加到 st 中
+ * @note  必须在读临界区内调用; 各项分别原子读取, 彼此之间不保证是同一时刻的值
+ */
+static void _logStatsCollect(LogPtr log, LogStats* st)
+{
+    _logStatShard* s;
+    int i, j;
+
+    st->lines   += __atomic_load_n(&log->lines,   __ATOMIC_RELAXED);
+    st->bytes   += __atomic_load_n(&log->bytes,   __ATOMIC_RELAXED);
+    st->errs    += __atomic_load_n(&log->errs,    __ATOMIC_RELAXED);
+    st->dropped += __atomic_load_n(&log->dropped, __ATOMIC_RELAXED);
+    st->flushes += __atomic_load_n(&log->flushes, __ATOMIC_RELAXED);
+    if(!log->stats) return;
+    for(i = 0; i < LOG_STAT_SHARDS; i++)
+    {
+        s = &log->stats[i];
+        st->calls       += __atomic_load_n(&s->calls,       __ATOMIC_RELAXED);
+        st->lockwait    += __atomic_load_n(&s->lockwait,    __ATOMIC_RELAXED);
+        st->consolewait += __atomic_load_n(&s->consolewait, __ATOMIC_RELAXED);
+        for(j = 0; j < LOG_HIST_BUCKETS; j++)
+            st->hist[j] += __atomic_load_n(&s->hist[j], __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief _logHistIndex - 计算耗时对应的直方图桶
+ * @note  小于 2^LOG_HIST_SUB_BITS 的值各占一个桶; 之后每个 [2^k, 2^(k+1)) 区间占 2^LOG_HIST_SUB_BITS 个桶
+ */
+static unsigned _logHistIndex(uint64_t ns)
+{
+    unsigned msb, idx;
+
+    if(ns < (1u << LOG_HIST_SUB_BITS))  return (unsigned)ns;
+    msb = 63 - __builtin_clzll(ns);
+    idx = (msb - LOG_HIST_SUB_BITS + 1) << LOG_HIST_SUB_BITS | (unsigned)(ns >> (msb - LOG_HIST_SUB_BITS) & ((1u << LOG_HIST_SUB_BITS) - 1));
+    return idx < LOG_HIST_BUCKETS ? idx : LOG_HIST_BUCKETS - 1;
+}
+
+/**
+ * @brief _logHistValue - 直方图桶的上界, 即桶中最大的值
+ */
+static uint64_t _logHistValue(unsigned idx)
+{
+    unsigned shift;
+
+    if(idx < (1u << LOG_HIST_SUB_BITS)) return idx;
+    shift = (idx >> LOG_HIST_SUB_BITS) - 1;
+    return ((uint64_t)((1u << LOG_HIST_SUB_BITS) | (idx & ((1u << LOG_HIST_SUB_BITS) - 1))) << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+/* ----------------------------- io engine implementation ------------------------- */
+/*  LOG_IO_DIRECT:
+ *      每个日志文件有两个大小为 wcap 的缓冲区, 记录在持有 file->locker 时直接渲染到当前缓冲区 wbuf[wcur] 中
+ *      需要写出时(缓冲区放不下或 fflush 策略要求), 交换缓冲区并置 wbusy, 然后释放锁, 在锁外 writev 旧缓冲区,
+ *      此时其他线程可以继续向新缓冲区写入; 同一时刻最多一个缓冲区在 writev, 后来者在 wcond 上等待, 保证写入顺序
+ *      交换只发生在两条记录之间, 所以一条记录不会被拆到两个缓冲区中
+ *  文件仍通过 fopen(path, "a+") 打开, 只使用它的 fd(O_APPEND), 轮转/清空/销毁前都会先写出缓冲区
+ *
+ *  LOG_IO_MMAP:
+ *      文件从实际长度所在的页开始, 每次 fallocate 预分配 mlen 字节(同时扩展文件长度, 映射超出文件长度的部分会引发 SIGBUS),
+ *      并映射为窗口 [moff, moff + mlen), 记录直接渲染或拷贝到窗口中, 窗口写满时解除映射, 预分配并映射下一块
+ *      文件的实际长度为 moff + mpos, cursize 照常累加, 所以 _logFileShrink 的大小检测不受影响;
+ *      轮转/清空/销毁/切换引擎时通过 _logFileDetach 解除映射并截断到实际长度, 之后 _logFileAttach 重新映射新文件
+ *      进程崩溃时文件长度停在窗口末尾, _logFileAttach 映射前由 _logMmapTrim 截掉末尾的 '\0', 新记录紧接在实际内容之后
+ *
+ *  LOG_IO_URING:
+ *      缓冲方式和 LOG_IO_DIRECT 相同, 见下面的 uring implementation
+ */
+
+/**
+ * @brief _logFileWrite - 按写入引擎写入一段已渲染好的数据
+ * @note  须持有 file->locker
+ */
+static void _logFileWrite(LogFilePtr file, const char* data, size_t len)
+{
+    if(LOG_IO_MMAP == file->engine)
+    {
+        _logMmapWrite(file, data, len);
+        _logCount(file, len);
+        return;
+    }
+    if(LOG_IO_STDIO == file->engine)
+    {
+        _logCount(file, fwrite(data, 1, len, file->fp));
+        return;
+    }
+
+    if(LOG_IO_URING == file->engine && len > file->wcap - file->wlen && len < file->wcap)
+        _logDirectSubmit(file, NULL, 0);     // 先把当前缓冲区交给 io_uring, 记录放入新缓冲区, 不在写线程中 writev
+    if(len <= file->wcap - file->wlen)
+    {
+        memcpy(file->wbuf[file->wcur] + file->wlen, data, len);
+        file->wlen += len;
+    }
+    else    /* 放不下, 和当前缓冲区一起 writev */
+        _logDirectSubmit(file, data, len);
+    _logCount(file, len);
+}
+
+/**
+ * @brief _logFileFlush - 按写入引擎写出缓冲的内容
+ * @note  须持有 file->locker; LOG_IO_DIRECT/LOG_IO_URING 返回时缓冲区已全部写入文件, 并且没有正在进行的 writev 和 io_uring 写入
+ *        LOG_IO_MMAP 的内容已经在页缓存中, 不需要写出
+ */
+static void _logFileFlush(LogFilePtr file)
+{
+    if(LOG_IO_DIRECT == file->engine || LOG_IO_URING == file->engine)
+    {
+        if(file->wlen)   _logDirectSubmit(file, NULL, 0);
+        _logDirectWait(file);
+    }
+    else if(LOG_IO_STDIO == file->engine)
+        fflush(file->fp);
+    file->pending = 0;
+    file->flushes++;
+}
+
+/**
+ * @brief _logDirectVWrite - 渲染一条记录到当前缓冲区
+ * @note  须持有 file->locker; 当前缓冲区放不下时先交换缓冲区再重新渲染, 比整个缓冲区还大的记录渲染到堆内存中
+ */
+static void _logDirectVWrite(LogFilePtr file, bool timed, constr prefix, constr text, va_list ap)
+{
+    size_t room, len, tlen;
+    char* heap;
+
+    for(;;)
+    {
+        room = file->wcap - file->wlen;
+        len  = _logRender(file->wbuf[file->wcur] + file->wlen, room, &tlen, timed, prefix, text, ap);
+        if(len < room)
+        {
+            file->wlen += len;
+            break;
+        }
+        if(len >= file->wcap)
+        {
+            if(!(heap = malloc(len + 1)))
+                return;
+            _logRender(heap, len + 1, &tlen, timed, prefix, text, ap);
+            _logDirectSubmit(file, heap, len);
+            free(heap);
+            break;
+        }
+        _logDirectSubmit(file, NULL, 0);     // 期间锁会被释放, 其他线程可能已写入新缓冲区, 所以重新计算剩余空间
+    }
+    _logCount(file, len);
+}
+
+/**
+ * @brief _logDirectSubmit - 交换缓冲区, 在锁外把写满的缓冲区和 extra 一起 writev 到文件
+ * @param extra 紧跟在缓冲区内容之后写入的数据, 可以为 NULL
+ * @note  须持有 file->locker, 返回时仍持有, 但期间会释放
+ *        LOG_IO_URING 没有 extra 时把缓冲区放入 io_uring 的提交队列后立即返回, 不等待写入完成
+ */
+static void _logDirectSubmit(LogFilePtr file, const char* extra, size_t elen)
+{
+    struct iovec iov[2];
+    int fd;
+
+    /* 上一个缓冲区还在写入, 等待它完成, 保证写入顺序 */
+    _logDirectWait(file);
+
+    if(LOG_IO_URING == file->engine && !extra && LOG_OK == _logUringQueue(file, file->wbuf[file->wcur], file->wlen))
+    {
+        file->wcur ^= 1;
+        file->wlen  = 0;
+        return;
+    }
+
+    fd = fileno(file->fp);
+    iov[0].iov_base = file->wbuf[file->wcur];
+    iov[0].iov_len  = file->wlen;
+    iov[1].iov_base = (void*)extra;
+    iov[1].iov_len  = extra ? elen : 0;
+    file->wcur ^= 1;
+    file->wlen  = 0;
+    file->wbusy = true;
+    pthread_mutex_unlock(&file->locker);
+
+    if(_logWritev(fd, iov, 2) < 0)
+        logsysAdd(file->name, "--Direct writing... err: %s \n", strerror(errno));
+
+    pthread_mutex_lock(&file->locker);
+    file->wbusy = false;
+    pthread_cond_broadcast(&file->wcond);
+}
+
+/**
+ * @brief _logDirectWait - 等待正在进行的 writev 和 io_uring 写入完成
+ * @note  须持有 file->locker; 在 wcond 上等待时锁会被释放, 其他线程可能又提交了缓冲区, 所以循环检查
+ */
+static void _logDirectWait(LogFilePtr file)
+{
+    for(;;)
+    {
+        _logUringWait(file);
+        if(!file->wbusy) break;
+        pthread_cond_wait(&file->wcond, &file->locker);
+    }
+}
+
+/**
+ * @brief _logWritev - writev 直到 iov 中的数据全部写入
+ * @return 写入的字节数, 出错时返回 -1
+ */
+static ssize_t _logWritev(int fd, struct iovec* iov, int cnt)
+{
+    ssize_t n, total = 0;
+
+    while(cnt)
+    {
+        if(!iov->iov_len)   {iov++; cnt--; continue;}
+        if((n = writev(fd, iov, cnt)) < 0)
+        {
+            if(EINTR == errno)  continue;
+            return -1;
+        }
+        total += n;
+        while(cnt && (size_t)n >= iov->iov_len)   {n -= iov->iov_len; iov++; cnt--;}
+        if(cnt)
+        {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return total;
+}
+
+/**
+ * @brief _logFileDetach - 写出缓冲的内容, 并结束引擎对当前文件的使用
+ * @note  须持有 file->locker; 结束当前二进制段; LOG_IO_MMAP 解除映射并把文件截断到实际长度
+ */
+static void _logFileDetach(LogFilePtr file)
+{
+    _logBinEnd(file);
+    _logFileFlush(file);
+    if(LOG_IO_MMAP == file->engine && file->mbase)
+    {
+        munmap(file->mbase, file->mlen);
+        file->mbase = NULL;
+        if(ftruncate(fileno(file->fp), file->moff + file->mpos))
+            logsysAdd(file->name, "--Unmapping file... err: can not truncate file, %s \n", strerror(errno));
+    }
+}
+
+/**
+ * @brief _logFileAttach - 引擎开始使用当前文件
+ * @return 成功返回 LOG_OK; LOG_IO_MMAP 映射失败 或 LOG_IO_URING 无法创建 io_uring 时退回 LOG_IO_STDIO, 返回 LOG_ERR
+ * @note  须持有 file->locker
+ */
+static int _logFileAttach(LogFilePtr file)
+{
+    size_t page = sysconf(_SC_PAGESIZE), size, trim;
+
+    if(LOG_IO_URING == file->engine)
+    {
+        if(LOG_OK == _logUringInit())
+            return LOG_OK;
+        file->engine = LOG_IO_STDIO;
+        logsysAdd(file->name, "--Setting up io_uring... err: %s, fall back to stdio \n", strerror(errno));
+        return LOG_ERR;
+    }
+    if(LOG_IO_MMAP != file->engine)  return LOG_OK;
+
+    /* 上次崩溃残留的预分配部分不计入文件大小, 从实际长度所在的页开始映射 */
+    if((trim = _logMmapTrim(file)))
+    {
+        size = __atomic_load_n(&file->cursize, __ATOMIC_RELAXED);
+        __atomic_store_n(&file->cursize, size > trim ? size - trim : 0, __ATOMIC_RELAXED);
+    }
+    size = _logFileStatSize(file->fp);
+    file->moff = size - size % page;
+    file->mpos = size - file->moff;
+    if(LOG_OK == _logMmapMap(file))
+        return LOG_OK;
+
+    file->engine = LOG_IO_STDIO;
+    logsysAdd(file->name, "--Mapping file... err: %s, fall back to stdio \n", strerror(errno));
+    return LOG_ERR;
+}
+
+/**
+ * @brief _logMmapTrim - 截掉文件末尾最后一个窗口内连续的 '\0', 即进程崩溃时没有截断的预分配部分
+ * @return 截掉的字节数
+ * @note  须持有 file->locker; 文本记录中不会出现 '\0', 窗口内是纯文本时截断到实际长度;
+ *        窗口内有 '\0' 时说明有二进制段, 最后一条二进制记录(如 'E')可能以 0 字节结尾, 所以多保留 LOG_MMAP_SLACK 字节, 由 logDecode 跳过
+ */
+static size_t _logMmapTrim(LogFilePtr file)
+{
+    char buf[4096];
+    int fd = fileno(file->fp);
+    size_t size = _logFileStatSize(file->fp), low, end, pos, n, i;
+    bool binary = false;
+
+    low = size > file->mlen ? size - file->mlen : 0;
+    for(end = pos = size; pos > low && !binary; pos -= n)
+    {
+        n = pos - low < sizeof(buf) ? pos - low : sizeof(buf);
+        if(pread(fd, buf, n, pos - n) != (ssize_t)n)    return 0;
+        for(i = n; i; i--)
+        {
+            if(buf[i - 1])                      continue;
+            if(end == pos - n + i)              end--;      // 仍在末尾连续的 '\0' 中
+            else                                {binary = true; break;}
+        }
+    }
+    if(binary)  end = end + LOG_MMAP_SLACK < size ? end + LOG_MMAP_SLACK : size;
+    if(end == size || ftruncate(fd, end))   return 0;
+    return size - end;
+}
+
+/**
+ * @brief _logMmapVWrite - 渲染一条记录到映射窗口
+ * @note  须持有 file->locker; 放不下时(跨越窗口边界)渲染到堆内存中再分段拷贝, 每个窗口最多发生一次
+ */
+static void _logMmapVWrite(LogFilePtr file, bool timed, constr prefix, constr text, va_list ap)
+{
+    size_t room = file->mlen - file->mpos, len, tlen;
+    char* heap;
+
+    len = _logRender(file->mbase + file->mpos, room, &tlen, timed, prefix, text, ap);
+    if(len < room)
+        file->mpos += len;
+    else
+    {
+        if(!(heap = malloc(len + 1)))
+            return;
+        _logRender(heap, len + 1, &tlen, timed, prefix, text, ap);
+        _logMmapWrite(file, heap, len);
+        free(heap);
+    }
+    _logCount(file, len);
+}
+
+/**
+ * @brief _logMmapWrite - 拷贝数据到映射窗口, 窗口写满时解除映射, 预分配并映射下一块
+ * @note  须持有 file->locker; 无法映射下一块时退回 LOG_IO_STDIO, 剩余内容通过 stdio 写入
+ */
+static void _logMmapWrite(LogFilePtr file, const char* data, size_t len)
+{
+    size_t n;
+
+    while(len)
+    {
+        if(file->mpos == file->mlen)
+        {
+            munmap(file->mbase, file->mlen);
+            file->mbase = NULL;
+            file->moff += file->mlen;
+            file->mpos  = 0;
+            if(LOG_ERR == _logMmapMap(file))
+            {
+                file->engine = LOG_IO_STDIO;
+                logsysAdd(file->name, "--Mapping file... err: %s, fall back to stdio \n", strerror(errno));
+                fwrite(data, 1, len, file->fp);
+                return;
+            }
+        }
+        n = len < file->mlen - file->mpos ? len : file->mlen - file->mpos;
+        memcpy(file->mbase + file->mpos, data, n);
+        file->mpos += n;
+        data      += n;
+        len       -= n;
+    }
+}
+
+/**
+ * @brief _logMmapMap - 预分配 [moff, moff + mlen) 并映射为窗口
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR, 文件长度恢复为 moff + mpos
+ * @note  文件系统不支持 fallocate 时, 使用 ftruncate 扩展文件长度(稀疏文件)
+ */
+static int _logMmapMap(LogFilePtr file)
+{
+    int fd = fileno(file->fp);
+    void* base;
+
+    if(fallocate(fd, 0, file->moff, file->mlen) && ftruncate(fd, file->moff + file->mlen))
+        return LOG_ERR;
+    if(MAP_FAILED == (base = mmap(NULL, file->mlen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, file->moff)))
+    {
+        fd = ftruncate(fd, file->moff + file->mpos);    // 恢复文件长度
+        return LOG_ERR;
+    }
+    file->mbase = base;
+    return LOG_OK;
+}
+
+/* ----------------------------- uring implementation ------------------------- */
+/*  LOG_IO_URING:
+ *      缓冲方式和 LOG_IO_DIRECT 相同, 区别在于写满的缓冲区不在锁外 writev, 而是放入所有日志共享的 io_uring 提交队列后立即返回,
+ *      之后由内核写入, 完成前 ubusy 保持为 true, 同一日志的下一个缓冲区需要等待它完成, 保证写入顺序
+ *      异步模式下写线程在批次中只放入提交队列(_uring_defer), 批次结束时一次 io_uring_enter 提交所有日志的缓冲区, 并处理已完成的项;
+ *      其他线程(同步模式, logFlush, 轮转等)放入后立即提交, 需要等待时自己处理完成队列
+ *  完成项的 user_data 为日志文件结构指针, 日志文件在 _logFileDetach 中等待写入完成后才会被释放, 所以处理完成项时指针总是有效的
+ *  短写或 EINTR/EAGAIN 时把剩余部分重新放入提交队列; 其他错误记录到系统日志中, 丢弃该缓冲区
+ *  文件以 O_APPEND 打开, 写入总是追加到文件末尾, 不使用 offset
+ *  锁顺序: file->locker -> _uring_locker, 处理完成项时不获取任何 file->locker
+ *  不使用 liburing, 直接通过 io_uring_setup/io_uring_enter 系统调用和映射的队列操作, 编译环境没有 <linux/io_uring.h> 时总是退回 stdio
+ */
+#ifdef LOG_HAVE_URING
+
+/**
+ * @brief _logUringInit - 创建共享的 io_uring 实例, 并映射提交队列, 完成队列和 sqe 数组
+ * @return 成功或已创建返回 LOG_OK; 内核不支持或被禁用时返回 LOG_ERR, errno 为失败原因
+ */
+static int _logUringInit()
+{
+    struct io_uring_params p;
+    int fd, ret = LOG_OK;
+
+    pthread_mutex_lock(&_uring_locker);
+    if(_uring.fd < 0)
+    {
+        memset(&p, 0, sizeof(p));
+        if((fd = syscall(__NR_io_uring_setup, DF_URING_ENTRIES, &p)) < 0)
+            ret = LOG_ERR;
+        else
+        {
+            _uring.sqsize  = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            _uring.cqsize  = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+            _uring.sqesize = p.sq_entries * sizeof(struct io_uring_sqe);
+            _uring.sqring  = mmap(NULL, _uring.sqsize , PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            _uring.cqring  = mmap(NULL, _uring.cqsize , PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            _uring.sqes    = mmap(NULL, _uring.sqesize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if(MAP_FAILED == _uring.sqring || MAP_FAILED == _uring.cqring || MAP_FAILED == (void*)_uring.sqes)
+            {
+                if(MAP_FAILED != _uring.sqring)         munmap(_uring.sqring, _uring.sqsize);
+                if(MAP_FAILED != _uring.cqring)         munmap(_uring.cqring, _uring.cqsize);
+                if(MAP_FAILED != (void*)_uring.sqes)    munmap(_uring.sqes, _uring.sqesize);
+                close(fd);
+                ret = LOG_ERR;
+            }
+            else
+            {
+                _uring.entries = p.sq_entries;
+                _uring.sqhead  = (unsigned*)((char*)_uring.sqring + p.sq_off.head);
+                _uring.sqtail  = (unsigned*)((char*)_uring.sqring + p.sq_off.tail);
+                _uring.sqmask  = (unsigned*)((char*)_uring.sqring + p.sq_off.ring_mask);
+                _uring.sqarray = (unsigned*)((char*)_uring.sqring + p.sq_off.array);
+                _uring.cqhead  = (unsigned*)((char*)_uring.cqring + p.cq_off.head);
+                _uring.cqtail  = (unsigned*)((char*)_uring.cqring + p.cq_off.tail);
+                _uring.cqmask  = (unsigned*)((char*)_uring.cqring + p.cq_off.ring_mask);
+                _uring.cqes    = (struct io_uring_cqe*)((char*)_uring.cqring + p.cq_off.cqes);
+                _uring.queued  = 0;
+                _uring.fd      = fd;
+            }
+        }
+    }
+    pthread_mutex_unlock(&_uring_locker);
+    return ret;
+}
+
+/**
+ * @brief _logUringRelease - 释放共享的 io_uring 实例
+ * @note  调用时所有 LOG_IO_URING 日志都应已销毁, 没有正在进行的写入
+ */
+static void _logUringRelease()
+{
+    pthread_mutex_lock(&_uring_locker);
+    if(_uring.fd >= 0)
+    {
+        munmap(_uring.sqring, _uring.sqsize);
+        munmap(_uring.cqring, _uring.cqsize);
+        munmap(_uring.sqes, _uring.sqesize);
+        close(_uring.fd);
+        memset(&_uring, 0, sizeof(_uring));
+        _uring.fd = -1;
+    }
+    pthread_mutex_unlock(&_uring_locker);
+}
+
+/**
+ * @brief _logUringQueue - 把缓冲区放入提交队列, 非写线程会立即提交
+ * @return 成功返回 LOG_OK, 之后缓冲区由内核写入, 完成前不能修改; 失败返回 LOG_ERR, 由调用者直接 writev
+ * @note  须持有 file->locker, 并且日志没有正在进行的写入
+ */
+static int _logUringQueue(LogFilePtr file, char* buf, size_t len)
+{
+    int ret;
+
+    pthread_mutex_lock(&_uring_locker);
+    _logUringReap();
+    file->uiov.iov_base = buf;
+    file->uiov.iov_len  = len;
+    __atomic_store_n(&file->ubusy, true, __ATOMIC_RELAXED);
+    if(LOG_OK == (ret = _logUringPrep(file)))
+    {
+        if(!_uring_defer)   _logUringEnter(0);
+    }
+    else
+        __atomic_store_n(&file->ubusy, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&_uring_locker);
+    return ret;
+}
+
+/**
+ * @brief _logUringSubmit - 处理已完成的项, 并一次 io_uring_enter 提交队列中的所有项, 由写线程在每批次结束时调用
+ */
+static void _logUringSubmit()
+{
+    pthread_mutex_lock(&_uring_locker);
+    if(_uring.fd >= 0)
+    {
+        _logUringReap();
+        if(_uring.queued)   _logUringEnter(0);
+    }
+    pthread_mutex_unlock(&_uring_locker);
+}
+
+/**
+ * @brief _logUringWait - 等待日志正在由 io_uring 写入的缓冲区完成, 期间处理所有已完成的项
+ * @note  须持有 file->locker; 等待期间持有 _uring_locker, 其他线程的提交会被阻塞, 缓冲写入通常很快完成
+ */
+static void _logUringWait(LogFilePtr file)
+{
+    if(!__atomic_load_n(&file->ubusy, __ATOMIC_ACQUIRE))
+        return;
+
+    pthread_mutex_lock(&_uring_locker);
+    _logUringReap();
+    while(__atomic_load_n(&file->ubusy, __ATOMIC_ACQUIRE))
+    {
+        if(LOG_ERR == _logUringEnter(1))
+            sched_yield();      // EAGAIN/EBUSY 等, 处理完成项后重试
+        _logUringReap();
+    }
+    pthread_mutex_unlock(&_uring_locker);
+}
+
+/**
+ * @brief _logUringPrep - 把 log->uiov 作为一个 IORING_OP_WRITEV 放入提交队列
+ * @return 成功返回 LOG_OK; 提交队列已满并且无法提交时返回 LOG_ERR
+ * @note  须持有 _uring_locker
+ */
+static int _logUringPrep(LogFilePtr file)
+{
+    struct io_uring_sqe* sqe;
+    unsigned tail = *_uring.sqtail, idx;
+
+    if(tail - __atomic_load_n(_uring.sqhead, __ATOMIC_ACQUIRE) >= _uring.entries)
+    {   /* 提交队列已满, 先提交 */
+        _logUringEnter(0);
+        if(tail - __atomic_load_n(_uring.sqhead, __ATOMIC_ACQUIRE) >= _uring.entries)
+            return LOG_ERR;
+    }
+
+    idx = tail & *_uring.sqmask;
+    sqe = &_uring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_WRITEV;
+    sqe->fd        = fileno(file->fp);
+    sqe->addr      = (uintptr_t)&file->uiov;
+    sqe->len       = 1;
+    sqe->user_data = (uintptr_t)file;
+    _uring.sqarray[idx] = idx;
+    __atomic_store_n(_uring.sqtail, tail + 1, __ATOMIC_RELEASE);
+    _uring.queued++;
+    return LOG_OK;
+}
+
+/**
+ * @brief _logUringEnter - 提交队列中的项
+ * @param wait 为 1 时等待至少一项完成
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR
+ * @note  须持有 _uring_locker
+ */
+static int _logUringEnter(unsigned wait)
+{
+    int n;
+
+    do n = syscall(__NR_io_uring_enter, _uring.fd, _uring.queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    while(n < 0 && EINTR == errno);
+    if(n < 0)
+        return LOG_ERR;
+    _uring.queued -= (unsigned)n < _uring.queued ? (unsigned)n : _uring.queued;
+    return LOG_OK;
+}
+
+/**
+ * @brief _logUringReap - 处理完成队列中的所有项
+ * @note  须持有 _uring_locker; 短写 或 EINTR/EAGAIN 时重新放入提交队列, 由下一次 io_uring_enter 提交
+ */
+static void _logUringReap()
+{
+    struct io_uring_cqe* cqe;
+    unsigned head = *_uring.cqhead;
+    LogFilePtr file;
+
+    while(head != __atomic_load_n(_uring.cqtail, __ATOMIC_ACQUIRE))
+    {
+        cqe = &_uring.cqes[head & *_uring.cqmask];
+        file = (LogFilePtr)(uintptr_t)cqe->user_data;
+        if(cqe->res > 0 && (size_t)cqe->res < file->uiov.iov_len)
+        {   /* 短写, 剩余部分重新提交 */
+            file->uiov.iov_base = (char*)file->uiov.iov_base + cqe->res;
+            file->uiov.iov_len -= cqe->res;
+        }
+        else if(-EINTR != cqe->res && -EAGAIN != cqe->res)
+        {
+            if(cqe->res < 0)
+                logsysAdd(file->name, "--Uring writing... err: %s \n", strerror(-cqe->res));
+            file->uiov.iov_len = 0;
+        }
+        __atomic_store_n(_uring.cqhead, ++head, __ATOMIC_RELEASE);
+
+        if(file->uiov.iov_len && LOG_ERR == _logUringPrep(file))
+        {
+            logsysAdd(file->name, "--Uring writing... err: submission queue is full \n");
+            file->uiov.iov_len = 0;
+        }
+        if(!file->uiov.iov_len)
+            __atomic_store_n(&file->ubusy, false, __ATOMIC_RELEASE);
+    }
+}
+
+#else
+
+static int  _logUringInit()     {errno = ENOSYS; return LOG_ERR;}
+static void _logUringRelease()  {}
+static int  _logUringQueue(LogFilePtr file, char* buf, size_t len)  {return LOG_ERR;}
+static void _logUringSubmit()   {}
+static void _logUringWait(LogFilePtr file)   {}
+
+#endif
+
+/* ----------------------------- binary implementation ------------------------- */
+/*  二进制记录:
+ *      开启后 logAdd* 不再调用 vfprintf, 只把格式化字串 id, 时间和参数的原始字节编码为一条 'R' 记录, 字符串参数会被拷贝
+ *      字面量格式化字串在第一次使用时解析一次, 按指针记录在全局的无锁 hash 表中, 得到 id 和每个转换说明的参数类型;
+ *      不在只读段中的格式化字串(如栈上或堆上的缓冲区) 不记录, 改为渲染好的 'T' 记录, 所以结果总是正确的, 也不会占满表
+ *      每个文件中的二进制段以 LOG_BIN_MAGIC 开始, 第一次使用某个 id 前写入它的 'F' 定义, 所以每个文件都可以独立解码;
+ *      轮转/清空/销毁/切换引擎或关闭二进制记录时写入 'E' 结束当前段
+ *  解码时把格式化字串按转换说明切分为多段, 每段连同对应的参数交给 snprintf, 时间前缀由 _timeRender 渲染, 结果和文本记录完全相同
+ *  异步模式下生产者直接把二进制记录编码到队列中, 需要输出到控制台时由写线程格式化
+ *  记录使用本机字节序和类型大小, 需要在相同架构的机器上解码
+ */
+
+/* 拷贝 n 字节到 buf 的 len 处, 放不下时只累加长度 */
+static inline size_t _logBinPut(char* buf, size_t cap, size_t len, const void* data, size_t n)
+{
+    if(len + n <= cap)  memcpy(buf + len, data, n);
+    return len + n;
+}
+
+/* 从 *p 处读取 n 字节到 dst 中, 超出 end 时返回 false */
+static inline bool _logBinGet(const char** p, const char* end, void* dst, size_t n)
+{
+    if((size_t)(end - *p) < n)  return false;
+    memcpy(dst, *p, n);
+    *p += n;
+    return true;
+}
+
+/**
+ * @brief _logFmtFind - 查找格式化字串, 不存在时解析并添加
+ * @return 可以使用二进制记录时返回 _logFormat; 含有不支持的转换说明, 不是字面量, 表已满 或 同一地址的内容已改变时返回 NULL
+ * @note  只记录只读段中的字面量, 栈上或堆上的格式化字串每次地址都可能不同, 记录它们只会占满表
+ */
+static _logFormat* _logFmtFind(constr key)
+{
+    size_t mask = DF_LOG_FORMATS * 2 - 1, i = (size_t)(((uint64_t)(uintptr_t)key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    _logFormat* f;
+
+    /* 无锁查找, 槽位一旦写入就不再改变 */
+    while((f = __atomic_load_n(&_fmt_slots[i], __ATOMIC_ACQUIRE)) && f->key != key)
+        i = (i + 1) & mask;
+    if(!f)
+    {   /* 没有找到, 加锁后从空槽位继续查找, 仍没有则添加 */
+        if(!_logFmtLiteral(key))    return NULL;
+        pthread_mutex_lock(&_fmt_locker);
+        while((f = _fmt_slots[i]) && f->key != key)
+            i = (i + 1) & mask;
+        if(!f && _fmt_count >= DF_LOG_FORMATS && !_fmt_full)
+            __atomic_store_n(&_fmt_full, 1, __ATOMIC_RELAXED);     // 可能持有文件锁, 不能在这里写系统日志
+        else if(!f && _fmt_count < DF_LOG_FORMATS && (f = _logFmtCreate(key)))
+        {
+            f->key = key;
+            f->id  = ++_fmt_count;
+            __atomic_store_n(&_fmt_list[f->id], f, __ATOMIC_RELEASE);
+            __atomic_store_n(&_fmt_slots[i], f, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&_fmt_locker);
+    }
+    return f && f->nspecs >= 0 && !strcmp(f->fmt, key) ? f : NULL;
+}
+
+/**
+ * @brief _logFmtLiteral - 判断格式化字串是否位于已加载模块的只读段中
+ * @note  只读段在第一次调用时由 dl_iterate_phdr 收集一次, 之后无锁读取; 之后 dlopen 的模块中的格式化字串使用 'T' 记录
+ */
+static bool _logFmtLiteral(constr key)
+{
+    uintptr_t p = (uintptr_t)key;
+    int i, n;
+
+    if((n = __atomic_load_n(&_fmt_nranges, __ATOMIC_ACQUIRE)) < 0)
+    {
+        pthread_mutex_lock(&_fmt_locker);
+        if(_fmt_nranges < 0)
+        {
+            n = 0;
+            dl_iterate_phdr(_logFmtRange, &n);
+            __atomic_store_n(&_fmt_nranges, n, __ATOMIC_RELEASE);
+        }
+        n = _fmt_nranges;
+        pthread_mutex_unlock(&_fmt_locker);
+    }
+    for(i = 0; i < n; i++)
+        if(p >= _fmt_ranges[i][0] && p < _fmt_ranges[i][1])
+            return true;
+    return false;
+}
+
+/**
+ * @brief _logFmtRange - dl_iterate_phdr 的回调, 把不可写的 PT_LOAD 段加入 _fmt_ranges
+ * @param arg   已收集的段数
+ */
+static int _logFmtRange(struct dl_phdr_info* info, size_t size, void* arg)
+{
+    int* n = arg, i;
+
+    (void)size;    for(i = 0; i < info->dlpi_phnum && *n < DF_LOG_FMT_RANGES; i++)
+        if(PT_LOAD == info->dlpi_phdr[i].p_type && !(info->dlpi_phdr[i].p_flags & PF_W))
+        {
+            _fmt_ranges[*n][0] = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+            _fmt_ranges[*n][1] = _fmt_ranges[*n][0] + info->dlpi_phdr[i].p_memsz;
+            (*n)++;
+        }
+    return 0;
+}
+
+/**
+ * @brief _logFmtReport - 格式化字串表已满时报告一次
+ */
+static void _logFmtReport()
+{
+    int full = 1;
+
+    if(__atomic_compare_exchange_n(&_fmt_full, &full, 2, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        logsysAdd(NULL, "--Binary format table is full, %d formats recorded, new formats are written as text\n", DF_LOG_FORMATS);
+}
+
+/**
+ * @brief _logFmtCreate - 拷贝并解析格式化字串
+ * @return 新的 _logFormat, 内存不足时返回 NULL; 含有不支持的转换说明时 nspecs 为 -1
+ */
+static _logFormat* _logFmtCreate(constr fmt)
+{
+    _logFmtSpec specs[MAX_FORMAT_SPECS];
+    _logFormat* f;
+    int n = _logFmtParse(fmt, specs, MAX_FORMAT_SPECS);
+
+    if(!(f = malloc(sizeof(*f) + (n > 0 ? n : 0) * sizeof(*specs))))
+        return NULL;
+    if(!(f->fmt = strdup(fmt)))
+    {
+        free(f);
+        return NULL;
+    }
+    f->key    = NULL;
+    f->id     = 0;
+    f->nspecs = n;
+    if(n > 0)   memcpy(f->specs, specs, n * sizeof(*specs));
+    return f;
+}
+
+/**
+ * @brief _logFmtParse - 把格式化字串切分为段, 每段以一个转换说明结束, 最后一段可以只有普通文本
+ * @return 段数; 含有不支持的转换说明(%n %m 位置参数 宽字符等), 段数超过 max 或 字串太长时返回 -1
+ */
+static int _logFmtParse(constr fmt, _logFmtSpec* specs, int max)
+{
+    constr p = fmt, q;
+    int n = 0, star, prec, lng;
+    unsigned char kind;
+
+    if(strlen(fmt) > MAX_FORMAT_LEN)    return -1;
+    for(;;)
+    {
+        while(*p && '%' != *p)  p++;
+        if(!*p) break;
+
+        /* 标志, 宽度, 精度 */
+        q    = p;
+        star = 0;
+        prec = -1;
+        for(p++; *p && strchr("-+ #0'I", *p); p++);
+        if('*' == *p)   {star++; p++;}
+        else            while(*p >= '0' && *p <= '9')   p++;
+        if('.' == *p)
+        {
+            if('*' == *++p) {star++; p++; prec = -2;}
+            else for(prec = 0; *p >= '0' && *p <= '9'; p++)   prec = prec * 10 + *p - '0';
+        }
+        if('$' == *p || (*p >= '0' && *p <= '9'))   return -1;   // 位置参数
+
+        /* 长度修饰 */
+        lng = 0;
+        switch(*p)
+        {
+            case 'h': p++; if('h' == *p) p++; break;
+            case 'l': p++; lng = 'l'; if('l' == *p) {p++; lng = 'q';} break;
+            case 'q': case 'L': lng = 'q'; p++; break;
+            case 'j': case 'z': case 'Z': case 't': lng = *p++; break;
+        }
+
+        /* 转换字符 */
+        switch(*p)
+        {
+            case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+                kind = 'l' == lng ? LOG_ARG_LONG   : 'q' == lng ? LOG_ARG_LLONG  : 'j' == lng ? LOG_ARG_INTMAX :
+                       't' == lng ? LOG_ARG_PTRDIFF: lng        ? LOG_ARG_SIZE   : LOG_ARG_INT;
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                kind = 'q' == lng ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+                break;
+            case 'c':   kind = LOG_ARG_INT; if(lng) return -1; break;
+            case 's':   kind = LOG_ARG_STR; if(lng) return -1; break;
+            case 'p':   kind = LOG_ARG_PTR; break;
+            case '%':   kind = LOG_ARG_NONE; if(p != q + 1) return -1; break;     // 只支持 %%
+            default:    return -1;
+        }
+        if(n == max)    return -1;
+        p++;
+        specs[n].end  = p - fmt;
+        specs[n].star = star;
+        specs[n].kind = kind;
+        specs[n].prec = prec;
+        n++;
+    }
+
+    /* 结尾的普通文本 */
+    if(p != fmt + (n ? specs[n - 1].end : 0))
+    {
+        if(n == max)    return -1;
+        specs[n].end  = p - fmt;
+        specs[n].star = 0;
+        specs[n].kind = LOG_ARG_NONE;
+        specs[n].prec = -1;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief _logFmtRelease - 释放所有格式化字串
+ * @note  只在 logsysRelease 中调用, 此时不应再有线程写入日志
+ */
+static void _logFmtRelease()
+{
+    unsigned i;
+
+    pthread_mutex_lock(&_fmt_locker);
+    for(i = 1; i <= _fmt_count; i++)
+    {
+        free(_fmt_list[i]->fmt);
+        free(_fmt_list[i]);
+    }
+    memset(_fmt_slots, 0, sizeof(_fmt_slots));
+    memset(_fmt_list, 0, sizeof(_fmt_list));
+    _fmt_count   = 0;
+    _fmt_full    = 0;
+    _fmt_nranges = -1;
+    pthread_mutex_unlock(&_fmt_locker);
+}
+
+/**
+ * @brief _logBinEncode - 编码一条二进制记录到 buf 中
+ * @return 完整编码所需的长度, 若大于等于 cap, 说明 buf 中的记录不完整
+ * @note  text 不能使用二进制记录时, 渲染为 'T' 记录
+ */
+static size_t _logBinEncode(char* buf, size_t cap, bool timed, constr prefix, constr text, va_list ap)
+{
+    _logFormat* f = NULL;
+    struct timespec ts;
+    size_t len = LOG_BIN_HEAD, tlen, n;
+    uint32_t u32, id = 0;
+    unsigned char flags = 0, prec;
+    int64_t sec;
+    int32_t off, iv = 0;
+    int64_t lv;
+    double dv;
+    long double ldv;
+    uint64_t pv;
+    constr str;
+    va_list cp;
+    int i, s, sp;
+
+    if(text && !(f = _logFmtFind(text)))
+    {   /* 渲染为 'T' 记录 */
+        len = _logRender(buf + (cap > LOG_BIN_HEAD + 4 ? LOG_BIN_HEAD + 4 : 0), cap > LOG_BIN_HEAD + 4 ? cap - LOG_BIN_HEAD - 4 : 0, &tlen, timed, prefix, text, ap);
+        u32 = tlen;
+        _logBinPut(buf, cap, LOG_BIN_HEAD, &u32, 4);
+        u32 = len + 4;
+        len += LOG_BIN_HEAD + 4;
+        if(cap)     buf[0] = LOG_BIN_TEXT;
+        _logBinPut(buf, cap, 1, &u32, 4);
+        return len;
+    }
+
+    if(f)       id = f->id;
+    if(timed)   flags |= LOG_BIN_TIMED;
+    if(prefix)  flags |= LOG_BIN_PREFIX;
+    len = _logBinPut(buf, cap, len, &id, 4);
+    len = _logBinPut(buf, cap, len, &flags, 1);
+    if(timed)
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        sec  = ts.tv_sec;
+        u32  = ts.tv_nsec;
+        off  = _timeGmtoff(ts.tv_sec);
+        prec = _logsys_timeprec;
+        len = _logBinPut(buf, cap, len, &sec, 8);
+        len = _logBinPut(buf, cap, len, &u32, 4);
+        len = _logBinPut(buf, cap, len, &off, 4);
+        len = _logBinPut(buf, cap, len, &prec, 1);
+    }
+    if(prefix)
+    {
+        u32 = strlen(prefix);
+        len = _logBinPut(buf, cap, len, &u32, 4);
+        len = _logBinPut(buf, cap, len, prefix, u32);
+    }
+
+    /* 按转换说明的顺序存放参数 */
+    va_copy(cp, ap);
+    for(i = 0; f && i < f->nspecs; i++)
+    {
+        for(s = 0; s < f->specs[i].star; s++)
+        {
+            iv  = va_arg(cp, int);
+            len = _logBinPut(buf, cap, len, &iv, 4);
+        }
+        switch(f->specs[i].kind)
+        {
+            case LOG_ARG_INT:       iv = va_arg(cp, int);           len = _logBinPut(buf, cap, len, &iv, 4);    break;
+            case LOG_ARG_LONG:      lv = va_arg(cp, long);          len = _logBinPut(buf, cap, len, &lv, 8);    break;
+            case LOG_ARG_LLONG:     lv = va_arg(cp, long long);     len = _logBinPut(buf, cap, len, &lv, 8);    break;
+            case LOG_ARG_INTMAX:    lv = va_arg(cp, intmax_t);      len = _logBinPut(buf, cap, len, &lv, 8);    break;
+            case LOG_ARG_SIZE:      lv = va_arg(cp, size_t);        len = _logBinPut(buf, cap, len, &lv, 8);    break;
+            case LOG_ARG_PTRDIFF:   lv = va_arg(cp, ptrdiff_t);     len = _logBinPut(buf, cap, len, &lv, 8);    break;
+            case LOG_ARG_DOUBLE:    dv = va_arg(cp, double);        len = _logBinPut(buf, cap, len, &dv, 8);    break;
+            case LOG_ARG_PTR:       pv = (uintptr_t)va_arg(cp, void*);  len = _logBinPut(buf, cap, len, &pv, 8);    break;
+            case LOG_ARG_LDOUBLE:
+                memset(&ldv, 0, sizeof(ldv));   // 填充字节也写入文件, 清零
+                ldv = va_arg(cp, long double);
+                len = _logBinPut(buf, cap, len, &ldv, sizeof(ldv));
+                break;
+            case LOG_ARG_STR:
+                /* 有精度时最多读取精度个字节, 字串可以没有 '\0' */
+                sp  = -2 == f->specs[i].prec ? iv : f->specs[i].prec;
+                str = va_arg(cp, constr);
+                n   = !str ? UINT32_MAX : sp >= 0 ? strnlen(str, sp) : strlen(str);
+                u32 = n;
+                len = _logBinPut(buf, cap, len, &u32, 4);
+                if(str) len = _logBinPut(buf, cap, len, str, n);
+                break;
+        }
+    }
+    va_end(cp);
+
+    if(cap)     buf[0] = LOG_BIN_RECORD;
+    u32 = len - LOG_BIN_HEAD;
+    _logBinPut(buf, cap, 1, &u32, 4);
+    return len;
+}
+
+/**
+ * @brief _logBinRender - 把 'R' 或 'T' 记录渲染为文本, 结果和写入文本记录时完全相同
+ * @param tlen  输出参数, 时间前缀的长度
+ * @param f     记录使用的格式化字串, 为 NULL 时只渲染时间和 prefix
+ * @return 完整渲染所需的长度(不含 '\0'), 若大于等于 cap, 说明 buf 中的内容被截断; 记录损坏时只渲染完整的部分
+ */
+static size_t _logBinRender(char* buf, size_t cap, size_t* tlen, const char* rec, size_t len, const _logFormat* f)
+{
+    const char* p = rec + LOG_BIN_HEAD, * end = rec + len;
+    char tb[40], sbuf[256], * seg, * str, * out;
+    size_t n = 0, start, room;
+    uint32_t u32;
+    unsigned char flags, prec;
+    int64_t sec, lv = 0;
+    int32_t off, iv = 0, st[2];
+    double dv = 0;
+    long double ldv = 0;
+    uint64_t pv = 0;
+    int i, s, r, star;
+
+    *tlen = 0;
+    if(LOG_BIN_TEXT == rec[0])
+    {
+        if(!_logBinGet(&p, end, &u32, 4))   return 0;
+        *tlen = u32;
+        n = end - p;
+        memcpy(buf, p, n < cap ? n : cap);
+        if(cap) buf[n < cap ? n : cap - 1] = '\0';
+        return n;
+    }
+
+    if(!_logBinGet(&p, end, &u32, 4) || !_logBinGet(&p, end, &flags, 1))   return 0;
+    if(flags & LOG_BIN_TIMED)
+    {
+        if(!_logBinGet(&p, end, &sec, 8) || !_logBinGet(&p, end, &u32, 4) || !_logBinGet(&p, end, &off, 4) || !_logBinGet(&p, end, &prec, 1))
+            return 0;
+        n = *tlen = _timeRender(tb, sec, u32, off, prec);
+        memcpy(buf, tb, n < cap ? n : cap);
+    }
+    if(flags & LOG_BIN_PREFIX)
+    {
+        if(!_logBinGet(&p, end, &u32, 4) || u32 > (size_t)(end - p))   return n;
+        if(n < cap) memcpy(buf + n, p, u32 < cap - n ? u32 : cap - n);
+        n += u32;
+        p += u32;
+    }
+
+    /* 每段连同它的参数交给 snprintf */
+    for(i = 0, start = 0; f && i < f->nspecs; start = f->specs[i++].end)
+    {
+        out  = buf + (n < cap ? n : cap);
+        room = n < cap ? cap - n : 0;
+        seg  = f->specs[i].end - start < sizeof(sbuf) ? sbuf : malloc(f->specs[i].end - start + 1);
+        if(!seg)    break;
+        memcpy(seg, f->fmt + start, f->specs[i].end - start);
+        seg[f->specs[i].end - start] = '\0';
+
+        star = f->specs[i].star;
+        for(s = 0; s < star; s++)
+            if(!_logBinGet(&p, end, &st[s], 4)) break;
+        if(s < star)
+        {
+            if(seg != sbuf) free(seg);
+            break;
+        }
+
+        #define _SNPRINTF(v)    (0 == star ? snprintf(out, room, seg, v) : 1 == star ? snprintf(out, room, seg, st[0], v) : snprintf(out, room, seg, st[0], st[1], v))
+        r = -1;
+        switch(f->specs[i].kind)
+        {
+            case LOG_ARG_NONE:
+                /* 普通文本, 只需把 %% 还原为 % */
+                for(str = seg, r = 0; *str; str++, r++)
+                {
+                    if('%' == *str) str++;
+                    if((size_t)r < room)    out[r] = *str;
+                }
+                if((size_t)r < room)    out[r] = '\0';
+                break;
+            case LOG_ARG_INT:       if(_logBinGet(&p, end, &iv, 4)) r = _SNPRINTF((int)iv);         break;
+            case LOG_ARG_LONG:      if(_logBinGet(&p, end, &lv, 8)) r = _SNPRINTF((long)lv);        break;
+            case LOG_ARG_LLONG:     if(_logBinGet(&p, end, &lv, 8)) r = _SNPRINTF((long long)lv);   break;
+            case LOG_ARG_INTMAX:    if(_logBinGet(&p, end, &lv, 8)) r = _SNPRINTF((intmax_t)lv);    break;
+            case LOG_ARG_SIZE:      if(_logBinGet(&p, end, &lv, 8)) r = _SNPRINTF((size_t)lv);      break;
+            case LOG_ARG_PTRDIFF:   if(_logBinGet(&p, end, &lv, 8)) r = _SNPRINTF((ptrdiff_t)lv);   break;
+            case LOG_ARG_DOUBLE:    if(_logBinGet(&p, end, &dv, 8)) r = _SNPRINTF(dv);              break;
+            case LOG_ARG_LDOUBLE:   if(_logBinGet(&p, end, &ldv, sizeof(ldv)))  r = _SNPRINTF(ldv); break;
+            case LOG_ARG_PTR:       if(_logBinGet(&p, end, &pv, 8)) r = _SNPRINTF((void*)(uintptr_t)pv);    break;
+            case LOG_ARG_STR:
+                if(!_logBinGet(&p, end, &u32, 4))   break;
+                if(UINT32_MAX == u32)   {r = _SNPRINTF((char*)NULL); break;}
+                if(u32 > (size_t)(end - p) || !(str = malloc(u32 + 1)))  break;
+                memcpy(str, p, u32);
+                str[u32] = '\0';
+                p += u32;
+                r = _SNPRINTF(str);
+                free(str);
+                break;
+        }
+        #undef _SNPRINTF
+        if(seg != sbuf) free(seg);
+        if(r < 0)   break;
+        n += r;
+    }
+
+    if(cap) buf[n < cap ? n : cap - 1] = '\0';
+    return n;
+}
+
+/**
+ * @brief _logBinLookup - 返回 'R' 记录使用的格式化字串
+ * @return 没有 text 或 不是 'R' 记录时返回 NULL
+ */
+static const _logFormat* _logBinLookup(const char* rec)
+{
+    uint32_t id;
+
+    if(LOG_BIN_RECORD != rec[0])    return NULL;
+    memcpy(&id, rec + LOG_BIN_HEAD, 4);
+    return id && id <= DF_LOG_FORMATS ? __atomic_load_n(&_fmt_list[id], __ATOMIC_ACQUIRE) : NULL;
+}
+
+/**
+ * @brief _logBinVWrite - 编码一条二进制记录并写入, 记录比栈缓冲区大时使用堆内存
+ * @note  须持有 file->locker
+ */
+static void _logBinVWrite(LogFilePtr file, bool timed, constr prefix, constr text, va_list ap)
+{
+    char buf[DF_ASYNC_MSG_SIZE], * rec = buf;
+    size_t len;
+
+    len = _logBinEncode(buf, sizeof(buf), timed, prefix, text, ap);
+    if(len >= sizeof(buf))
+    {
+        if(!(rec = malloc(len + 1)))    return;
+        _logBinEncode(rec, len + 1, timed, prefix, text, ap);
+    }
+    _logBinWrite(file, rec, len);
+    if(rec != buf)  free(rec);
 }
 
-
 /**
- * @brief logAdd - 添加 时间 和 text 到 日志中, 由 (*log).mute 决定是否静默处理
- * @param name
- * @param text
+ * @brief _logBinWrite - 写入一条二进制记录
+ * @note  须持有 file->locker; 需要时先写入段标记和格式化字串的定义; 日志已关闭二进制记录时(异步队列中的旧记录)渲染为文本写入
  */
-void logAdd(constr name, constr text, ...)
+static void _logBinWrite(LogFilePtr file, const char* rec, size_t len)
 {
-    if(!text || !(*text))   return;
-    LogPtr log;
-    /* 检测未通过, 返回 err */
-    if(LOG_ERR == _check_logsys(name, "logAdd")) return;
-    if(LOG_ERR == _check_name(name, "logAdd")) return;
-    if(!(log = _check_log(name, "logAdd"))) return;
-
-    _logFileShrink(log);
+    char buf[DF_ASYNC_MSG_SIZE], * text = buf, head[LOG_BIN_HEAD + 4];
+    const _logFormat* f;
+    uint32_t id = 0, u32;
+    unsigned char* def;
+    size_t n, tlen;
 
-    va_list argptr;
+    if((f = _logBinLookup(rec)))
+        id = f->id;
 
-    // 添加到文件流中
-    pthread_mutex_lock(&fileLocker);
-    va_start(argptr, text);
-    fprintf(log->fp, "%s", _timeStr(TS_LOG));
-    vfprintf(log->fp, text, argptr);
-    fflush(log->fp);
-    pthread_mutex_unlock(&fileLocker);
-    // 如果需要, 输出到控制台
-    if(!log->mutetype)
+    if(!file->binary)
     {
-        pthread_mutex_lock(&consoleLocker);
-        va_start(argptr, text);
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
-        fprintf(stderr, "[%s] :", log->name);
-        vfprintf(stderr, text, argptr);
-        pthread_mutex_unlock(&consoleLocker);
+        n = _logBinRender(buf, sizeof(buf), &tlen, rec, len, f);
+        if(n >= sizeof(buf) && (text = malloc(n + 1)))
+            _logBinRender(text, n + 1, &tlen, rec, len, f);
+        _logFileWrite(file, text ? text : buf, text ? n : sizeof(buf) - 1);
+        if(text != buf) free(text);
+        return;
     }
 
-    logsysAdd(name, "add a log\n");
-
-    va_end(argptr);
+    if(!file->binseg)
+    {
+        _logFileWrite(file, LOG_BIN_MAGIC, LOG_BIN_MAGIC_LEN);
+        file->binseg = true;
+    }
+    if(f)
+    {
+        /* 本段中第一次使用该 id, 先写入定义 */
+        if(id / 8 >= file->bindefcap)
+        {
+            n = (id / 8 + 1) * 2;
+            if(!(def = realloc(file->bindef, n)))    return;
+            memset(def + file->bindefcap, 0, n - file->bindefcap);
+            file->bindef    = def;
+            file->bindefcap = n;
+        }
+        if(!(file->bindef[id / 8] & (1 << id % 8)))
+        {
+            n = strlen(f->fmt);
+            head[0] = LOG_BIN_FORMAT;
+            u32 = n + 4;
+            memcpy(head + 1, &u32, 4);
+            memcpy(head + LOG_BIN_HEAD, &id, 4);
+            _logFileWrite(file, head, sizeof(head));
+            _logFileWrite(file, f->fmt, n);
+            file->bindef[id / 8] |= 1 << id % 8;
+        }
+    }
+    _logFileWrite(file, rec, len);
 }
-void logAddMute(constr name, constr text, ...)     // 添加 时间 和 text 到 日志中, 强制静默处理
-{
-    if(!text || !(*text))   return;
-    LogPtr log;
-    /* 检测未通过, 返回 err */
-    if(LOG_ERR == _check_logsys(name, "logAddMute")) return;
-    if(LOG_ERR == _check_name(name, "logAddMute")) return;
-    if(!(log = _check_log(name, "logAddMute"))) return;
-
-    _logFileShrink(log);
-
-    va_list argptr;
-
-    // 写入到文件流中
-    pthread_mutex_lock(&fileLocker);
-    va_start(argptr, text);
-    fprintf(log->fp, "%s", _timeStr(TS_LOG));
-    vfprintf(log->fp, text, argptr);
-    fflush(log->fp);
-    pthread_mutex_unlock(&fileLocker);
 
-    logsysAdd(name, "add a log in mute mode \n");
+/**
+ * @brief _logBinEnd - 写入 'E' 结束当前二进制段, 之后再写入二进制记录时重新开始一段并重新写入定义
+ * @note  须持有 file->locker
+ */
+static void _logBinEnd(LogFilePtr file)
+{
+    char end[LOG_BIN_HEAD] = {LOG_BIN_END, 0, 0, 0, 0};
 
-    va_end(argptr);
+    if(!file->binseg)    return;
+    _logFileWrite(file, end, sizeof(end));
+    file->binseg = false;
+    if(file->bindef) memset(file->bindef, 0, file->bindefcap);
 }
+
 /**
- * @brief logAddNMute - 添加 时间 和 text 到 日志中, 强制非静默处理
- * @param name
- * @param text
+ * @brief logDecode - 把二进制记录还原为文本
+ * @param in    日志文件
+ * @param out   输出
+ * @return 成功返回 LOG_OK; 记录头损坏时返回 LOG_ERR, 损坏之前的内容已输出
+ * @note  二进制段以外的文本原样输出; mmap 引擎崩溃后残留的 '\0' 被跳过, 之后在下一个段标记或文本处继续解码
  */
-void logAddNMute(constr name, constr text, ...)
+int logDecode(FILE* in, FILE* out)
 {
-    if(!text || !(*text))   return;
-    LogPtr log;
-    /* 检测未通过, 返回 err */
-    if(LOG_ERR == _check_logsys(name, "logAddNMute")) return;
-    if(LOG_ERR == _check_name(name, "logAddNMute")) return;
-    if(!(log = _check_log(name, "logAddNMute"))) return;
+    _logFormat** fmts = NULL, * f;
+    char head[LOG_BIN_HEAD], * rec = NULL, * text;
+    size_t reccap = 0, textcap = 1024, n, tlen;
+    uint32_t len, id;
+    int c, ret = LOG_OK;
 
-    _logFileShrink(log);
+    if(!(text = malloc(textcap)))   return LOG_ERR;
 
-    va_list argptr;
+    for(;;)
+    {
+        /* 文本: 原样输出, 直到段标记 */
+        while(EOF != (c = getc(in)) && '\0' != c)
+            putc(c, out);
+        while('\0' == c)
+        {   /* 不属于段标记的 '\0' 跳过; 段标记只有第一个字节是 '\0', 不匹配的字节是 '\0' 时从它重新匹配 */
+            for(n = 1; n < LOG_BIN_MAGIC_LEN && (c = getc(in)) == LOG_BIN_MAGIC[n]; n++);
+            if(LOG_BIN_MAGIC_LEN == n)  break;
+            fwrite(LOG_BIN_MAGIC + 1, 1, n - 1, out);
+        }
+        if(EOF == c)    break;
+        if(LOG_BIN_MAGIC_LEN != n)
+        {
+            putc(c, out);
+            continue;
+        }
 
-    pthread_mutex_lock(&fileLocker);
-    // 写入到文件流中
-    va_start(argptr, text);
-    fprintf(log->fp, "%s", _timeStr(TS_LOG));
-    vfprintf(log->fp, text, argptr);
-    fflush(log->fp);
-    pthread_mutex_unlock(&fileLocker);
-    // 输出到控制台
-    pthread_mutex_lock(&consoleLocker);
-    va_start(argptr, text);
-    fprintf(stderr, "%s", _timeStr(TS_LOG));
-    fprintf(stderr, "[%s] :", log->name);
-    vfprintf(stderr, text, argptr);
-    pthread_mutex_unlock(&consoleLocker);
+        /* 二进制段, 遇到 '\0' 时回到文本, 跳过 '\0' 后在下一个段标记或文本处继续 */
+        while(EOF != (c = getc(in)))
+        {
+            if('\0' == c)  {ungetc(c, in); break;}
+            head[0] = c;
+            if(sizeof(head) - 1 != fread(head + 1, 1, sizeof(head) - 1, in) || LOG_BIN_END == c)
+                break;
+            memcpy(&len, head + 1, 4);
+            if(len + sizeof(head) >= reccap)
+            {
+                free(rec);
+                reccap = len + sizeof(head) + 1;
+                if(!(rec = malloc(reccap))) {ret = LOG_ERR; break;}
+            }
+            memcpy(rec, head, sizeof(head));
+            if(len != fread(rec + sizeof(head), 1, len, in))    break;     // 文件末尾不完整的记录
+
+            f = NULL;
+            if(LOG_BIN_FORMAT == head[0] || LOG_BIN_RECORD == head[0])
+            {
+                if(len < 4) {ret = LOG_ERR; break;}
+                memcpy(&id, rec + sizeof(head), 4);
+                if(id > DF_LOG_FORMATS) {ret = LOG_ERR; break;}
+                if(!fmts && !(fmts = calloc(DF_LOG_FORMATS + 1, sizeof(*fmts))))   {ret = LOG_ERR; break;}
+                f = fmts[id];
+            }
+            if(LOG_BIN_FORMAT == head[0])
+            {   /* 新段中会重新定义, 以最新的为准 */
+                rec[sizeof(head) + len] = '\0';
+                if(f)   {free(f->fmt); free(f);}
+                fmts[id] = _logFmtCreate(rec + sizeof(head) + 4);
+                continue;
+            }
+            if(LOG_BIN_RECORD != head[0] && LOG_BIN_TEXT != head[0])    {ret = LOG_ERR; break;}
 
-    logsysAdd(name, "add a log in nmute mode\n");
+            n = _logBinRender(text, textcap, &tlen, rec, len + sizeof(head), f);
+            if(n >= textcap)
+            {
+                free(text);
+                textcap = n + 1;
+                if(!(text = malloc(textcap)))   {ret = LOG_ERR; break;}
+                _logBinRender(text, textcap, &tlen, rec, len + sizeof(head), f);
+            }
+            fwrite(text, 1, n, out);
+        }
+        if(LOG_ERR == ret)
+            break;
+    }
 
-    va_end(argptr);
+    if(fmts)
+    {
+        for(id = 0; id <= DF_LOG_FORMATS; id++)
+            if(fmts[id])    {free(fmts[id]->fmt); free(fmts[id]);}
+        free(fmts);
+    }
+    free(rec);
+    free(text);
+    return ret;
 }
 
+/* ----------------------------- blackbox implementation ------------------------- */
+/*  黑匣子:
+ *      每个日志文件可以有一个 MAP_SHARED 映射的环形缓冲区文件(path + LOG_BOX_SUFFIX), 头部为 LogBox, 之后为 size 字节的数据区
+ *      写入时用 __atomic_fetch_add 在 head 上预留 [head, head + len), 然后 memcpy 到 head % size 处, 回绕时分两段拷贝,
+ *      不需要锁也没有系统调用, 同步模式下在写入文件之前, 异步模式下在入队时写入, 所以崩溃时已写入黑匣子的记录一定在页缓存中
+ *      进程异常终止不影响页缓存, 只有机器掉电会丢失; 崩溃时正在拷贝的记录可能不完整
+ *      提取时 head 不超过 size 则输出 [0, head), 否则从 head % size 处的下一行开始输出到末尾, 再输出 [0, head % size)
+ *  黑匣子总是保存文本, 二进制记录会为它另外渲染一份
+ */
+
 /**
- * @brief logAddDebug - 调式日志 API, 供 logErr/logWarning/logInfo 使用
- * @param name
- * @param text
+ * @brief _logBoxOpen - 打开或创建黑匣子文件并映射
+ * @param size  数据区大小
+ * @return 成功返回映射的 LogBox; 失败返回 NULL, errno 为失败原因
+ * @note  文件已是相同大小的黑匣子时保留其中的记录, 继续在 head 处写入
  */
-void logAddDebug(constr name, constr text, ...)
+static LogBox* _logBoxOpen(constr path, size_t size)
 {
-    va_list argptr;
-    LogPtr log;
-    char* file, * func;
-    int line;
-
-    va_start(argptr, text);
-    file = va_arg(argptr, char*);   // 获取文件名
-    line = va_arg(argptr, int);     // 获取行
-    func = va_arg(argptr, char*);   // 获取函数名
-    /* 检查不成功 返回 */
-    if(!_logsys_service){/* 服务未开启, 输出调式信息到控制台, 返回 err */
-        va_start(argptr, text);
-        logsysShow("[logsys err]:%s(%d)-%s: logsys service is off \n", file, line, func);
-        return;
+    size_t total = sizeof(LogBox) + size;
+    struct stat st;
+    LogBox* box;
+    int fd;
+
+    if((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)   return NULL;
+    /* 大小不同的旧文件可能仍被映射(正在替换的黑匣子), 截断会使写入它的线程收到 SIGBUS, 所以删除后重新创建 */
+    if(!fstat(fd, &st) && st.st_size && (size_t)st.st_size != total)
+    {
+        close(fd);
+        unlink(path);
+        if((fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0)  return NULL;
     }
-    if(!name || !*name) {/* 字串不合法, 添加调式信息到系统日志, 返回 */
-        logsysAdd(name, "[name err]:%s(%d)-%s: name is NULL or empty \n", file, line, func);
-        return ;
+    /* 预分配, 避免写入页缓存时因磁盘已满而收到 SIGBUS; 文件系统不支持时使用 ftruncate */
+    if(fallocate(fd, 0, 0, total) && ftruncate(fd, total))
+    {
+        close(fd);
+        return NULL;
     }
-    log = _logdictFetchValue(_logsys_dic, name);
-    if(!log){/* log 不存在, 添加调式信息到系统日志, 返回 */
-        logsysAdd(name, "[log err]:%s(%d)-%s: log \"%s\" not exist \n", file, line, func, name);
-        return ;
+    box = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(MAP_FAILED == box)   return NULL;
+
+    if(memcmp(box->magic, LOG_BOX_MAGIC, sizeof(box->magic)) || box->size != size)
+    {   /* 新文件: 最后写入标识 */
+        box->size = size;
+        __atomic_store_n(&box->head, 0, __ATOMIC_RELAXED);
+        memcpy(box->magic, LOG_BOX_MAGIC, sizeof(box->magic));
     }
+    return box;
+}
 
-    _logFileShrink(log);    // 如果需要, 清空日志文件
+/**
+ * @brief _logBoxWrite - 写入一段数据到黑匣子
+ * @note  不需要锁, 多个线程同时写入时各自预留不重叠的区间; 超过数据区大小时只保留末尾部分
+ */
+static void _logBoxWrite(LogBox* box, const char* data, size_t len)
+{
+    uint64_t size = box->size, off;
+    size_t n;
 
-    // 写入文件流
-    pthread_mutex_lock(&fileLocker);
-    va_start(argptr, text);
-    fprintf(log->fp, "%s", _timeStr(TS_LOG));
-    vfprintf(log->fp, text, argptr);
-    fflush(log->fp);
-    pthread_mutex_unlock(&fileLocker);
-    // 如果需要, 输出日志到控制台
-    if(!log->mutetype)
+    if(len > size)
     {
-        pthread_mutex_lock(&consoleLocker);
-        va_start(argptr, text);
-        fprintf(stderr, "%s", _timeStr(TS_LOG));
-        fprintf(stderr, "[%s] :", log->name);
-        vfprintf(stderr, text, argptr);
-        pthread_mutex_unlock(&consoleLocker);
+        data += len - size;
+        len   = size;
     }
+    off = __atomic_fetch_add(&box->head, len, __ATOMIC_RELAXED) % size;
+    n   = size - off < len ? size - off : len;
+    memcpy(box->data + off, data, n);
+    memcpy(box->data, data + n, len - n);
+}
 
-    logsysAdd(name, "add a debug log\n");
+static void _logBoxUnmap(void* box)
+{
+    munmap(box, sizeof(LogBox) + ((LogBox*)box)->size);
+}
 
-    va_end(argptr);
+/**
+ * @brief logBoxExtract - 按写入顺序取出黑匣子中的记录
+ * @param in    黑匣子文件
+ * @param out   输出
+ * @return 成功返回 LOG_OK; 不是黑匣子文件或读取失败时返回 LOG_ERR
+ * @note  已回绕时最旧的一条记录可能已被部分覆盖, 从它的下一行开始输出
+ */
+int logBoxExtract(FILE* in, FILE* out)
+{
+    LogBox head;
+    uint64_t start;
+    char* data, * p;
+
+    if(1 != fread(&head, sizeof(head), 1, in) || memcmp(head.magic, LOG_BOX_MAGIC, sizeof(head.magic)) || !head.size || head.size > SIZE_MAX)
+        return LOG_ERR;
+    if(!(data = malloc(head.size)))     return LOG_ERR;
+    if(head.size != fread(data, 1, head.size, in))
+    {
+        free(data);
+        return LOG_ERR;
+    }
+
+    if(head.head <= head.size)
+        fwrite(data, 1, head.head, out);
+    else
+    {
+        start = head.head % head.size;
+        if((p = memchr(data + start, '\n', head.size - start)))
+        {
+            fwrite(p + 1, 1, data + head.size - p - 1, out);
+            fwrite(data, 1, start, out);
+        }
+        else if((p = memchr(data, '\n', start)))
+            fwrite(p + 1, 1, data + start - p - 1, out);
+    }
+    free(data);
+    return LOG_OK;
 }
 
 /* ------------------- private functions for logdict ------------------------ */
@@ -1520,21 +5205,170 @@ static status _GetFileStatus(constr path)
 */
 char* _timeStr(int type)
 {
-    static char timestr[30];    // 因为不大, 所以直接放到 栈 中
-    static time_t t;
+    static __thread char timestr[30];   // 线程局部, 多线程同时调用互不影响
+
+    if(TS_LOG == type)  return _timeLogStr(NULL);
+    return _timeFormat(timestr, sizeof(timestr), type, time(NULL));
+}
+
+/* 线程局部的时间前缀缓存 */
+typedef struct _logTimeCache {
+    time_t sec;         // buf 中 "[YYYY-MM-DD HH:MM:SS" 部分对应的秒
+    time_t offend;      // gmtoff 的有效期, 过期后重新调用 localtime_r 获取
+    long   gmtoff;      // 缓存的 UTC 偏移(秒)
+    int    prec;        // buf 渲染时的精度
+    size_t len;         // 整个前缀的长度
+    char   buf[40];     // "[YYYY-MM-DD HH:MM:SS.uuuuuu] "
+} _logTimeCache;
+
+static __thread _logTimeCache _time_cache;
+
+static inline void _timeDigits(char* p, unsigned long v, int n)
+{
+    while(n--)  {p[n] = '0' + v % 10; v /= 10;}
+}
+
+/**
+ * 返回线程局部缓存的日志时间前缀 "[YYYY-MM-DD HH:MM:SS] " 或带小数部分的 "[YYYY-MM-DD HH:MM:SS.mmm] "
+ * @param  len  若不为 NULL, 输出前缀的长度
+ * @return 指向线程局部缓冲区的字符串, 不可 free
+ * @note   日期和时间部分只在秒变化时重新渲染, 每次调用只改写小数部分
+*/
+char* _timeLogStr(size_t* len)
+{
+    _logTimeCache* tc = &_time_cache;
+    struct timespec ts;
+    int prec = _logsys_timeprec;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if(ts.tv_sec != tc->sec || prec != tc->prec || !tc->len)
+    {
+        tc->len  = _timeRender(tc->buf, ts.tv_sec, ts.tv_nsec, _timeGmtoff(ts.tv_sec), prec);
+        tc->sec  = ts.tv_sec;
+        tc->prec = prec;
+    }
+
+    /* 只改写小数部分 */
+    if(LOG_TS_MSEC == prec)         _timeDigits(tc->buf + 21, ts.tv_nsec / 1000000, 3);
+    else if(LOG_TS_USEC == prec)    _timeDigits(tc->buf + 21, ts.tv_nsec / 1000, 6);
+
+    if(len) *len = tc->len;
+    return tc->buf;
+}
+
+/**
+ * 渲染日志时间前缀 "[YYYY-MM-DD HH:MM:SS.mmm] " 到 buf 中
+ * @param  buf     目标缓冲区, 至少 40 字节
+ * @param  gmtoff  UTC 偏移(秒), 本地时间由它直接计算, 不调用 localtime(), 所以不会争用 tz 锁
+ * @param  prec    小数部分的位数: LOG_TS_SEC / LOG_TS_MSEC / LOG_TS_USEC
+ * @return 前缀的长度
+ * @note   二进制记录的解码也使用这里, 所以还原出的时间前缀和写入文本时完全相同
+*/
+static size_t _timeRender(char* buf, time_t sec, long nsec, long gmtoff, int prec)
+{
+    long days, secs, era, y;
+    unsigned long doe, yoe, doy, mp, d, m;
+    char* p = buf;
+
+    /* 由天数计算公历日期, Howard Hinnant 的 civil_from_days 算法 */
+    secs = sec + gmtoff;
+    days = secs / 86400;
+    secs %= 86400;
+    if(secs < 0)    {secs += 86400; days--;}
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    doe = days - era * 146097;
+    yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    doy = doe - (365*yoe + yoe/4 - yoe/100);
+    mp  = (5*doy + 2) / 153;
+    d   = doy - (153*mp + 2) / 5 + 1;
+    m   = mp < 10 ? mp + 3 : mp - 9;
+    y   = yoe + era * 400 + (m <= 2);
+
+    *p = '[';
+    _timeDigits(p + 1, y, 4);           p[5]  = '-';
+    _timeDigits(p + 6, m, 2);           p[8]  = '-';
+    _timeDigits(p + 9, d, 2);           p[11] = ' ';
+    _timeDigits(p + 12, secs/3600, 2);  p[14] = ':';
+    _timeDigits(p + 15, secs/60%60, 2); p[17] = ':';
+    _timeDigits(p + 18, secs%60, 2);
+    p += 20;
+    if(LOG_TS_MSEC == prec)         *p++ = '.', _timeDigits(p, nsec / 1000000, 3), p += 3;
+    else if(LOG_TS_USEC == prec)    *p++ = '.', _timeDigits(p, nsec / 1000, 6), p += 6;
+    memcpy(p, "] ", 3);
+    return p + 2 - buf;
+}
+
+/**
+ * 返回线程局部缓存的 UTC 偏移(秒)
+ * @note   每 15 分钟(夏令时切换的最小粒度)通过 localtime_r 更新一次
+*/
+static long _timeGmtoff(time_t sec)
+{
+    _logTimeCache* tc = &_time_cache;
+    struct tm tm;
+
+    if(sec >= tc->offend)
+    {
+        localtime_r(&sec, &tm);
+        tc->gmtoff = tm.tm_gmtoff;
+        tc->offend = sec - sec % 900 + 900;
+    }
+    return tc->gmtoff;
+}
+
+/**
+ * 按 type 把指定时间转换成本地时间字符串
+ * @param  buf   目标缓冲区, 至少 30 字节
+ * @param  t     日历时间
+ * @return buf
+*/
+static char* _timeFormat(char* buf, size_t cap, int type, time_t t)
+{
+    struct tm tm;
 
-    t = time(NULL);         // 获取日历时间
-    // 转换成本地时间, 并根据 type 按指定形式输出到字符串
+    localtime_r(&t, &tm);
     switch(type)
     {
-        case TS_LOG:            
-            strftime(timestr, sizeof(timestr), "[%Y-%m-%d %H:%M:%S] ", localtime(&t));
+        case TS_LOG:
+            strftime(buf, cap, "[%Y-%m-%d %H:%M:%S] ", &tm);
             break;
-        case TS_FILE:            
-            strftime(timestr, sizeof(timestr), "-%Y-%m-%d_%H:%M:%S.out", localtime(&t));
+        case TS_FILE:
+            strftime(buf, cap, "-%Y-%m-%d_%H:%M:%S.out", &tm);
             break;
     }
-    return timestr;
+    return buf;
+}
+
+/**
+ * 获取当前时间(秒)
+ * CLOCK_REALTIME_COARSE 由 vDSO 提供, 只读取内核更新的共享页, 没有系统调用, 精度为一个时钟节拍, 用于轮转检测足够了
+*/
+static time_t _timeNow()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+/**
+ * 计算 now 之后的下一个轮转时间点
+ * @param  now       当前时间
+ * @param  interval  轮转间隔(秒), 若能整除一天, 则按本地时间对齐, 如每小时整点, 每天零点;
+ *                   否则直接为 now + interval
+ * @return 下一个轮转时间点
+*/
+static time_t _timeNextBoundary(time_t now, int interval)
+{
+    struct tm tm;
+    time_t local;
+
+    if(86400 % interval)    return now + interval;
+
+    localtime_r(&now, &tm);
+    local = now + tm.tm_gmtoff;
+    return local - local % interval + interval - tm.tm_gmtoff;
 }
 
 /**
@@ -1585,30 +5419,204 @@ void _mkdir(constr name, constr path, mode_t mode)
 }
 
 /**
- * @brief _logFileShrink - 若 日志文件 已达上限, 则清空文件
+ * @brief _logFileShrink - 若 日志文件 已达上限, 则轮转或清空文件
+ * @param log
+ * @note  在日志锁外调用, 同一时刻只有一个线程执行轮转, 其他线程继续写入旧文件, 不会阻塞
+ *        先处理文件再添加提示到系统日志, 否则系统日志自身达到上限时, logsysAdd 会再次进入这里, 无限递归
+ */
+void _logFileShrink(LogFilePtr file)
+{
+    bool timeup = file->interval && _timeNow() >= __atomic_load_n(&file->rotatetime, __ATOMIC_RELAXED);
+
+    if(!timeup && (0 == file->maxsize || _logFileSize(file) <= file->maxsize))
+        return;
+
+    /* 已有线程在处理, 直接返回 */
+    if(__atomic_exchange_n(&file->rotating, true, __ATOMIC_ACQUIRE))
+        return;
+
+    if(timeup && _timeNow() >= file->rotatetime)
+    {
+        /* 按时间轮转, 旧文件以本段的开始时间命名 */
+        char suffix[30];
+        _timeFormat(suffix, sizeof(suffix), TS_FILE, file->segstart);
+        if(LOG_OK == _logFileRotate(file, suffix))
+            logsysAdd(file->name, "Reach the rotate time ~!, File rotated to \"%s%s\"\n", file->path, suffix);
+        else
+        {
+            logsysAdd(file->name, "--Rotating file... err: %s \n", strerror(errno));
+            logsysShow("[%s] --Rotating file... err: %s \n", file->name, strerror(errno));
+        }
+        file->segstart = _timeNow();
+        __atomic_store_n(&file->rotatetime, _timeNextBoundary(file->segstart, file->interval), __ATOMIC_RELAXED);
+    }
+    else if(file->rotate > 0 && _logFileSize(file) > file->maxsize)
+    {
+        if(LOG_OK == _logFileRotate(file, NULL))
+            logsysAdd(file->name, "Test to reach the upper file limitation ~!, File rotated\n");
+        else
+        {
+            logsysAdd(file->name, "--Rotating file... err: %s \n", strerror(errno));
+            logsysShow("[%s] --Rotating file... err: %s \n", file->name, strerror(errno));
+        }
+    }
+    else if(_logFileSize(file) > file->maxsize)
+    {
+        pthread_mutex_lock(&file->locker);
+        _logFlieEmpty(file);
+        pthread_mutex_unlock(&file->locker);
+        logsysAdd(file->name, "Test to reach the upper file limitation ~!, File emptied\n");
+    }
+
+    __atomic_store_n(&file->rotating, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief _logFileRotate - 轮转日志文件, 然后打开新文件
  * @param log
+ * @param suffix  为 NULL 时按数量轮转: path.N-1 -> path.N, ..., path -> path.1, 最旧的 path.N 被覆盖;
+ *                否则按时间轮转: path -> path+suffix
+ * @return 成功返回 LOG_OK; 失败返回 LOG_ERR, 此时继续使用原来的文件
+ * @note  重命名和打开新文件都在锁外进行, 期间其他线程继续写入旧文件(也就是重命名后的文件),
+ *        最后在锁内替换 FILE 指针, 所以写入线程不会因为轮转而阻塞
+ */
+int _logFileRotate(LogFilePtr file, constr suffix)
+{
+    size_t len = strlen(file->path) + 32;
+    char* from = malloc(len), * to = malloc(len);
+    FILE* fp, * old;
+    int i;
+
+    if(suffix)
+    {
+        snprintf(to, len, "%s%s", file->path, suffix);
+        if(rename(file->path, to) && ENOENT != errno)
+            logsysAdd(file->name, "--Rotating file... err: can not rename \"%s\" to \"%s\", %s\n", file->path, to, strerror(errno));
+    }
+    for(i = suffix ? 0 : file->rotate; i > 0; i--)
+    {
+        if(i > 1)   snprintf(from, len, "%s.%d", file->path, i - 1);
+        else        snprintf(from, len, "%s", file->path);
+        snprintf(to, len, "%s.%d", file->path, i);
+        if(rename(from, to) && ENOENT != errno)
+            logsysAdd(file->name, "--Rotating file... err: can not rename \"%s\" to \"%s\", %s\n", from, to, strerror(errno));
+    }
+    free(from);
+    free(to);
+
+    if(!(fp = fopen(file->path, "a+")))
+        return LOG_ERR;
+
+    /* 写出缓冲的内容到旧文件, 然后替换文件流 */
+    pthread_mutex_lock(&file->locker);
+    _logFileDetach(file);
+    old = file->fp;
+    file->fp = fp;
+    __atomic_store_n(&file->cursize, _logFileStatSize(fp), __ATOMIC_RELAXED);
+    file->pending = 0;
+    _logFileIdentity(file);
+    _logFileAttach(file);
+    pthread_mutex_unlock(&file->locker);
+
+    fclose(old);
+    return LOG_OK;
+}
+
+/**
+ * @brief _logFileSize - 获取日志文件大小
+ * @return 大小, 单位为字节
+ * @note  直接读取缓存的计数器, 不会移动 FILE 的位置, 也不会产生系统调用, 可在锁外调用
+ */
+size_t _logFileSize(LogFilePtr file)
+{
+    return __atomic_load_n(&file->cursize, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief _logCount - 累加已写入文件的字节数
+ * @param n   fprintf/vfprintf/fwrite 的返回值, 小于 0 时忽略
  */
-void _logFileShrink(LogPtr log)
+void _logCount(LogFilePtr file, int n)
 {
-    if(0 != log->maxsize && _logFileSize(log) > log->maxsize)
+    if(n > 0)
     {
-        logsysAdd(log->name, "Test to reach the upper file limitation ~!, Empty file...\n");
-        _logFlieEmpty(log);
+        __atomic_add_fetch(&file->cursize, n, __ATOMIC_RELAXED);
+        file->written += n;      // 调用者持有 file->locker
+        file->pending += n;
     }
 }
 
-size_t _logFileSize(LogPtr log)
+/**
+ * @brief _logCountLine - 累加已写入文件的记录数和字节数
+ * @param bytes 本条记录写入的字节数, 为写入前后 file->written 的差值
+ * @note  须持有 log->file->locker, 其他线程只做原子读取
+ */
+static void _logCountLine(LogPtr log, uint64_t bytes)
+{
+    __atomic_store_n(&log->lines, log->lines + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&log->bytes, log->bytes + bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief _logCountFlush - 累加日志触发的写出次数
+ * @param n   写出前后 file->flushes 的差值
+ * @note  须持有 log->file->locker, 其他线程只做原子读取
+ */
+static void _logCountFlush(LogPtr log, uint64_t n)
+{
+    if(n)   __atomic_store_n(&log->flushes, log->flushes + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief _logDumpCounters - 把日志的计数器写入系统日志
+ */
+static void _logDumpCounters(LogPtr log)
+{
+    LogStats st;
+
+    bzero(&st, sizeof(st));
+    _logStatsCollect(log, &st);
+    logsysAdd(log->name, "--Counters: lines %llu, bytes %llu, errs %llu, dropped %llu, flushes %llu, "
+                         "calls %llu, p50 %lluns, p99 %lluns, p99.9 %lluns, lockwait %lluus, consolewait %lluus\n",
+              (unsigned long long)st.lines, (unsigned long long)st.bytes, (unsigned long long)st.errs,
+              (unsigned long long)st.dropped, (unsigned long long)st.flushes, (unsigned long long)st.calls,
+              (unsigned long long)logStatsPercentile(&st, 50), (unsigned long long)logStatsPercentile(&st, 99),
+              (unsigned long long)logStatsPercentile(&st, 99.9),
+              (unsigned long long)st.lockwait / 1000, (unsigned long long)st.consolewait / 1000);
+}
+
+/**
+ * @brief _logFileStatSize - 通过 fstat 获取文件的实际大小, 只在打开文件时用于初始化计数器
+ */
+static size_t _logFileStatSize(FILE* fp)
+{
+    struct stat st;
+    if(!fp || fstat(fileno(fp), &st))   return 0;
+    return st.st_size;
+}
+
+/**
+ * @brief _logFileIdentity - 记录当前文件的 dev/inode, 打开和轮转后调用
+ */
+static void _logFileIdentity(LogFilePtr file)
 {
-    fseek(log->fp, 0, SEEK_END);
-    return ftell(log->fp);
+    struct stat st;
+
+    if(!file->fp || fstat(fileno(file->fp), &st))
+        st.st_dev = st.st_ino = 0;
+    __atomic_store_n(&file->dev, st.st_dev, __ATOMIC_RELAXED);
+    __atomic_store_n(&file->ino, st.st_ino, __ATOMIC_RELAXED);
 }
 
-int _logFlieEmpty(LogPtr log)
+int _logFlieEmpty(LogFilePtr file)
 {
-    int fd = fileno(log->fp);
+    int fd = fileno(file->fp);
+    _logFileDetach(file);
     fd = ftruncate(fd, 0);
-    rewind(log->fp);
-    fflush(log->fp);
+    rewind(file->fp);
+    __atomic_store_n(&file->cursize, 0, __ATOMIC_RELAXED);
+    file->pending = 0;
+    _logFileAttach(file);
     return fd;
 }
 /* ---------------------- logcheck private prototypes ---------------------------- */
@@ -1641,12 +5649,45 @@ int _check_path(constr path, constr tag)                           // 检查 pat
     }
     return LOG_OK;
 }
-LogPtr _check_log(constr name, constr tag)                            // 检查 log 是否存在, 并输出相应提示信息
+/**
+ * @brief _check_log - 检查 log 是否存在, 并输出相应提示信息
+ * @return 找到的日志结构; 若不存在返回 NULL
+ * @note   查找前会进入读临界区, 若返回值不为 NULL, 调用者用完日志结构后必须调用 _logReadUnlock()
+ */
+LogPtr _check_log(constr name, constr tag)
 {
+    _logReadLock();
     /* 未找到指定的 log, 返回 err */
-    LogPtr r_log = _logdictFetchValue(_logsys_dic, name);
+    LogPtr r_log = _logSnapFind(name);
     if(!r_log)
+    {
+        _logReadUnlock();
         logsysAdd(name, "%s() err: log not exist \n", tag);
+    }
+    return r_log;
+}
+/**
+ * @brief _check_handle - 检查句柄是否有效
+ * @return 句柄对应的日志结构; 若句柄无效返回 NULL
+ * @note   同 _check_log, 若返回值不为 NULL, 调用者用完日志结构后必须调用 _logReadUnlock()
+ *         先读日志再读代数, 若期间日志被销毁, 代数一定已经改变
+ */
+LogPtr _check_handle(LogHandle h)
+{
+    unsigned int idx = (uint32_t)h - 1;
+    _logHandleSlot* slot;
+    LogPtr r_log;
+
+    if(idx >= MAX_LOG_HANDLES)  return NULL;
+    slot = &_logsys_handles[idx];
+
+    _logReadLock();
+    r_log = __atomic_load_n(&slot->log, __ATOMIC_ACQUIRE);
+    if(!r_log || __atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE) != (uint32_t)(h >> 32))
+    {
+        _logReadUnlock();
+        return NULL;
+    }
     return r_log;
 }
 int _check_size_mb(size_t size_mb, constr name, constr tag)
@@ -20,8 +20,9 @@
  *      3. 用户日志大小默认为 100M, 可使用 logSetFileSize(size_mb), 每次使用都须重新设置, 每个用户日志均有自己的属性, 互不影响
  *
  * 注意:
- *      本日志系统并没有执行相同文件测试, 即两个日志结构可以指向同一个文件
- *      本日志并没有做轮询写入, 只是简单清空, 下一版本完善
+ *      指向同一个文件(按 dev/inode 判断) 的日志共享同一个文件流, 锁 和 缓冲区, 各自保留名称, 静默属性 和 级别,
+ *      文件相关的设置(logSetFileSize, logSetRotate, logSetRotateTime, logSetFlush, logSetEngine, logSetBinary, logSetBlackBox, logFlieEmpty) 对共享该文件的所有日志生效
+ *      日志文件达到上限时默认只是简单清空, 可通过 logSetRotate() 开启按大小轮转
  *
  * author: ziyht
  *
@@ -30,6 +31,33 @@
  *      2. 添加用户自定义调式日志API: logErr logWarning logInfo
  *      3. 添加系统自定义调式日志API: logsysErr logsysWarning logsysInfo
  *      4. 添加多线程安全特性
+ *
+ * 2.1.0 更新:
+ *      1. 添加异步模式: logsysSetAsync(), 开启后 logAdd* 只把渲染好的记录放入有界无锁队列, 由后台线程批量写入文件
+ *      2. 用户日志文件锁由全局锁改为每个日志结构独立的锁, 不同日志之间的写入互不阻塞
+ *      3. 文件大小改为缓存的原子计数器, 大小检测和 logFileSize() 不再调用 fseek/ftell
+ *      4. 添加按大小轮转: logSetRotate(), 达到上限时把文件依次重命名为 path.1 ... path.N, 然后打开新文件
+ *      5. 添加按时间轮转: logSetRotateTime(), 可按小时/天/自定义秒数轮转, 旧文件以本段开始时间命名
+ *      6. 时间前缀改为线程局部缓存, 只在秒变化时重新渲染, 默认精确到毫秒, 可通过 logsysSetTimePrecision() 设置
+ *      7. 日志名查找改为读取不可变快照(RCU), logCreate/logDestroy 写时复制并延迟释放, 读取无锁也无数据竞争
+ *      8. 添加句柄API: logOpen() logAddH() logAddTextH() logErrH() logWarningH() logInfoH(), 跳过 name 的 hash 和检测, 日志销毁后句柄自动失效
+ *      9. 调式宏 logErr/logsysErr/... 不再 calloc/strcat 格式化字串, 前缀格式在编译期拼接, 调用时没有堆内存分配
+ *     10. 添加调式信息级别: logSetLevel() logsysSetLevel(), 被关闭的级别在宏中只需一次原子读, 不会对参数求值
+ *     11. 添加编译期级别 LOG_COMPILE_LEVEL, 高于它的调式宏展开为空语句, 参数也不会出现在编译结果中
+ *     12. 添加 fflush 策略: logSetFlush() 可选每行, 每 N 字节, 每 N 毫秒(后台定时线程) 或只在 logErr/logFlush() 时 fflush
+ *     13. 添加写入引擎 LOG_IO_DIRECT: logSetEngine(), 格式化到日志自己的双缓冲区, 写满的缓冲区在锁外 writev, 不经过 stdio
+ *     14. 添加写入引擎 LOG_IO_MMAP: 按块 fallocate 预分配文件并 mmap, 写入只是 memcpy 到页缓存, 关闭/轮转/清空时截断到实际长度
+ *     15. 添加写入引擎 LOG_IO_URING: 所有日志共享一个 io_uring 实例, 异步模式下写线程每批次只用一次系统调用提交所有日志的缓冲区, 内核不支持时退回 stdio
+ *     16. 添加二进制记录: logSetBinary(), 只保存格式化字串 id, 时间和参数, 不调用 vfprintf, 由 logDecode() 或 logdecode 工具还原为完全相同的文本
+ *     17. 用户日志的每次写入不再向系统日志追加 "add a log", 改为每个日志的计数器(记录数, 字节数, logErr 数), 由 logsysDump() 或 logsysSetDumpInterval() 写入系统日志
+ *     18. 添加统计API: logStats() logsysStats(), 包括丢弃数, 写出次数, 等待文件锁/控制台锁的时间 和 调用耗时直方图, 统计按线程分散到独占缓存行的分片中
+ *     19. 添加性能测试程序 logbench(logbench.pro), 输出机器可读的 JSON Lines 报告, 便于比较不同版本
+ *     20. 添加按调用点过滤的调式宏: logErrEvery() logErrRateLimited() logErrSampled() 及对应的 logWarning, logInfo 版本, 过滤检查只需一次原子操作, 被抑制的条数在下一次输出时报告
+ *     21. 添加重复记录合并: logSetDedup(), 格式化字串和参数都相同的连续记录只写入一条, 重复结束或超时时写入 "last message repeated N times" 摘要, 比较时不调用 vfprintf
+ *     22. 添加异步控制台输出: logsysSetConsoleAsync(), 所有日志的控制台输出在锁内只做 memcpy, 由后台线程合并后批量 writev, 控制台阻塞时丢弃并计数, 调用者不会被阻塞; 每条控制台输出也改为一次 writev
+ *     23. 同时输出到文件和控制台的记录(用户日志 和 系统日志) 只渲染一次到线程局部缓冲区, 文件和控制台写入相同的内容, 时间前缀也相同
+ *     24. logCreate() 按 dev/inode 检测已打开的文件, 指向同一文件的日志共享一个引用计数的日志文件结构 LogFile(文件流, 锁, 引擎缓冲区, 轮转状态, 黑匣子), 同一文件只有一个 fd, 写入不会交错, 计数器属于各自的日志
+ *     25. 添加黑匣子: logSetBlackBox(), 每条记录以文本形式 memcpy 到 MAP_SHARED 映射的环形缓冲区文件, 原子预留 head, 没有系统调用, 进程崩溃或被 SIGKILL 后最近的记录仍可由 logBoxExtract() 或 logbox 工具按顺序取出
 */
 
 #include <stdio.h>      // FILE
@@ -39,6 +67,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <malloc.h>
+#include <stdlib.h>     // posix_memalign
 #include <stddef.h>
 #include <string.h>
 #include <stdarg.h>
@@ -46,11 +75,24 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>    // writev
+#include <sys/mman.h>   // mmap
+#include <fcntl.h>      // fallocate
+#include <sys/syscall.h>    // syscall
 #include <pthread.h>    // 引入多线程安全
+#include <sched.h>      // sched_yield
+#include <link.h>       // dl_iterate_phdr
 
 #ifndef LOG_H
 #define LOG_H
 
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h> // io_uring, 直接通过系统调用使用, 不依赖 liburing
+#define LOG_HAVE_URING  1
+#endif
+#endif
+
 #define LOG_ERR     0
 #define LOG_OK      1
 #define LOGDICT_ERR 2
@@ -58,18 +100,140 @@
 
 #define DF_LOG_DIR     "./logs/"               // 默认的日志文件存放地点
 #define DF_LOG_SIZE    100                     // 默认日志文件大小 100 M
+#define DF_LOG_ROTATE  0                       // 默认不轮转, 日志文件达到上限时直接清空
+#define MAX_LOG_ROTATE 1000                    // 最多保留的旧文件数量
+
+#define MAX_LOG_HANDLES 1024                   // 最多可同时打开的日志句柄数量
+
+#define LOG_ROTATE_HOURLY   3600               // 每小时轮转
+#define LOG_ROTATE_DAILY    86400              // 每天轮转
+
+#define LOG_LV_OFF      0                      // 调式信息级别: 关闭所有调式信息
+#define LOG_LV_ERR      1                      // 调式信息级别: 只输出 logErr
+#define LOG_LV_WARNING  2                      // 调式信息级别: 输出 logErr logWarning
+#define LOG_LV_INFO     3                      // 调式信息级别: 输出所有调式信息
+#define DF_LOG_LEVEL    LOG_LV_INFO            // 默认输出所有级别
+
+#ifndef LOG_COMPILE_LEVEL                      // 编译期调式信息级别, 高于它的调式宏展开为空(包括参数), 可在编译时指定, 如 -DLOG_COMPILE_LEVEL=1
+#define LOG_COMPILE_LEVEL   LOG_LV_INFO        // 默认保留所有级别
+#endif
+
+#define LOG_FLUSH_LINE      0                  // fflush 策略: 每行 fflush 一次
+#define LOG_FLUSH_BYTES     1                  // fflush 策略: 未 fflush 的字节数达到 N 时 fflush
+#define LOG_FLUSH_TIME      2                  // fflush 策略: 由后台定时线程每 N 毫秒 fflush 一次
+#define LOG_FLUSH_MANUAL    3                  // fflush 策略: 只在 logErr 或 logFlush() 时 fflush
+#define DF_LOG_FLUSH        LOG_FLUSH_LINE     // 默认每行 fflush 一次
+#define DF_FLUSH_TICK_MS    10                 // 定时 fflush 线程的检查间隔(毫秒)
+
+#define LOG_IO_STDIO        0                  // 写入引擎: 通过 stdio 的 FILE* 写入
+#define LOG_IO_DIRECT       1                  // 写入引擎: 格式化到日志自己的双缓冲区, 由 writev 直接写入, 不经过 stdio
+#define LOG_IO_MMAP         2                  // 写入引擎: fallocate 预分配文件, 通过 mmap 窗口直接 memcpy 到页缓存, 没有系统调用
+#define LOG_IO_URING        3                  // 写入引擎: 同 LOG_IO_DIRECT 的双缓冲区, 写满的缓冲区交给共享的 io_uring 写入, 不等待完成
+#define DF_LOG_ENGINE       LOG_IO_STDIO       // 默认使用 stdio
+#define DF_LOG_BUFSIZE      (64 << 10)         // LOG_IO_DIRECT/LOG_IO_URING 每个缓冲区的默认大小 64K
+#define DF_LOG_LINE_SIZE    1024               // 同时输出到文件和控制台的记录只渲染一次, 线程局部缓冲区的大小, 超出时使用堆内存
+#define MIN_LOG_BUFSIZE     1024               // LOG_IO_DIRECT/LOG_IO_URING 每个缓冲区的最小大小
+#define DF_LOG_MMAPSIZE     (4 << 20)          // LOG_IO_MMAP 每次预分配和映射的默认大小 4M
+#define LOG_MMAP_SLACK      (MAX_FORMAT_SPECS * 24 + LOG_BIN_HEAD)  // 崩溃后截断含二进制段的文件时多保留的 '\0', 不小于一条二进制记录末尾可能的 0 字节数
+#define DF_URING_ENTRIES    256                // 共享 io_uring 的提交队列大小, 每个日志同一时刻最多占用一项
+#define LOG_BOX_MAGIC       "LOGBOX01"         // 黑匣子文件头部的标识
+#define LOG_BOX_SUFFIX      ".box"             // 黑匣子文件的路径为 日志文件路径 + 此后缀
+
+#define LOG_HIST_SUB_BITS   2                  // 耗时直方图: 每个 2 的幂区间细分为 2^LOG_HIST_SUB_BITS 个子区间, 相对误差不超过 25%
+#define LOG_HIST_BUCKETS    160                // 耗时直方图的桶数量, 覆盖 0 ~ 2^41 ns, 更大的值计入最后一个桶
+#define LOG_STAT_SHARDS     8                  // 每个日志的统计分片数量, 必须为 2 的幂, 线程按序号分散到不同分片
 
 #define NMUTE false
 #define MUTE  true
 
 typedef const char* constr;
+typedef uint64_t LogHandle;     // 日志句柄, 由 logOpen() 返回, 高 32 位为代数, 低 32 位为槽位序号 + 1, 0 表示无效句柄
 
-typedef struct Log{
-    char* name;         // 本日志的名称, 每次输出的时候都会附带, 以区分不同的日志信息
+/* 日志的统计信息, 由 logStats() / logsysStats() 填充 */
+typedef struct LogStats{
+    uint64_t lines;         // 已写入文件的记录数
+    uint64_t bytes;         // 已写入文件的字节数, 不因轮转/清空而归零
+    uint64_t errs;          // logErr 记录数
+    uint64_t dropped;       // 异步模式下因队列满而丢弃的记录数
+    uint64_t flushes;       // 写出次数(fflush, 或等待缓冲区写入完成)
+    uint64_t calls;         // 写入调用次数, 即直方图中的样本数, 关闭统计(logsysSetStats)期间不计入
+    uint64_t lockwait;      // 等待日志文件锁的总时间(ns), 只在发生竞争时计时
+    uint64_t consolewait;   // 等待控制台锁的总时间(ns), 只在发生竞争时计时
+    uint64_t hist[LOG_HIST_BUCKETS];   // 写入调用耗时(ns)的直方图, 使用 logStatsPercentile() 读取
+}LogStats;
+
+/* 黑匣子文件的头部, 之后紧跟 size 字节的环形数据区, 整个文件以 MAP_SHARED 映射 */
+typedef struct LogBox{
+    char     magic[8];      // LOG_BOX_MAGIC, 初始化完成后最后写入
+    uint64_t size;          // 数据区大小
+    uint64_t head;          // 已写入的总字节数, 写入时原子累加, 写入位置为 head % size
+    char     pad[40];       // 数据区从第 64 字节开始
+    char     data[];
+}LogBox;
+
+/* 日志文件: 文件流, 锁, 写入引擎, 缓冲区, 轮转和 fflush 设置; 指向同一文件(dev/inode)的日志共享一个, 引用计数 */
+typedef struct LogFile{
+    char* name;         // 第一个打开该文件的日志的名称, 用于系统日志中的提示
     char* path;         // 存储日志文件的位置
     FILE* fp;           // 文件流指针, 指向存储日志的本地文件
     size_t maxsize;     // 最大文件大小, 默认为 0, 表示不设限制
+    size_t cursize;     // 当前文件大小, 打开时由 fstat 初始化, 之后每次写入原子累加, 避免每次 fseek/ftell
+    int  rotate;        // 轮转时保留的旧文件数量(path.1 ... path.N), 为 0 时达到上限直接清空文件
+    bool rotating;      // 是否有线程正在轮转/清空文件
+    int  interval;      // 按时间轮转的间隔(秒), 为 0 时不按时间轮转
+    time_t rotatetime;  // 缓存的下一个轮转时间点
+    time_t segstart;    // 当前文件段的开始时间, 轮转时用于命名旧文件
+    int  flush;         // fflush 策略, 见 LOG_FLUSH_*
+    size_t flusharg;    // LOG_FLUSH_BYTES 时为字节数, LOG_FLUSH_TIME 时为毫秒数
+    size_t pending;     // 上次 fflush 之后写入的字节数, 须持有 locker
+    uint64_t flushtime; // 定时线程上次检查时 fflush 的时间(毫秒)
+    int  engine;        // 写入引擎, 见 LOG_IO_*
+    char* wbuf[2];      // LOG_IO_DIRECT/LOG_IO_URING 的双缓冲区, 一个用于格式化写入, 另一个可能正在锁外 writev 或由 io_uring 写入
+    size_t wcap;        // 每个缓冲区的大小
+    size_t wlen;        // 当前缓冲区已使用的长度
+    int  wcur;          // 当前用于格式化写入的缓冲区序号
+    bool wbusy;         // 是否有缓冲区正在 writev, 同一时刻最多一个
+    bool ubusy;         // LOG_IO_URING 是否有缓冲区正在由 io_uring 写入, 同一时刻最多一个, 原子读写
+    struct iovec uiov;  // LOG_IO_URING 正在写入的缓冲区中剩余的部分, 只在持有 _uring_locker 时访问
+    pthread_cond_t wcond;   // writev 完成时通知等待的线程
+    char* mbase;        // LOG_IO_MMAP 当前映射的窗口
+    size_t mlen;        // 窗口大小, 也是每次 fallocate 预分配的大小, 按页对齐
+    size_t mpos;        // 窗口中已写入的长度, 文件的实际长度为 moff + mpos
+    off_t moff;         // 窗口在文件中的偏移, 按页对齐
+    bool binary;        // 是否使用二进制记录, 原子读取
+    bool binseg;        // 当前文件中是否已开始二进制段(已写入 LOG_BIN_MAGIC), 须持有 locker
+    unsigned char* bindef;  // 当前二进制段中已定义的格式化字串 id 位图, 须持有 locker
+    size_t bindefcap;   // 位图的字节数
+    LogBox* box;        // 黑匣子的映射, 为 NULL 时关闭, 原子读取, 替换后延迟到宽限期结束再解除映射
+    uint64_t written;   // 已写入的总字节数, 持有 locker 时更新, 写入一条记录前后的差值计入该记录所属日志的字节数
+    uint64_t flushes;   // 已写出的总次数, 持有 locker 时更新, 同 written, 差值计入触发写出的日志
+    pthread_mutex_t locker; // 文件锁, 不同文件之间的写入互不阻塞
+    int  refs;          // 引用该文件的日志数, 为 0 时关闭, 只在持有 _dictLocker 时修改
+    dev_t dev;          // 当前文件的 dev/inode, 用于 logCreate 时查找已打开的同一文件, 原子读写
+    ino_t ino;
+}* LogFilePtr;
+
+typedef struct Log{
+    char* name;         // 本日志的名称, 每次输出的时候都会附带, 以区分不同的日志信息
+    LogFilePtr file;    // 日志文件, 指向同一文件的日志共享一个
+    unsigned int hslot; // 句柄槽位序号 + 1, 为 0 表示还没有通过 logOpen() 分配句柄
+    int  level;         // 调式信息级别, 只输出级别不高于它的 logErr/logWarning/logInfo, 原子读取
     bool mutetype;      // 静默属性, 决定在添加日志时是否显示到控制台上
+    uint64_t lines;     // 计数器: 已写入文件的记录数, 持有 file->locker 时更新, 原子读取
+    uint64_t bytes;     // 计数器: 本日志的记录写入文件的字节数(不因轮转/清空而归零), 持有 file->locker 时更新, 原子读取
+    uint64_t flushes;   // 计数器: 本日志的写入或调用触发的写出次数, 持有 file->locker 时更新, 原子读取
+    uint64_t errs;      // 计数器: logErr 记录数, 原子累加
+    uint64_t dropped;   // 计数器: 异步模式下因队列满而丢弃的记录数, 原子累加
+    struct _logStatShard* stats;    // LOG_STAT_SHARDS 个统计分片, 各自独占缓存行
+    int  dedup;         // 合并连续重复记录的超时(毫秒), 为 0 时不合并, 原子读取
+    constr dupfmt;      // 上一条记录的格式化字串, 以下 dup* 须持有 dlocker
+    uint32_t duphash;   // 上一条记录(不含时间) 的 prefix 和 参数的 hash
+    size_t duplen;      // 上一条记录参与 hash 的字节数
+    bool dupconsole;    // 上一条记录是否输出到控制台, 摘要行与之相同
+    uint64_t dupcount;  // 上一条记录之后被合并的重复记录数
+    uint64_t dupfirst;  // 第一条被合并的记录的时间(毫秒)
+    uint64_t duplast;   // 最后一条被合并的记录的时间(毫秒)
+    pthread_mutex_t dlocker;    // 合并重复记录的锁, 保护以上 dup*; 摘要和打断重复的新记录也在锁内写入, 保证顺序
 }* LogPtr;
 
 /* ------------------------------- logdict struct ------------------------------------*/
@@ -127,6 +291,149 @@ typedef struct logdict {
 #define logdictGetKey(he) ((he)->key)
 #define logdictGetVal(he) ((he)->v)
 
+/* ------------------------------- rcu struct ------------------------------------*/
+/* 日志名字典的只读快照, 开放地址法, 创建后不再修改 */
+typedef struct _logSnap {
+    unsigned long sizemask;         // 大小掩码, 大小为 2 的幂
+    struct {
+        unsigned int hash;          // name 的 hash 值
+        LogPtr v;                   // 日志结构, 为 NULL 表示空槽位
+    } slots[];
+} _logSnap;
+
+/* 读者槽位, 每个线程一个, 独占一个缓存行, 进入读临界区时记录当前纪元 */
+typedef struct _logReader {
+    size_t epoch;                   // 进入读临界区时的全局纪元, 为 0 表示不在读临界区内
+    int    depth;                   // 嵌套深度, 只有所属线程访问
+    bool   used;                    // 槽位是否被线程占用
+    struct _logReader* next;
+} __attribute__((aligned(64))) _logReader;
+
+/* 等待宽限期结束后释放的对象 */
+typedef struct _logRetired {
+    size_t epoch;                   // 对象被替换后的纪元, 所有读者的纪元都不小于它时才能释放
+    void*  ptr;
+    void (*destructor)(void*);
+    struct _logRetired* next;
+} _logRetired;
+
+/* 句柄槽位, 日志销毁时清空并递增代数, 使旧句柄失效 */
+typedef struct _logHandleSlot {
+    LogPtr   log;                   // 日志结构, 为 NULL 表示槽位空闲
+    uint32_t gen;                   // 槽位代数, 必须和句柄的高 32 位一致, 句柄才有效
+} _logHandleSlot;
+
+/* ------------------------------- async struct ------------------------------------*/
+#define DF_ASYNC_QUEUE_SIZE   4096    // 异步队列容量(记录数), 必须为 2 的幂
+#define DF_ASYNC_MSG_SIZE     512     // 队列中每条记录的内联缓冲区大小, 超出时使用堆内存
+#define DF_ASYNC_BATCH        256     // 后台写线程每批次最多处理的记录数
+#define DF_ASYNC_WAIT_MS      10      // 队列为空时, 后台写线程的最长休眠时间
+#define DF_ASYNC_REPORT_MS    1000    // 定时线程报告队列满丢弃记录数的最短间隔(毫秒)
+
+/* 异步队列中的一条记录, 保存已渲染好的日志内容 */
+typedef struct _logRecord {
+    size_t seq;                     // 槽位序号, 用于无锁多生产者队列的同步
+    LogPtr log;                     // 目标日志结构
+    bool   console;                 // 是否输出到控制台
+    bool   flush;                   // 写入后是否立即写出(logErr), 由写线程处理, 生产者不等待
+    bool   tagged;                  // 输出到控制台时, 是否在时间前缀后添加 "[name] :"
+    bool   binary;                  // 记录内容是否为二进制记录, 输出到控制台时由写线程格式化
+    size_t tlen;                    // 时间前缀的长度
+    size_t len;                     // 记录长度
+    char*  msg;                     // 记录内容, 指向 buf 或 堆内存
+    char   buf[DF_ASYNC_MSG_SIZE];  // 内联缓冲区
+} _logRecord;
+
+/* ------------------------------- console struct ------------------------------------*/
+#define DF_CONSOLE_BUF_SIZE   (256 << 10) // 异步控制台输出每个缓冲区的大小, 写满时丢弃新的输出, 超过它的单条输出总是丢弃
+#define DF_CONSOLE_WAIT_MS    10          // 控制台线程的最长休眠时间, 缓冲区超过一半时提前唤醒
+
+/* ------------------------------- uring struct ------------------------------------*/
+#ifdef LOG_HAVE_URING
+/* 所有 LOG_IO_URING 日志共享的 io_uring 实例, 只在持有 _uring_locker 时访问 */
+typedef struct _logUring {
+    int       fd;                   // io_uring_setup 返回的 fd, 为 -1 表示未创建
+    unsigned  entries;              // 提交队列大小
+    unsigned* sqhead;               // 提交队列
+    unsigned* sqtail;
+    unsigned* sqmask;
+    unsigned* sqarray;
+    unsigned* cqhead;               // 完成队列
+    unsigned* cqtail;
+    unsigned* cqmask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void*     sqring;               // 映射的区域和大小, 释放时使用
+    size_t    sqsize;
+    void*     cqring;
+    size_t    cqsize;
+    size_t    sqesize;
+    unsigned  queued;               // 已放入提交队列还没有 io_uring_enter 的项数
+} _logUring;
+#endif
+
+/* ------------------------------- binary struct ------------------------------------*/
+/*  二进制记录(本机字节序), 每条记录为 | type(1) | len(4) | payload(len) |:
+ *      'F' 格式化字串定义 | id(4) | 格式化字串(不含 '\0') |, 每个二进制段中第一次使用某个 id 之前写入
+ *      'R' 延迟格式化记录 | id(4, 0 表示没有 text) | flags(1) | [sec(8) nsec(4) gmtoff(4) prec(1)] | [prefix 长度(4) prefix] | 参数 |
+ *      'T' 已渲染的文本   | 时间前缀长度(4) | 文本 |, 用于含有不支持的转换说明的格式化字串
+ *      'E' 二进制段结束, 之后的内容为文本, 直到下一个 LOG_BIN_MAGIC
+ *  参数按转换说明的顺序存放: '*' 宽度/精度 和 int 及以下的整数为 4 字节, 其他整数和指针为 8 字节,
+ *  double 为 8 字节, long double 为 sizeof(long double) 字节, 字符串为 长度(4, 0xFFFFFFFF 表示 NULL) + 内容
+ */
+#define LOG_BIN_MAGIC       "\0LOGBIN1"    // 二进制段的起始标记, 文本日志中不会出现 '\0'
+#define LOG_BIN_MAGIC_LEN   8
+#define LOG_BIN_HEAD        5               // 记录头 type + len 的长度
+#define LOG_BIN_FORMAT      'F'
+#define LOG_BIN_RECORD      'R'
+#define LOG_BIN_TEXT        'T'
+#define LOG_BIN_END         'E'
+#define LOG_BIN_TIMED       0x01            // 'R' 记录带时间
+#define LOG_BIN_PREFIX      0x02            // 'R' 记录带 prefix
+
+#define DF_LOG_FORMATS      4096            // 最多记录的格式化字串数量, 超出后使用 'T' 记录
+#define DF_LOG_FMT_RANGES   256             // 最多收集的只读段数量, 只有其中的字面量格式化字串会被记录
+#define MAX_FORMAT_SPECS    64              // 单个格式化字串最多的转换说明数量, 超出后使用 'T' 记录
+#define MAX_FORMAT_LEN      65535           // 格式化字串的最大长度, 超出后使用 'T' 记录
+
+#define LOG_ARG_NONE        0               // 转换说明的参数类型: 没有参数(%% 或 结尾的普通文本)
+#define LOG_ARG_INT         1               // int 及以下的整数, %c
+#define LOG_ARG_LONG        2
+#define LOG_ARG_LLONG       3
+#define LOG_ARG_INTMAX      4
+#define LOG_ARG_SIZE        5
+#define LOG_ARG_PTRDIFF     6
+#define LOG_ARG_DOUBLE      7
+#define LOG_ARG_LDOUBLE     8
+#define LOG_ARG_PTR         9
+#define LOG_ARG_STR         10
+
+/* 格式化字串中的一段: 上一段结束处到本转换说明结束处 */
+typedef struct _logFmtSpec {
+    unsigned short end;             // 本段在格式化字串中的结束位置
+    unsigned char  star;            // 宽度和精度中 '*' 的个数, 各对应一个 int 参数
+    unsigned char  kind;            // 值参数的类型 LOG_ARG_*
+    int            prec;            // %s 的精度, -1 表示未指定, -2 表示由 '*' 参数指定
+} _logFmtSpec;
+
+/* 解析过的格式化字串, 创建后不再修改 */
+typedef struct _logFormat {
+    constr   key;                   // 调用者传入的格式化字串指针
+    char*    fmt;                   // 格式化字串的拷贝
+    unsigned id;                    // 从 1 开始
+    int      nspecs;                // 段数, -1 表示含有不支持的转换说明(%n %m 位置参数 宽字符等), 使用 'T' 记录
+    _logFmtSpec specs[];
+} _logFormat;
+
+/* ------------------------------- stats struct ------------------------------------*/
+/* 统计分片, 同一分片的线程之间才有竞争, 分片之间不共享缓存行 */
+typedef struct _logStatShard {
+    uint64_t calls;                 // 写入调用次数
+    uint64_t lockwait;              // 等待日志文件锁的时间(ns)
+    uint64_t consolewait;           // 等待控制台锁的时间(ns)
+    uint64_t hist[LOG_HIST_BUCKETS];    // 写入调用耗时的直方图
+} __attribute__((aligned(64))) _logStatShard;
+
 /* ------------------------------- logsys API ------------------------------------*/
 #define LOGSYS_PATH     "./logs/sys.out"
 
@@ -136,6 +443,16 @@ typedef struct logdict {
 #define DF_LOGSYS_FILESIZE    1       // 系统日志大小, 默认为 1 M
 #define DF_LOGSYS_DIC         NULL    // 日志系统维护的日志结构字典
 #define DF_LOGSYS_DICTYPE     NULL    // 日志字典类型
+#define DF_LOGSYS_ASYNC       false   // 异步模式, 默认关闭
+#define DF_LOGSYS_TIMEPREC    LOG_TS_MSEC // 日志时间前缀精度, 默认精确到毫秒
+#define DF_LOGSYS_LEVEL       DF_LOG_LEVEL    // 系统日志 和 新建日志 的默认调式信息级别
+#define DF_LOGSYS_DUMP        0       // 定时把用户日志计数器写入系统日志的间隔(秒), 默认不写入
+#define DF_LOGSYS_STATS       true    // 是否统计写入调用的耗时, 默认开启
+#define DF_LOGSYS_CONSOLE     false   // 异步控制台输出, 默认关闭
+
+#define LOG_TS_SEC            0       // 时间前缀精度: 秒   "[%Y-%m-%d %H:%M:%S] "
+#define LOG_TS_MSEC           3       // 时间前缀精度: 毫秒 "[%Y-%m-%d %H:%M:%S.mmm] "
+#define LOG_TS_USEC           6       // 时间前缀精度: 微秒 "[%Y-%m-%d %H:%M:%S.uuuuuu] "
 
 // 系统日志设置 API
 int  logsysInit();                              // 初始化日志系统
@@ -144,6 +461,14 @@ void logsysRelease();                           // 停用日志系统 并 释放
 void logsysSetMutetype(bool mutetype);          // 设置日志系统静默属性
 int  logsysSetFileSize(size_t size_mb);         // 设置系统日志最大文件大小
 int  logsysFlieEmpty();                         // 清空系统日志文件
+int  logsysSetAsync(bool async);                // 设置用户日志的异步模式, 开启后由后台线程批量写入文件
+int  logsysSetTimePrecision(int prec);          // 设置日志时间前缀的精度: LOG_TS_SEC / LOG_TS_MSEC / LOG_TS_USEC
+int  logsysSetLevel(int level);                 // 设置系统日志 和 之后新建日志 的调式信息级别: LOG_LV_OFF ~ LOG_LV_INFO
+int  logsysSetDumpInterval(int seconds);        // 设置定时把用户日志计数器写入系统日志的间隔(秒), 为 0 时不定时写入
+int  logsysDump();                              // 立即把所有用户日志的计数器写入系统日志
+int  logsysSetStats(bool on);                   // 设置是否统计写入调用的耗时, 关闭后每次调用少两次读时钟
+int  logsysStats(LogStats* st);                 // 获取所有用户日志统计信息的总和
+int  logsysSetConsoleAsync(bool async);         // 设置控制台输出的异步模式, 开启后所有控制台输出由后台线程合并后批量写入, 控制台阻塞时丢弃而不阻塞调用者
 
 // 系统日志操作 API
 int  logsysShowTime();                                  // 当系统日志无法输出(未开启或静默)时, 在控制台上显示时间
@@ -155,6 +480,7 @@ void logsysAddTextNMute(constr name, constr text, ...); // 添加 text 到系统
 void logsysAdd(constr name, constr text, ...);          // 添加 时间 和 text 到系统日志中, 由系统日志静默属性决定是否输出到控制台
 void logsysAddMute(constr name, constr text, ...);      // 添加 时间 和 text 到系统日志中, 强制静默
 void logsysAddNMute(constr name, constr text, ...);     // 添加 时间 和 text 到系统日志中, 强制非静默
+void logsysAddDebug(constr name, int level, constr text, ...);     // 系统调式日志的专用 API, 不要直接使用, 请使用下面的宏函数
 
 /* ------------------------- logsys Debug macros  ------------------------------------*/
 // DEBUG_FORMAT_STR & DEBUG_FORMAT_SRC 自定义调式格式化字串和源
@@ -163,42 +489,30 @@ void logsysAddNMute(constr name, constr text, ...);     // 添加 时间 和 tex
 #define D_F_STR_E   "%s(%d)-%s: %s\n"
 #define D_F_SRC_E   __FILE__, __LINE__, __FUNCTION__, strerror(errno)
 
-#define logsysErr(name, format, ...) do{\
-        char* newFormat, * fmtptr = format;char tag[] = "[err]: ";\
-        if(!fmtptr || !*fmtptr){\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR_E) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR_E);\
-            logsysAdd(name, newFormat, D_F_SRC_E);}\
-        else{\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR) + strlen(fmtptr) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR);strcat(newFormat, fmtptr);\
-            logsysAdd(name, newFormat, D_F_SRC, ##__VA_ARGS__);}\
-        free(newFormat);\
-    }while(0)
-#define logsysWarning(name, format, ...)  do{\
-        char* newFormat, * fmtptr = format;char tag[] = "[warning]: ";\
-        if(!fmtptr || !*fmtptr){\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR_E) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR_E);\
-            logsysAdd(name, newFormat, D_F_SRC_E);}\
-        else{\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR) + strlen(fmtptr) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR);strcat(newFormat, fmtptr);\
-            logsysAdd(name, newFormat, D_F_SRC, ##__VA_ARGS__);}\
-        free(newFormat);\
-    }while(0)
-#define logsysInfo(name, format, ...)  do{\
-        char* newFormat, * fmtptr = format;char tag[] = "[info]: ";\
-        if(!fmtptr || !*fmtptr){\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR_E) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR_E);\
-            logsysAdd(name, newFormat, D_F_SRC_E);}\
-        else{\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR) + strlen(fmtptr) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR);strcat(newFormat, fmtptr);\
-            logsysAdd(name, newFormat, D_F_SRC, ##__VA_ARGS__);}\
-        free(newFormat);\
-    }while(0)
+// 调式宏在编译期把 tag 和 D_F_STR 拼接为前缀格式, 用户格式化字串单独传入, 调用时没有堆内存分配
+// 调式宏先用一次原子读检查级别, 若所有日志都不需要该级别, 直接返回, 不会对参数求值
+// 级别高于 LOG_COMPILE_LEVEL 的调式宏展开为空语句, 不生成任何指令
+extern int _logsys_maxlevel;    // 系统日志和所有用户日志中最高的调式信息级别, 只读, 由日志系统维护
+#define _logLevelOn(lv)     ((lv) <= __atomic_load_n(&_logsys_maxlevel, __ATOMIC_RELAXED))
+#define _logDebug(fn, obj, lv, tag, format, ...) \
+        do{ if(_logLevelOn(lv)) fn(obj, lv, tag D_F_STR, D_F_SRC, errno, format, ##__VA_ARGS__); }while(0)
+#define _logStrip(...)      do{}while(0)
+
+#if LOG_COMPILE_LEVEL >= LOG_LV_ERR
+#define logsysErr(name, format, ...)        _logDebug(logsysAddDebug, name, LOG_LV_ERR, "[err]: ", format, ##__VA_ARGS__)
+#else
+#define logsysErr(name, format, ...)        _logStrip()
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LV_WARNING
+#define logsysWarning(name, format, ...)    _logDebug(logsysAddDebug, name, LOG_LV_WARNING, "[warning]: ", format, ##__VA_ARGS__)
+#else
+#define logsysWarning(name, format, ...)    _logStrip()
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LV_INFO
+#define logsysInfo(name, format, ...)       _logDebug(logsysAddDebug, name, LOG_LV_INFO, "[info]: ", format, ##__VA_ARGS__)
+#else
+#define logsysInfo(name, format, ...)       _logStrip()
+#endif
 
 /* ------------------------------- log API ------------------------------------*/
 // 独立输出API, 这部分直接输出到 控制台, 不影响任何日志
@@ -212,6 +526,15 @@ int    logDestroy(constr name);                             // 销毁一个 日
 size_t logFileSize(constr name);                            // 获取日志结构所指文件的大小
 int    logSetFileSize(constr name, size_t size_mb);         // 设置文件大小限制, 单位为 MB
 void   logSetMutetype(constr name, bool mutetype);          // 设置日志结构的 静默 属性
+int    logSetRotate(constr name, int count);                // 设置文件轮转数量, 达到大小上限时重命名为 path.1 ... path.count
+int    logSetRotateTime(constr name, int interval);         // 设置按时间轮转的间隔(秒), 到达时间点时重命名为 path-%Y-%m-%d_%H:%M:%S.out
+int    logSetLevel(constr name, int level);                 // 设置日志的调式信息级别, 运行期间可随时修改
+int    logSetFlush(constr name, int policy, size_t arg);    // 设置 fflush 策略: LOG_FLUSH_LINE / BYTES(字节数) / TIME(毫秒) / MANUAL
+int    logFlush(constr name);                               // 立即 fflush 日志文件, 异步模式下会先等待已入队的记录写入
+int    logSetDedup(constr name, int timeout_ms);            // 设置是否合并连续重复的记录, 为 0 时不合并, 重复超过 timeout_ms 毫秒时也写入摘要行
+int    logSetEngine(constr name, int engine, size_t bufsize); // 设置写入引擎: LOG_IO_STDIO / LOG_IO_DIRECT, LOG_IO_URING(bufsize 为每个缓冲区的大小) / LOG_IO_MMAP(bufsize 为映射窗口大小)
+int    logSetBinary(constr name, bool binary);              // 设置是否使用二进制记录, 文件中只保存格式化字串 id, 时间和参数, 由 logDecode() 还原
+int    logSetBlackBox(constr name, size_t size_mb);         // 设置黑匣子大小, 单位为 MB, 为 0 时关闭, 最近的记录保存在映射的 path.box 中, 进程崩溃后仍可取出
 int    logFlieEmpty(constr name);                           // 清空结构所指日志文件
 
 // 用户日志 操作API
@@ -225,51 +548,168 @@ void logAdd(constr name, constr text, ...);             // 添加 时间 和 tex
 void logAddMute(constr name, constr text, ...);         // 添加 时间 和 text 到 日志中, 强制静默处理
 void logAddNMute(constr name, constr text, ...);        // 添加 时间 和 text 到 日志中, 强制非静默处理
 
+// 用户日志 句柄API, 热点循环中使用, 跳过 name 的 hash 和检测, 日志销毁后句柄自动失效
+LogHandle logOpen(constr name);                             // 获取日志的句柄, 同一日志多次获取返回相同的句柄, 失败返回 0
+void logAddTextH(LogHandle h, constr text, ...);            // 同 logAddText, 通过句柄添加
+void logAddH(LogHandle h, constr text, ...);                // 同 logAdd, 通过句柄添加
+
+// 二进制日志 解码API
+int  logDecode(FILE* in, FILE* out);                    // 把二进制记录还原为文本输出到 out, 二进制段以外的文本原样输出
+
+// 黑匣子 提取API
+int  logBoxExtract(FILE* in, FILE* out);                // 按写入顺序把黑匣子中的记录输出到 out
+
+// 统计API
+int      logStats(constr name, LogStats* st);                   // 获取日志的统计信息
+uint64_t logStatsPercentile(const LogStats* st, double pct);    // 从耗时直方图中读取百分位数(ns), pct 为 0 ~ 100
+
 /* ------------------------- log Debug macros  ------------------------------------*/
 // 自定义调式日志的专用 API, 不要直接使用, 请使用下面的宏函数:L_ERR L_WARNING L_INFO
-void logAddDebug(constr name, constr text, ...);
+void logAddDebug(constr name, int level, constr text, ...);
+void logAddDebugH(LogHandle h, int level, constr text, ...);
 
 /** L_ERR/L_WARNING/L_INFO - 输出自定义调式信息
  * @param name   日志名
  * @param format 格式化字串 若为NULL或空串, 输出系统错误; 否则, 输出自定义信息
  *
 */
-#define logErr(name, format, ...) do{\
-        char* newFormat, * fmtptr = format;char tag[] = "[err]: ";\
-        if(!fmtptr || !*fmtptr){\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR_E) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR_E);\
-            logAddDebug(name, newFormat, D_F_SRC_E);}\
-        else{\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR) + strlen(fmtptr) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR);strcat(newFormat, fmtptr);\
-            logAddDebug(name, newFormat, D_F_SRC, ##__VA_ARGS__);}\
-        free(newFormat);\
-    }while(0)
-#define logWarning(name, format, ...) do{\
-        char* newFormat, * fmtptr = format;char tag[] = "[warming]: ";\
-        if(!fmtptr || !*fmtptr){\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR_E) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR_E);\
-            logAddDebug(name, newFormat, D_F_SRC_E);}\
-        else{\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR) + strlen(fmtptr) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR);strcat(newFormat, fmtptr);\
-            logAddDebug(name, newFormat, D_F_SRC, ##__VA_ARGS__);}\
-        free(newFormat);\
-    }while(0)
-#define logInfo(name, format, ...) do{\
-        char* newFormat, * fmtptr = format;char tag[] = "[info]: ";\
-        if(!fmtptr || !*fmtptr){\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR_E) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR_E);\
-            logAddDebug(name, newFormat, D_F_SRC_E);}\
-        else{\
-            newFormat = calloc(strlen(tag) + strlen(D_F_STR) + strlen(fmtptr) + 1, 1);\
-            strcat(newFormat, tag);strcat(newFormat, D_F_STR);strcat(newFormat, fmtptr);\
-            logAddDebug(name, newFormat, D_F_SRC, ##__VA_ARGS__);}\
-        free(newFormat);\
-    }while(0)
+#if LOG_COMPILE_LEVEL >= LOG_LV_ERR
+#define logErr(name, format, ...)       _logDebug(logAddDebug, name, LOG_LV_ERR, "[err]: ", format, ##__VA_ARGS__)
+#else
+#define logErr(name, format, ...)       _logStrip()
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LV_WARNING
+#define logWarning(name, format, ...)   _logDebug(logAddDebug, name, LOG_LV_WARNING, "[warming]: ", format, ##__VA_ARGS__)
+#else
+#define logWarning(name, format, ...)   _logStrip()
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LV_INFO
+#define logInfo(name, format, ...)      _logDebug(logAddDebug, name, LOG_LV_INFO, "[info]: ", format, ##__VA_ARGS__)
+#else
+#define logInfo(name, format, ...)      _logStrip()
+#endif
+
+/** logErrH/logWarningH/logInfoH - 同 logErr/logWarning/logInfo, 通过句柄输出
+ * @param h      logOpen() 返回的句柄
+ * @param format 格式化字串 若为NULL或空串, 输出系统错误; 否则, 输出自定义信息
+ *
+*/
+#if LOG_COMPILE_LEVEL >= LOG_LV_ERR
+#define logErrH(h, format, ...)         _logDebug(logAddDebugH, h, LOG_LV_ERR, "[err]: ", format, ##__VA_ARGS__)
+#else
+#define logErrH(h, format, ...)         _logStrip()
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LV_WARNING
+#define logWarningH(h, format, ...)     _logDebug(logAddDebugH, h, LOG_LV_WARNING, "[warming]: ", format, ##__VA_ARGS__)
+#else
+#define logWarningH(h, format, ...)     _logStrip()
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LV_INFO
+#define logInfoH(h, format, ...)        _logDebug(logAddDebugH, h, LOG_LV_INFO, "[info]: ", format, ##__VA_ARGS__)
+#else
+#define logInfoH(h, format, ...)        _logStrip()
+#endif
+
+/* ------------------------- rate limit & sampling macros  ------------------------------------*/
+// 每个调用点有自己的 static 状态, 过滤检查只需一次原子操作, 被过滤的调用不会对参数求值
+// 被抑制的条数在下一条输出之前以 "N similar messages suppressed" 单独输出一行
+// 限速的调用点第一次输出时加入系统的调用点链表, 窗口结束后仍没有调用时由定时线程报告被抑制的条数
+typedef struct _logSite {
+    uint64_t count;         // 调用次数; 限速时高 32 位为当前窗口的秒数, 低 32 位为窗口内的调用次数
+    uint64_t last;          // 上一次输出时的调用次数, 只在输出时访问
+    uint32_t limit;         // 限速时每秒最多输出的次数, 窗口切换时设置, 为 0 表示不限速
+    bool     linked;        // 是否已加入调用点链表, 以下成员在加入之前设置, 之后只读
+    int      level;
+    int      line;
+    char*    name;
+    const char* text;       // 宏拼接好的前缀格式, 同 logAddDebug
+    const char* file;
+    const char* func;
+    struct _logSite* next;
+} _logSite;
+void _logSiteLink(_logSite* s, const char* name, int level, const char* text, const char* file, int line, const char* func);  // 把限速的调用点加入链表
+
+/* 本次输出, 返回上一次输出之后的调用次数(含本次), 即被抑制的条数 + 1 */
+static inline uint64_t _logSitePass(_logSite* s, uint64_t c)
+{
+    uint64_t prev = __atomic_exchange_n(&s->last, c + 1, __ATOMIC_RELAXED);
+    return c + 1 > prev ? c + 1 - prev : 1;
+}
+/* 每 n 次调用输出一次(第 1, n+1, 2n+1 ... 次), 返回 0 表示本次被抑制 */
+static inline uint64_t _logSiteEvery(_logSite* s, uint64_t n)
+{
+    uint64_t c = __atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+    return n > 1 && c % n ? 0 : _logSitePass(s, c);
+}
+/* 按概率 p 输出, 由调用序号和调用点地址混合得到伪随机数, 没有线程局部状态 */
+static inline uint64_t _logSiteSample(_logSite* s, double p)
+{
+    uint64_t c = __atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED), x = c + (uintptr_t)s;
+
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;    // splitmix64
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (double)(x >> 11) * 0x1.0p-53 < p ? _logSitePass(s, c) : 0;
+}
+/* 每秒最多输出 limit 次, 窗口切换时由替换成功的线程报告上一个窗口被抑制的条数, 替换失败时重试, 本次计入新窗口
+ * 定时线程先报告时把上一个窗口的次数改为 limit, 这里不再重复报告 */
+static inline uint64_t _logSiteRate(_logSite* s, uint32_t limit)
+{
+    uint64_t now = (uint32_t)time(NULL), v = __atomic_load_n(&s->count, __ATOMIC_RELAXED), nv;
+
+    do
+        nv = v >> 32 == now ? v + 1 : now << 32 | 1;
+    while(!__atomic_compare_exchange_n(&s->count, &v, nv, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    if(v >> 32 == now)  return (uint32_t)nv <= limit;
+    if(__atomic_load_n(&s->limit, __ATOMIC_RELAXED) != limit)   __atomic_store_n(&s->limit, limit, __ATOMIC_RELAXED);
+    return (uint32_t)v > limit ? (uint32_t)v - limit + 1 : 1;
+}
+
+#define _logDebugSite(fn, obj, lv, tag, check, format, ...) \
+        do{ static _logSite _log_site; uint64_t _log_pass; int _log_errno;                                       \
+            if(_logLevelOn(lv) && (_log_pass = check)){                                                          \
+                _log_errno = errno;                                                                              \
+                if(__atomic_load_n(&_log_site.limit, __ATOMIC_RELAXED) && !__atomic_load_n(&_log_site.linked, __ATOMIC_ACQUIRE)) \
+                    _logSiteLink(&_log_site, obj, lv, tag D_F_STR, D_F_SRC);                                     \
+                if(_log_pass > 1)                                                                                \
+                    fn(obj, lv, tag D_F_STR, D_F_SRC, _log_errno, "%llu similar messages suppressed\n", (unsigned long long)(_log_pass - 1)); \
+                fn(obj, lv, tag D_F_STR, D_F_SRC, _log_errno, format, ##__VA_ARGS__);                            \
+            } }while(0)
+
+/** logErrEvery/logErrRateLimited/logErrSampled ... - 同 logErr/logWarning/logInfo, 按调用点过滤
+ * @param n          Every:       每 n 次调用输出一次
+ * @param per_second RateLimited: 每秒最多输出的次数, 按自然秒划分窗口
+ * @param p          Sampled:     输出的概率, 0 ~ 1
+ * @note  被抑制的条数在该调用点下一次输出时报告; Every/Sampled 之后不再有输出时不会报告,
+ *        RateLimited 的窗口结束后由定时线程报告, 报告写入该调用点第一次输出时的日志
+*/
+#if LOG_COMPILE_LEVEL >= LOG_LV_ERR
+#define logErrEvery(name, n, format, ...)                   _logDebugSite(logAddDebug, name, LOG_LV_ERR, "[err]: ", _logSiteEvery(&_log_site, n), format, ##__VA_ARGS__)
+#define logErrRateLimited(name, per_second, format, ...)    _logDebugSite(logAddDebug, name, LOG_LV_ERR, "[err]: ", _logSiteRate(&_log_site, per_second), format, ##__VA_ARGS__)
+#define logErrSampled(name, p, format, ...)                 _logDebugSite(logAddDebug, name, LOG_LV_ERR, "[err]: ", _logSiteSample(&_log_site, p), format, ##__VA_ARGS__)
+#else
+#define logErrEvery(name, n, format, ...)                   _logStrip()
+#define logErrRateLimited(name, per_second, format, ...)    _logStrip()
+#define logErrSampled(name, p, format, ...)                 _logStrip()
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LV_WARNING
+#define logWarningEvery(name, n, format, ...)               _logDebugSite(logAddDebug, name, LOG_LV_WARNING, "[warming]: ", _logSiteEvery(&_log_site, n), format, ##__VA_ARGS__)
+#define logWarningRateLimited(name, per_second, format, ...) _logDebugSite(logAddDebug, name, LOG_LV_WARNING, "[warming]: ", _logSiteRate(&_log_site, per_second), format, ##__VA_ARGS__)
+#define logWarningSampled(name, p, format, ...)             _logDebugSite(logAddDebug, name, LOG_LV_WARNING, "[warming]: ", _logSiteSample(&_log_site, p), format, ##__VA_ARGS__)
+#else
+#define logWarningEvery(name, n, format, ...)               _logStrip()
+#define logWarningRateLimited(name, per_second, format, ...) _logStrip()
+#define logWarningSampled(name, p, format, ...)             _logStrip()
+#endif
+#if LOG_COMPILE_LEVEL >= LOG_LV_INFO
+#define logInfoEvery(name, n, format, ...)                  _logDebugSite(logAddDebug, name, LOG_LV_INFO, "[info]: ", _logSiteEvery(&_log_site, n), format, ##__VA_ARGS__)
+#define logInfoRateLimited(name, per_second, format, ...)   _logDebugSite(logAddDebug, name, LOG_LV_INFO, "[info]: ", _logSiteRate(&_log_site, per_second), format, ##__VA_ARGS__)
+#define logInfoSampled(name, p, format, ...)                _logDebugSite(logAddDebug, name, LOG_LV_INFO, "[info]: ", _logSiteSample(&_log_site, p), format, ##__VA_ARGS__)
+#else
+#define logInfoEvery(name, n, format, ...)                  _logStrip()
+#define logInfoRateLimited(name, per_second, format, ...)   _logStrip()
+#define logInfoSampled(name, p, format, ...)                _logStrip()
+#endif
 
 
 /* ------------------------------- Test Function ------------------------------------*/
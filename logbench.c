@@ -0,0 +1,192 @@
+#include "log.h"
+
+/*  日志系统性能测试: 测量不同 线程数, 消息大小, 静默属性, 日志数量 和 fflush 策略 下的吞吐量和单次调用耗时
+ *
+ *  用法: logbench [-t 最大线程数] [-n 每个线程的写入次数] [-a] [-c] [-o 报告文件]
+ *      -t  线程数从 1 开始按 2 的幂递增, 直到该值(默认为 CPU 核心数), 最后一档总是该值
+ *      -n  每个线程的写入次数, 默认 20000
+ *      -a  使用异步模式(logsysSetAsync)
+ *      -c  使用异步控制台输出(logsysSetConsoleAsync)
+ *      -o  报告输出到文件, 默认输出到标准输出
+ *
+ *  报告为 JSON Lines: 第一行为测试环境, 之后每行一个测试结果, 便于不同版本之间比较
+ *  单次调用耗时来自日志系统自己的耗时直方图(logsysStats), 非静默模式下控制台输出被重定向到 /dev/null
+ */
+
+#define BENCH_MAX_THREADS   256
+#define BENCH_MAX_LOGS      4
+
+static const int    _sizes[]  = {16, 128, 1024};           // 消息大小(不含时间前缀)
+static const int    _nlogs[]  = {1, BENCH_MAX_LOGS};        // 日志数量
+static const bool   _mutes[]  = {MUTE, NMUTE};
+static const struct {int policy; size_t arg; constr name;} _flushes[] = {
+    {LOG_FLUSH_LINE,   0,        "line"},
+    {LOG_FLUSH_BYTES,  64 << 10, "bytes"},
+    {LOG_FLUSH_TIME,   10,       "time"},
+    {LOG_FLUSH_MANUAL, 0,        "manual"},
+};
+#define BENCH_COUNT(a)      (int)(sizeof(a) / sizeof((a)[0]))
+
+typedef struct _benchRun {
+    int  threads;
+    int  size;
+    int  nlogs;
+    bool mute;
+    int  flush;
+    long lines;                     // 每个线程的写入次数
+    char msg[1024 + 1];
+    uint64_t begin;                 // 最早开始写入的线程的开始时间(ns), 由各写线程记录, 避免单核时主线程晚于写线程开始计时
+    pthread_barrier_t start;
+} _benchRun;
+
+static constr _logNames[BENCH_MAX_LOGS] = {"bench0", "bench1", "bench2", "bench3"};
+
+static uint64_t _benchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* _benchFunc(void* data)
+{
+    _benchRun* run = data;
+    uint64_t now, begin;
+    long i;
+
+    pthread_barrier_wait(&run->start);
+    now   = _benchNow();
+    begin = __atomic_load_n(&run->begin, __ATOMIC_RELAXED);
+    while(now < begin && !__atomic_compare_exchange_n(&run->begin, &begin, now, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    for(i = 0; i < run->lines; i++)
+        logAdd(_logNames[i % run->nlogs], "%s\n", run->msg);
+    return NULL;
+}
+
+/**
+ * @brief _benchOne - 执行一次测试, 并输出一行结果
+ */
+static int _benchOne(FILE* out, _benchRun* run, bool async, bool console_async)
+{
+    pthread_t pthreads[BENCH_MAX_THREADS];
+    char path[64];
+    LogStats st;
+    double secs;
+    int i, console = -1, null;
+
+    logsysRelease();
+    logsysInit();
+    logsysSetAsync(async);
+    logsysSetConsoleAsync(console_async);
+    for(i = 0; i < run->nlogs; i++)
+    {
+        snprintf(path, sizeof(path), "./logs/bench/%s.out", _logNames[i]);
+        logCreate(_logNames[i], path, run->mute);
+        logFlieEmpty(_logNames[i]);
+        logSetFlush(_logNames[i], _flushes[run->flush].policy, _flushes[run->flush].arg);
+    }
+    memset(run->msg, 'x', run->size - 1);
+    run->msg[run->size - 1] = '\0';
+
+    /* 非静默时控制台输出到 /dev/null, 只测量格式化和加锁的开销 */
+    if(!run->mute && (null = open("/dev/null", O_WRONLY)) >= 0)
+    {
+        fflush(stderr);
+        console = dup(STDERR_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+    }
+
+    run->begin = UINT64_MAX;
+    pthread_barrier_init(&run->start, NULL, run->threads + 1);
+    for(i = 0; i < run->threads; i++)
+        pthread_create(&pthreads[i], NULL, _benchFunc, run);
+    pthread_barrier_wait(&run->start);
+    for(i = 0; i < run->threads; i++)
+        pthread_join(pthreads[i], NULL);
+    for(i = 0; i < run->nlogs; i++)
+        logFlush(_logNames[i]);     // 吞吐量包含写出剩余内容的时间
+    secs = (_benchNow() - run->begin) / 1e9;
+    pthread_barrier_destroy(&run->start);
+
+    logsysStats(&st);
+    logsysRelease();                // 异步控制台输出在这里写完, 之后才还原 stderr
+
+    if(console >= 0)
+    {
+        fflush(stderr);
+        dup2(console, STDERR_FILENO);
+        close(console);
+    }
+
+    fprintf(out, "{\"threads\":%d,\"size\":%d,\"logs\":%d,\"mute\":%s,\"flush\":\"%s\",\"async\":%s,\"console_async\":%s,"
+                 "\"lines\":%ld,\"secs\":%.6f,\"lines_per_sec\":%.0f,"
+                 "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+                 "\"lockwait_us\":%llu,\"consolewait_us\":%llu,\"dropped\":%llu}\n",
+            run->threads, run->size, run->nlogs, run->mute ? "true" : "false", _flushes[run->flush].name, async ? "true" : "false", console_async ? "true" : "false",
+            run->lines * run->threads, secs, run->lines * run->threads / secs,
+            (unsigned long long)logStatsPercentile(&st, 50), (unsigned long long)logStatsPercentile(&st, 99),
+            (unsigned long long)logStatsPercentile(&st, 99.9),
+            (unsigned long long)st.lockwait / 1000, (unsigned long long)st.consolewait / 1000, (unsigned long long)st.dropped);
+    fflush(out);
+    return LOG_OK;
+}
+
+int main(int argc, char* argv[])
+{
+    int maxthreads = (int)sysconf(_SC_NPROCESSORS_ONLN), threads, s, l, m, f, c;
+    long lines = 20000;
+    bool async = false, console_async = false;
+    FILE* out = stdout;
+    _benchRun run;
+
+    while(-1 != (c = getopt(argc, argv, "t:n:aco:h")))
+    {
+        switch(c)
+        {
+            case 't': maxthreads = atoi(optarg);    break;
+            case 'n': lines = atol(optarg);         break;
+            case 'a': async = true;                 break;
+            case 'c': console_async = true;         break;
+            case 'o':
+                if(!(out = fopen(optarg, "w")))
+                {
+                    fprintf(stderr, "logbench: open %s failed: %s\n", optarg, strerror(errno));
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-t max threads] [-n lines per thread] [-a] [-c] [-o report]\n", argv[0]);
+                return 'h' == c ? 0 : 1;
+        }
+    }
+    if(maxthreads < 1)                  maxthreads = 1;
+    if(maxthreads > BENCH_MAX_THREADS)  maxthreads = BENCH_MAX_THREADS;
+    if(lines < 1)                       lines = 1;
+
+    /* 测试环境 */
+    fprintf(out, "{\"bench\":\"logV2\",\"cores\":%ld,\"max_threads\":%d,\"lines_per_thread\":%ld,\"async\":%s,\"console_async\":%s,\"time\":%ld}\n",
+            sysconf(_SC_NPROCESSORS_ONLN), maxthreads, lines, async ? "true" : "false", console_async ? "true" : "false", (long)time(NULL));
+
+    bzero(&run, sizeof(run));
+    run.lines = lines;
+    for(threads = 1; ; threads = threads * 2 < maxthreads ? threads * 2 : maxthreads)
+    {
+        for(s = 0; s < BENCH_COUNT(_sizes); s++)
+            for(l = 0; l < BENCH_COUNT(_nlogs); l++)
+                for(m = 0; m < BENCH_COUNT(_mutes); m++)
+                    for(f = 0; f < BENCH_COUNT(_flushes); f++)
+                    {
+                        run.threads = threads;
+                        run.size    = _sizes[s];
+                        run.nlogs   = _nlogs[l];
+                        run.mute    = _mutes[m];
+                        run.flush   = f;
+                        _benchOne(out, &run, async, console_async);
+                    }
+        if(threads == maxthreads)   break;
+    }
+
+    if(out != stdout)   fclose(out);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include "log.h"
+
+/* 黑匣子提取工具: logbox [file ...], 按写入顺序把黑匣子(logSetBlackBox) 中的记录输出到标准输出, 无参数时从标准输入读取 */
+int main(int argc, char* argv[])
+{
+    FILE* fp;
+    int i, ret = 0;
+
+    if(argc < 2)
+        return LOG_OK == logBoxExtract(stdin, stdout) ? 0 : 1;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(!(fp = fopen(argv[i], "r")))
+        {
+            fprintf(stderr, "logbox: open %s failed: %s\n", argv[i], strerror(errno));
+            ret = 1;
+            continue;
+        }
+        if(LOG_OK != logBoxExtract(fp, stdout))
+        {
+            fprintf(stderr, "logbox: %s: not a black box file\n", argv[i]);
+            ret = 1;
+        }
+        fclose(fp);
+    }
+
+    return ret;
+}
@@ -0,0 +1,13 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += logbox.c \
+    log.c
+
+HEADERS += \
+    log.h
+
+LIBS += \
+    -lpthread
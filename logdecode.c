@@ -0,0 +1,29 @@
+#include "log.h"
+
+/* 二进制日志解码工具: logdecode [file ...], 无参数时从标准输入读取, 文本输出到标准输出 */
+int main(int argc, char* argv[])
+{
+    FILE* fp;
+    int i, ret = 0;
+
+    if(argc < 2)
+        return LOG_OK == logDecode(stdin, stdout) ? 0 : 1;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(!(fp = fopen(argv[i], "r")))
+        {
+            fprintf(stderr, "logdecode: open %s failed: %s\n", argv[i], strerror(errno));
+            ret = 1;
+            continue;
+        }
+        if(LOG_OK != logDecode(fp, stdout))
+        {
+            fprintf(stderr, "logdecode: %s: corrupted binary record\n", argv[i]);
+            ret = 1;
+        }
+        fclose(fp);
+    }
+
+    return ret;
+}
@@ -1,5 +1,7 @@
 #include "logtest.h"
 
+static int _grepLines(constr path, constr str);     // 统计文件中含有 str 的行数
+
 void logTest()
 {
     logShow("------- logShowAPI test ------\n");
@@ -229,6 +231,1211 @@ void mutexTest()
     logsysRelease();
 }
 
+static void* _toggleFunc(void* data)
+{
+    int i;
+    for(i = 0; i < 5000; i++)
+        logAdd("togglelog", "toggle %d\n", i);
+    return data;
+}
+
+/* 异步模式测试 */
+void asyncTest()
+{
+    logShow("异步模式测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+    logsysSetAsync(true);       // 开启异步模式, 以下日志由后台线程写入
+
+    logCreate("pthreadlog1", "./logs/asynclog1.out", MUTE);
+    logCreate("pthreadlog2", "./logs/asynclog2.out", MUTE);
+
+    logFlieEmpty("pthreadlog1");
+    logFlieEmpty("pthreadlog2");
+
+    pthread_t pthread11;
+    pthread_t pthread12;
+    pthread_t pthread21;
+    pthread_t pthread22;
+
+    pthread_create(&pthread11, NULL, pthreadFunc11, NULL);
+    pthread_create(&pthread12, NULL, pthreadFunc12, NULL);
+    pthread_create(&pthread21, NULL, pthreadFunc21, NULL);
+    pthread_create(&pthread22, NULL, pthreadFunc22, NULL);
+
+    pthread_join(pthread11, (void**)0);
+    pthread_join(pthread12, (void**)0);
+    pthread_join(pthread21, (void**)0);
+    pthread_join(pthread22, (void**)0);
+
+    logDestroy("pthreadlog1");  // 销毁前会等待队列中该日志的记录写完
+
+    logsysSetAsync(false);      // 还原为同步模式, 程序运行期间一直有效
+
+    /* 写入期间反复切换异步模式, 记录不会丢失(队列满时的丢弃除外), 也不会访问已释放的队列 */
+    pthread_t togglers[4];
+    LogStats st;
+    int i, lines;
+
+    logCreate("togglelog", "./logs/togglelog.out", MUTE);
+    logFlieEmpty("togglelog");
+    for(i = 0; i < 4; i++)
+        pthread_create(&togglers[i], NULL, _toggleFunc, NULL);
+    for(i = 0; i < 200; i++)
+        logsysSetAsync(i % 2 == 0);
+    for(i = 0; i < 4; i++)
+        pthread_join(togglers[i], NULL);
+    logsysSetAsync(false);
+    logStats("togglelog", &st);
+    if(20000 != (lines = _grepLines("./logs/togglelog.out", "toggle ")) + (int)st.dropped)
+        logShow("logsysSetAsync err: %d lines written, %d dropped of 20000 while toggling\n", lines, (int)st.dropped);
+
+    logsysRelease();            // 停止服务前, 队列中剩余的记录都会写入文件
+}
+
+/* 文件轮转测试 */
+void rotateTest()
+{
+    int i;
+    char line[128];
+
+    logShow("按大小轮转测试: 应生成 ./logs/rotatelog.out 和 ./logs/rotatelog.out.1 ~ ./logs/rotatelog.out.3\n");
+
+    logsysRelease();
+    logsysInit();
+
+    logCreate("rotatelog", "./logs/rotatelog.out", MUTE);
+    logFlieEmpty("rotatelog");
+    logSetFileSize("rotatelog", 1);     // 1 MB
+    logSetRotate("rotatelog", 3);       // 保留 3 个旧文件
+    logSetRotate("rotatelog", -1);      // 错误, 数量不合法
+
+    memset(line, 'r', sizeof(line) - 2);
+    line[sizeof(line) - 2] = '\n';
+    line[sizeof(line) - 1] = '\0';
+    for(i = 0; i < 50000; i++)          // 约 6 MB, 轮转 5 次
+        logAddText("rotatelog", line);
+
+    logShow("rotatelog.out 大小: %u \n", logFileSize("rotatelog"));
+
+    logShow("按时间轮转测试: 应生成 ./logs/rotatetimelog.out-%%Y-%%m-%%d_%%H:%%M:%%S.out\n");
+    logCreate("rotatetimelog", "./logs/rotatetimelog.out", MUTE);
+    logSetRotateTime("rotatetimelog", 1);   // 每秒轮转
+    logAdd("rotatetimelog", "before rotate\n");
+    sleep(2);
+    logAdd("rotatetimelog", "after rotate\n");
+
+    logsysRelease();
+}
+
+/* 句柄API测试 */
+void handleTest()
+{
+    LogHandle h1, h2;
+
+    logShow("句柄API测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+
+    logCreate("handlelog", "./logs/handlelog.out", MUTE);
+    h1 = logOpen("handlelog");
+    h2 = logOpen("handlelog");          // 同一日志返回相同的句柄
+    if(!h1 || h1 != h2)
+        logShow("logOpen err: %llx %llx\n", (unsigned long long)h1, (unsigned long long)h2);
+    logOpen("000");                     // 错误, 日志不存在, 返回 0, 记录到系统日志中
+
+    logAddH(h1, "Hello handle, argtest: %d\n", 1);
+    logAddTextH(h1, "Hello handle text\n");
+    logErrH(h1, NULL);
+    logInfoH(h1, "%s", "logInfoHtest\n");
+
+    logDestroy("handlelog");            // 销毁后旧句柄失效
+    logAddH(h1, "should not be added\n");
+    logErrH(h1, "%s", "should not be added\n");
+
+    logCreate("handlelog", "./logs/handlelog.out", MUTE);
+    h2 = logOpen("handlelog");          // 重新创建后, 即使复用了相同的槽位, 新旧句柄也不相同
+    if(h1 == h2)
+        logShow("logOpen err: stale handle %llx reused\n", (unsigned long long)h1);
+    logAddH(h1, "should not be added\n");
+    logAddH(h2, "Hello new handle\n");
+
+    logsysRelease();
+}
+
+static int _levelArgCount = 0;
+static int _levelArg()
+{
+    return ++_levelArgCount;
+}
+
+void levelTest()
+{
+    logShow("调式级别测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+
+    logCreate("levellog", "./logs/levellog.out", MUTE);
+    logSetLevel("levellog", LOG_LV_WARNING);
+    logErr("levellog", "%s", "logErr should be added\n");
+    logWarning("levellog", "%s", "logWarning should be added\n");
+    logInfo("levellog", "%s", "logInfo should not be added\n");
+    logSetLevel("levellog", 10);        // 错误, 级别不合法, 记录到系统日志中
+
+    /* 所有日志都关闭了该级别时, 宏不会对参数求值 */
+    logsysSetLevel(LOG_LV_WARNING);
+    logInfo("levellog", "should not be added %d\n", _levelArg());
+    if(_levelArgCount)
+        logShow("logInfo err: argument evaluated while level is off\n");
+
+    logSetLevel("levellog", LOG_LV_INFO);
+    logInfo("levellog", "logInfo should be added %d\n", _levelArg());
+#if LOG_COMPILE_LEVEL >= LOG_LV_INFO
+    if(1 != _levelArgCount)
+        logShow("logInfo err: argument not evaluated while level is on\n");
+#else
+    (void)_levelArg;
+    if(_levelArgCount)                  // 编译期已去除, 参数不会出现在编译结果中
+        logShow("logInfo err: argument evaluated while stripped at compile time\n");
+#endif
+
+    logsysSetLevel(DF_LOGSYS_LEVEL);
+    logsysRelease();
+}
+
+static off_t _diskSize(constr path)
+{
+    struct stat st;
+    return stat(path, &st) ? -1 : st.st_size;
+}
+
+/* 当前进程的线程数 */
+static int _threadCount()
+{
+    char line[256];
+    int n = -1;
+    FILE* fp;
+
+    if(!(fp = fopen("/proc/self/status", "r")))  return -1;
+    while(fgets(line, sizeof(line), fp))
+        if(1 == sscanf(line, "Threads: %d", &n))    break;
+    fclose(fp);
+    return n;
+}
+
+void flushTest()
+{
+    off_t size;
+    int i, threads;
+
+    logShow("fflush 策略测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+
+    /* 日志不存在时失败, 不启动定时线程 */
+    threads = _threadCount();
+    if(LOG_ERR != logSetFlush("noflushlog", LOG_FLUSH_TIME, 20) || threads != _threadCount())
+        logShow("logSetFlush err: flush ticker started for a missing log\n");
+
+    /* 每 N 字节 */
+    logCreate("flushlog", "./logs/flushlog.out", MUTE);
+    logFlieEmpty("flushlog");
+    logSetFlush("flushlog", LOG_FLUSH_BYTES, 1 << 10);
+    logAdd("flushlog", "LOG_FLUSH_BYTES line\n");
+    if(0 != _diskSize("./logs/flushlog.out"))
+        logShow("LOG_FLUSH_BYTES err: flushed before %d bytes\n", 1 << 10);
+    logFlush("flushlog");
+    if(0 == (size = _diskSize("./logs/flushlog.out")))
+        logShow("logFlush err: nothing written\n");
+
+    /* 只在 logErr 或 logFlush() 时 */
+    logSetFlush("flushlog", LOG_FLUSH_MANUAL, 0);
+    logAdd("flushlog", "LOG_FLUSH_MANUAL line\n");
+    if(size != _diskSize("./logs/flushlog.out"))
+        logShow("LOG_FLUSH_MANUAL err: flushed without logErr\n");
+    logErr("flushlog", "%s", "LOG_FLUSH_MANUAL err line\n");
+    if(size == _diskSize("./logs/flushlog.out"))
+        logShow("LOG_FLUSH_MANUAL err: logErr not flushed\n");
+    size = _diskSize("./logs/flushlog.out");
+
+    /* 异步模式下 logErr 不等待队列, 由写线程写入这条记录后写出 */
+    logsysSetAsync(true);
+    logErr("flushlog", "%s", "LOG_FLUSH_MANUAL async err line\n");
+    for(i = 0; i < 100 && size == _diskSize("./logs/flushlog.out"); i++)
+        usleep(10 * 1000);
+    if(size == _diskSize("./logs/flushlog.out"))
+        logShow("LOG_FLUSH_MANUAL err: async logErr not flushed by writer\n");
+    logsysSetAsync(false);
+    size = _diskSize("./logs/flushlog.out");
+
+    /* 每 N 毫秒 */
+    logSetFlush("flushlog", LOG_FLUSH_TIME, 20);
+    logAdd("flushlog", "LOG_FLUSH_TIME line\n");
+    usleep(200 * 1000);
+    if(size == _diskSize("./logs/flushlog.out"))
+        logShow("LOG_FLUSH_TIME err: not flushed by ticker\n");
+
+    logSetFlush("flushlog", LOG_FLUSH_BYTES, 0);    // 错误, 参数不合法, 记录到系统日志中
+
+    logsysRelease();
+}
+
+void* directFunc(void* data)
+{
+    int i = 0;
+    for(i = 0; i < 1000; i++)
+        logAdd("directlog", "directFunc %d\n", i);
+    return data;
+}
+
+void directTest()
+{
+    pthread_t pthreads[4];
+    char line[4096], big[3000];
+    int i, lines = 0, broken = 0;
+    FILE* fp;
+
+    logShow("直接写入引擎测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+
+    logCreate("directlog", "./logs/directlog.out", MUTE);
+    logFlieEmpty("directlog");
+    logSetEngine("directlog", LOG_IO_DIRECT, MIN_LOG_BUFSIZE);  // 使用最小的缓冲区, 让双缓冲区频繁交换
+    logSetFlush("directlog", LOG_FLUSH_MANUAL, 0);
+    logSetEngine("directlog", LOG_IO_DIRECT, 10);               // 错误, 缓冲区太小, 记录到系统日志中
+
+    for(i = 0; i < 4; i++)
+        pthread_create(&pthreads[i], NULL, directFunc, NULL);
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    logAdd("directlog", "%s\n", big);                           // 比整个缓冲区还大的记录
+    for(i = 0; i < 4; i++)
+        pthread_join(pthreads[i], (void**)0);
+    logFlush("directlog");
+
+    /* 每一行都应完整, 不应被其他记录打断 */
+    if((fp = fopen("./logs/directlog.out", "r")))
+    {
+        while(fgets(line, sizeof(line), fp))
+        {
+            lines++;
+            if('[' != line[0] || (!strstr(line, "] directFunc ") && !strstr(line, "] xxx")))  broken++;
+        }
+        fclose(fp);
+    }
+    if(4001 != lines || broken)
+        logShow("LOG_IO_DIRECT err: %d lines, %d broken\n", lines, broken);
+
+    logsysRelease();
+}
+
+void* mmapFunc(void* data)
+{
+    int i = 0;
+    for(i = 0; i < 1000; i++)
+        logAdd("mmaplog", "mmapFunc %d\n", i);
+    return data;
+}
+
+/* 检查文件的每一行是否完整, 返回行数, 有 '\0' 或最后一行不完整时返回 -1 */
+static int _checkLines(constr path)
+{
+    int c, last = '\n', lines = 0;
+    FILE* fp;
+
+    if(!(fp = fopen(path, "r")))    return -1;
+    while(EOF != (c = fgetc(fp)))
+    {
+        if('\0' == c)  {lines = -1; break;}
+        if('\n' == c)  lines++;
+        last = c;
+    }
+    fclose(fp);
+    return '\n' == last ? lines : -1;
+}
+
+void mmapTest()
+{
+    pthread_t pthreads[4];
+    int i, lines, status;
+    pid_t pid;
+
+    logShow("mmap 写入引擎测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+
+    logCreate("mmaplog", "./logs/mmaplog.out", MUTE);
+    logFlieEmpty("mmaplog");
+    logSetEngine("mmaplog", LOG_IO_MMAP, MIN_LOG_BUFSIZE);  // 使用最小的窗口, 让窗口频繁推进
+    for(i = 0; i < 4; i++)
+        pthread_create(&pthreads[i], NULL, mmapFunc, NULL);
+    for(i = 0; i < 4; i++)
+        pthread_join(pthreads[i], (void**)0);
+
+    /* 切换引擎时截断到实际长度 */
+    logSetEngine("mmaplog", LOG_IO_STDIO, 0);
+    if(4000 != (lines = _checkLines("./logs/mmaplog.out")))
+        logShow("LOG_IO_MMAP err: %d lines after switching engine\n", lines);
+
+    /* 和按大小轮转共存, 轮转时旧文件截断到实际长度 */
+    logFlieEmpty("mmaplog");
+    logSetEngine("mmaplog", LOG_IO_MMAP, 0);
+    logSetFileSize("mmaplog", 1);
+    logSetRotate("mmaplog", 1);
+    for(i = 0; i < 40000; i++)
+        logAdd("mmaplog", "mmap rotate test %d\n", i);
+    if(_checkLines("./logs/mmaplog.out.1") <= 0)
+        logShow("LOG_IO_MMAP err: rotated file is not truncated\n");
+
+    logsysRelease();
+    if(_checkLines("./logs/mmaplog.out") <= 0)
+        logShow("LOG_IO_MMAP err: file is not truncated after release\n");
+
+    /* 进程崩溃时文件没有截断, 重新映射时截掉残留的预分配部分, 新记录紧接在原有内容之后 */
+    logsysInit();
+    logCreate("crashlog", "./logs/crashlog.out", MUTE);
+    logFlieEmpty("crashlog");
+    if(0 == (pid = fork()))
+    {
+        logSetEngine("crashlog", LOG_IO_MMAP, 0);
+        logAdd("crashlog", "before crash\n");
+        _exit(0);
+    }
+    if(pid > 0)
+        waitpid(pid, &status, 0);
+    logSetEngine("crashlog", LOG_IO_MMAP, 0);
+    logAdd("crashlog", "after\n");
+    logsysRelease();
+    if(pid <= 0 || 2 != _checkLines("./logs/crashlog.out") || 1 != _grepLines("./logs/crashlog.out", "before crash") || 1 != _grepLines("./logs/crashlog.out", "after"))
+        logShow("LOG_IO_MMAP err: preallocated space left by a crash is not truncated\n");
+}
+
+void* uringFunc(void* data)
+{
+    int i = 0;
+    for(i = 0; i < 1000; i++)
+        logAdd((constr)data, "uringFunc %d\n", i);
+    return data;
+}
+
+void uringTest()
+{
+    pthread_t pthreads[4];
+    constr names[2] = {"uringlog1", "uringlog2"}, paths[2] = {"./logs/uringlog1.out", "./logs/uringlog2.out"};
+    int i, lines;
+
+    logShow("io_uring 写入引擎测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+
+    for(i = 0; i < 2; i++)
+    {
+        logCreate(names[i], paths[i], MUTE);
+        logFlieEmpty(names[i]);
+        logSetEngine(names[i], LOG_IO_URING, MIN_LOG_BUFSIZE);  // 使用最小的缓冲区, 让缓冲区频繁提交
+    }
+    logSetFlush("uringlog2", LOG_FLUSH_MANUAL, 0);
+    logsysSetAsync(true);       // 写线程每批次一次提交两个日志的缓冲区
+    for(i = 0; i < 4; i++)
+        pthread_create(&pthreads[i], NULL, uringFunc, (void*)names[i % 2]);
+    for(i = 0; i < 4; i++)
+        pthread_join(pthreads[i], (void**)0);
+
+    /* 同步模式下由调用线程提交 */
+    logsysSetAsync(false);
+    for(i = 0; i < 2; i++)
+    {
+        logAdd(names[i], "uringFunc sync\n");
+        logFlush(names[i]);
+        if(2001 != (lines = _checkLines(paths[i])))
+            logShow("LOG_IO_URING err: %d lines in %s\n", lines, paths[i]);
+    }
+
+    logsysRelease();
+}
+/* 去掉行首的时间前缀 */
+static char* _lineBody(char* line)
+{
+    char* p;
+    while('[' == line[0] && '2' == line[1] && (p = strstr(line, "] ")))
+        line = p + 2;
+    return line;
+}
+
+/* 文件的原始字节中是否含有 str */
+static bool _binHas(constr path, constr str)
+{
+    static char buf[1 << 20];
+    size_t n, i, len = strlen(str);
+    FILE* fp;
+
+    if(!(fp = fopen(path, "rb")))   return false;
+    n = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    for(i = 0; i + len <= n; i++)
+        if(!memcmp(buf + i, str, len))  return true;
+    return false;
+}
+
+#define _binBoth(fn, ...)   do{ fn("textlog", __VA_ARGS__); fn("binlog", __VA_ARGS__); }while(0)
+void binaryTest()
+{
+    char stack[64], big[2000], line[2][4096];
+    FILE* fp[2];
+    int i, lines = 0, diff = 0, status;
+    pid_t pid;
+
+    logShow("二进制记录测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+
+    logCreate("textlog", "./logs/textlog.out", MUTE);
+    logCreate("binlog", "./logs/binlog.out", MUTE);
+    logFlieEmpty("textlog");
+    logFlieEmpty("binlog");
+    logSetBinary("binlog", true);
+    memset(big, 'y', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    /* 同步和异步模式下各写一遍, 解码结果应和文本日志相同 */
+    for(i = 0; i < 2; i++)
+    {
+        logsysSetAsync(1 == i);
+        _binBoth(logAdd, "int %d %i %5d %-5d| %05d %+d %x %X %#o %u %hhd %hd\n", 1, -2, 3, 4, 5, 6, 255, 255, 8, 4000000000u, 300, 70000);
+        _binBoth(logAdd, "long %ld %lu %lld %llx %jd %zu %zd %td\n", -1L, 2UL, -3LL, 0xffLL, (intmax_t)-4, (size_t)5, (ssize_t)-6, (ptrdiff_t)7);
+        _binBoth(logAdd, "float %f %.2f %10.3e %g %G %a %Lf\n", 3.14159, 2.5, 12345.678, 0.0001, 1e20, 1.0, (long double)1.5);
+        _binBoth(logAdd, "str %s %10s %-10s| %.3s %.*s %*d %c %p %s %%\n", "abc", "right", "left", "truncate", 2, "star", 6, 42, 'x', (void*)0x1234, (char*)NULL);
+        _binBoth(logAdd, "big %s\n", big);
+        _binBoth(logAdd, "%2$s %1$s positional\n", "a", "b");     // 不支持的转换说明, 写入渲染好的文本
+        strcpy(stack, "dynamic %d\n");
+        _binBoth(logAdd, stack, 1);
+        strcpy(stack, "changed %s\n");                          // 同一地址的内容改变
+        _binBoth(logAdd, stack, "ok");
+        _binBoth(logAddText, "text only %d\n", 7);
+        _binBoth(logErr, "err %d\n", 8);
+        logAddTime("textlog");
+        logAddTime("binlog");
+    }
+    logsysSetAsync(false);
+
+    /* 关闭二进制记录后的文本原样保留 */
+    logSetBinary("binlog", false);
+    _binBoth(logAdd, "back to text %d\n", 9);
+    logFlush("textlog");
+    logFlush("binlog");
+
+    fp[0] = fopen("./logs/binlog.out", "r");
+    fp[1] = fopen("./logs/binlog.txt", "w+");
+    if(!fp[0] || !fp[1] || LOG_OK != logDecode(fp[0], fp[1]))
+        logShow("logDecode err\n");
+    if(fp[0])   fclose(fp[0]);
+    if(fp[1])   fclose(fp[1]);
+
+    fp[0] = fopen("./logs/textlog.out", "r");
+    fp[1] = fopen("./logs/binlog.txt", "r");
+    while(fp[0] && fp[1] && fgets(line[0], sizeof(line[0]), fp[0]))
+    {
+        lines++;
+        if(!fgets(line[1], sizeof(line[1]), fp[1]) || strcmp(_lineBody(line[0]), _lineBody(line[1])))
+            diff++;
+    }
+    if(fp[1] && fgets(line[1], sizeof(line[1]), fp[1]))    diff++;
+    if(fp[0])   fclose(fp[0]);
+    if(fp[1])   fclose(fp[1]);
+    if(21 != lines || diff)
+        logShow("binary record err: %d lines, %d differ\n", lines, diff);
+
+    /* 只有字面量写入 'F' 定义, 栈上的格式化字串写入渲染好的文本, 不占用格式化字串表 */
+    if(!_binHas("./logs/binlog.out", "int %d %i") || _binHas("./logs/binlog.out", "dynamic %d") || !_binHas("./logs/binlog.out", "dynamic 1"))
+        logShow("binary record err: only literal formats should be recorded\n");
+
+    logsysRelease();
+
+    /* mmap 引擎崩溃后残留的 '\0' 不影响之后的解码: 崩溃前的二进制段, 重新打开后的二进制段 和 正常关闭后追加的文本都应还原 */
+    logsysInit();
+    logCreate("bincrash", "./logs/bincrash.out", MUTE);
+    logFlieEmpty("bincrash");
+    if(0 == (pid = fork()))
+    {
+        logSetEngine("bincrash", LOG_IO_MMAP, 0);
+        logSetBinary("bincrash", true);
+        logAdd("bincrash", "crash %d\n", 0);
+        _exit(0);
+    }
+    if(pid > 0)
+        waitpid(pid, &status, 0);
+    logSetEngine("bincrash", LOG_IO_MMAP, 0);
+    logSetBinary("bincrash", true);
+    logAdd("bincrash", "crash %d\n", 1);
+    logsysRelease();
+    logsysInit();
+    logCreate("bincrash", "./logs/bincrash.out", MUTE);
+    logSetEngine("bincrash", LOG_IO_MMAP, 0);
+    logAdd("bincrash", "crash text\n");
+    logsysRelease();
+
+    fp[0] = fopen("./logs/bincrash.out", "r");
+    fp[1] = fopen("./logs/bincrash.txt", "w");
+    lines = fp[0] && fp[1] ? logDecode(fp[0], fp[1]) : LOG_ERR;
+    if(fp[0])   fclose(fp[0]);
+    if(fp[1])   fclose(fp[1]);
+    if(pid <= 0 || LOG_OK != lines || _checkLines("./logs/bincrash.txt") < 3 || 3 != _grepLines("./logs/bincrash.txt", "] crash "))
+        logShow("binary record err: records after a crash are not decoded\n");
+}
+/* 在系统日志中查找最后一条 name 的计数器, 返回找到的条数, 同时统计 "add a" 记录的条数 */
+static int _sysCounters(constr name, unsigned long long* lines, unsigned long long* bytes, unsigned long long* errs, int* adds)
+{
+    char line[1024], tag[64], * p;
+    int found = 0;
+    FILE* fp;
+
+    *adds = 0;
+    snprintf(tag, sizeof(tag), "[%s] --Counters: ", name);
+    if(!(fp = fopen(LOGSYS_PATH, "r")))  return 0;
+    while(fgets(line, sizeof(line), fp))
+    {
+        if(strstr(line, "] add a") || strstr(line, "] add time"))   (*adds)++;
+        if((p = strstr(line, tag)) && 3 == sscanf(p + strlen(tag), "lines %llu, bytes %llu, errs %llu", lines, bytes, errs))
+            found++;
+    }
+    fclose(fp);
+    return found;
+}
+
+void counterTest()
+{
+    unsigned long long lines = 0, bytes = 0, errs = 0;
+    int i, adds, found;
+
+    logShow("计数器测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+    logsysFlieEmpty();
+
+    logCreate("cntlog", "./logs/cntlog.out", MUTE);     // 创建时写入的 "\n" 也计入
+    logFlieEmpty("cntlog");
+    for(i = 0; i < 100; i++)
+        logAdd("cntlog", "counter %d\n", i);
+    logErr("cntlog", "counter err %d\n", 1);
+    logErr("cntlog", "counter err %d\n", 2);
+
+    /* 立即写入 */
+    logsysDump();
+    found = _sysCounters("cntlog", &lines, &bytes, &errs, &adds);
+    if(adds)
+        logShow("counter err: %d per-call records in sys log\n", adds);
+    if(1 != found || 103 != lines || 1 + logFileSize("cntlog") != bytes || 2 != errs)
+        logShow("logsysDump err: found %d, lines %llu, bytes %llu, errs %llu\n", found, lines, bytes, errs);
+
+    /* 定时写入 */
+    logsysSetDumpInterval(1);
+    usleep(1100 * 1000);
+    logsysSetDumpInterval(0);
+    if((found = _sysCounters("cntlog", &lines, &bytes, &errs, &adds)) < 2)
+        logShow("logsysSetDumpInterval err: found %d\n", found);
+
+    /* 销毁时写入最终的计数器 */
+    logAdd("cntlog", "last line\n");
+    logDestroy("cntlog");
+    if(found + 1 != _sysCounters("cntlog", &lines, &bytes, &errs, &adds) || 104 != lines)
+        logShow("logDestroy err: final counters not dumped\n");
+
+    logsysRelease();
+}
+void* statsFunc(void* data)
+{
+    int i = 0;
+    for(i = 0; i < 1000; i++)
+        logAdd("statslog", "statsFunc %d\n", i);
+    return data;
+}
+
+void statsTest()
+{
+    pthread_t pthreads[4];
+    LogStats st, all;
+    uint64_t samples = 0;
+    int i;
+
+    logShow("统计测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+
+    logCreate("statslog", "./logs/statslog.out", MUTE);     // 创建时写入的 "\n" 也计入
+    logFlieEmpty("statslog");
+    for(i = 0; i < 4; i++)
+        pthread_create(&pthreads[i], NULL, statsFunc, NULL);
+    for(i = 0; i < 4; i++)
+        pthread_join(pthreads[i], NULL);
+
+    if(LOG_OK != logStats("statslog", &st))
+        logShow("logStats err\n");
+    for(i = 0; i < LOG_HIST_BUCKETS; i++)
+        samples += st.hist[i];
+    if(4001 != st.lines || 4001 != st.calls || samples != st.calls || st.flushes < 4000 || st.dropped || st.errs)
+        logShow("logStats err: lines %llu, calls %llu, samples %llu, flushes %llu\n",
+                (unsigned long long)st.lines, (unsigned long long)st.calls, (unsigned long long)samples, (unsigned long long)st.flushes);
+    if(!logStatsPercentile(&st, 50) || logStatsPercentile(&st, 50) > logStatsPercentile(&st, 99) || logStatsPercentile(&st, 99) > logStatsPercentile(&st, 99.9))
+        logShow("logStatsPercentile err: p50 %llu, p99 %llu, p99.9 %llu\n", (unsigned long long)logStatsPercentile(&st, 50),
+                (unsigned long long)logStatsPercentile(&st, 99), (unsigned long long)logStatsPercentile(&st, 99.9));
+
+    /* 所有日志的总和 */
+    logCreate("statslog2", "./logs/statslog2.out", MUTE);
+    if(LOG_OK != logsysStats(&all) || all.lines != st.lines + 1 || all.calls != st.calls + 1)
+        logShow("logsysStats err: lines %llu, calls %llu\n", (unsigned long long)all.lines, (unsigned long long)all.calls);
+
+    /* 关闭耗时统计后, 计数器照常累加 */
+    logsysSetStats(false);
+    logAdd("statslog", "stats off\n");
+    logsysSetStats(true);
+    logStats("statslog", &all);
+    if(all.lines != st.lines + 1 || all.calls != st.calls)
+        logShow("logsysSetStats err: lines %llu, calls %llu\n", (unsigned long long)all.lines, (unsigned long long)all.calls);
+
+    /* 百分位数取桶的上界 */
+    bzero(&st, sizeof(st));
+    st.hist[3]  = 90;
+    st.hist[40] = 10;
+    if(3 != logStatsPercentile(&st, 50) || 3 != logStatsPercentile(&st, 90) || 2559 != logStatsPercentile(&st, 99))
+        logShow("logStatsPercentile err: p50 %llu, p90 %llu, p99 %llu\n", (unsigned long long)logStatsPercentile(&st, 50),
+                (unsigned long long)logStatsPercentile(&st, 90), (unsigned long long)logStatsPercentile(&st, 99));
+
+    logsysRelease();
+}
+static int _siteArgCount = 0;
+static int _siteArg()
+{
+    return ++_siteArgCount;
+}
+
+/* 统计文件中含有 str 的行数 */
+static int _grepLines(constr path, constr str)
+{
+    char line[1024];
+    int lines = 0;
+    FILE* fp;
+
+    if(!(fp = fopen(path, "r")))    return -1;
+    while(fgets(line, sizeof(line), fp))
+        if(strstr(line, str))   lines++;
+    fclose(fp);
+    return lines;
+}
+
+/* 等待到下一秒开始 */
+static void _waitNextSecond()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    usleep((1000000000L - ts.tv_nsec) / 1000 + 1000);
+}
+
+void siteTest()
+{
+    int i, round, lines;
+
+    logShow("调用点过滤测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+
+    logCreate("sitelog", "./logs/sitelog.out", MUTE);
+    logFlieEmpty("sitelog");
+
+    /* 每 10 次输出一次, 被抑制的调用不会对参数求值 */
+    for(i = 0; i < 100; i++)
+        logErrEvery("sitelog", 10, "every %d\n", _siteArg());
+    if(10 != _siteArgCount || 10 != _grepLines("./logs/sitelog.out", "every ")
+       || 9 != _grepLines("./logs/sitelog.out", "9 similar messages suppressed"))
+        logShow("logErrEvery err: %d evaluated, %d written\n", _siteArgCount, _grepLines("./logs/sitelog.out", "every "));
+
+    /* 每秒最多 5 次, 下一个窗口的第一条输出之前报告上一个窗口被抑制的条数 */
+    for(round = 0; round < 2; round++)
+    {
+        _waitNextSecond();
+        for(i = 0; i < 100; i++)
+            logWarningRateLimited("sitelog", 5, "rate %d\n", i);
+        if(5 * (round + 1) != (lines = _grepLines("./logs/sitelog.out", "rate ")))
+            logShow("logWarningRateLimited err: %d written in %d seconds\n", lines, round + 1);
+    }
+    if(1 != _grepLines("./logs/sitelog.out", "95 similar messages suppressed"))
+        logShow("logWarningRateLimited err: suppressed count not reported\n");
+
+    /* 之后不再调用时, 窗口结束后由定时线程报告被抑制的条数 */
+    _waitNextSecond();
+    for(i = 0; i < 10; i++)
+        logErrRateLimited("sitelog", 3, "tail %d\n", i);
+    for(round = 0; round < 300 && 1 != _grepLines("./logs/sitelog.out", "7 similar messages suppressed"); round++)
+        usleep(10000);
+    if(3 != _grepLines("./logs/sitelog.out", "tail ") || 1 != _grepLines("./logs/sitelog.out", "7 similar messages suppressed"))
+        logShow("logErrRateLimited err: suppressed count of the last window not reported\n");
+
+    /* 按概率输出 */
+    for(i = 0; i < 10000; i++)
+        logInfoSampled("sitelog", 0.1, "sampled %d\n", i);
+    lines = _grepLines("./logs/sitelog.out", "sampled ");
+    if(lines < 800 || lines > 1200)
+        logShow("logInfoSampled err: %d of 10000 written with p = 0.1\n", lines);
+    for(i = 0; i < 100; i++)
+    {
+        logInfoSampled("sitelog", 0, "never %d\n", i);
+        logInfoSampled("sitelog", 1, "always %d\n", i);
+    }
+    if(0 != _grepLines("./logs/sitelog.out", "never ") || 100 != _grepLines("./logs/sitelog.out", "always "))
+        logShow("logInfoSampled err: p = 0 or p = 1 not respected\n");
+
+    logsysRelease();
+}
+
+static void* _dedupFunc(void* arg)
+{
+    for(int i = 0; i < 2000; i++)
+        logAdd("dedupmt", "dedupmt %d\n", i / 8 % 3);
+    return arg;
+}
+
+void dedupTest()
+{
+    char big[2000], stack[32], line[256], * p;
+    pthread_t pthreads[4];
+    int i, lines, threads, total, prev;
+    FILE* fp;
+
+    logShow("重复记录合并测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+
+    /* 日志不存在时失败, 不启动定时线程 */
+    threads = _threadCount();
+    if(LOG_ERR != logSetDedup("nodeduplog", 60000) || threads != _threadCount())
+        logShow("logSetDedup err: flush ticker started for a missing log\n");
+
+    logCreate("deduplog", "./logs/deduplog.out", MUTE);
+    logFlieEmpty("deduplog");
+    logSetDedup("deduplog", 60000);
+
+    /* 连续相同的记录只写入第一条, 被不同的记录打断时写入摘要 */
+    for(i = 0; i < 100; i++)
+        logAdd("deduplog", "same %d %s\n", 7, "arg");
+    logAdd("deduplog", "same %d %s\n", 8, "arg");
+    for(i = 0; i < 10; i++)
+        logErr("deduplog", "err %s\n", "again");
+    logAdd("deduplog", "other\n");
+    if(1 != _grepLines("./logs/deduplog.out", "same 7 arg") || 1 != _grepLines("./logs/deduplog.out", "same 8 arg")
+       || 1 != _grepLines("./logs/deduplog.out", "last message repeated 99 times")
+       || 1 != _grepLines("./logs/deduplog.out", "err again")
+       || 1 != _grepLines("./logs/deduplog.out", "last message repeated 9 times"))
+        logShow("logSetDedup err: duplicated records not merged\n");
+
+    /* 长参数完整参与比较, 只在末尾不同的记录不会被合并 */
+    memset(big, 'x', sizeof(big) - 2);
+    big[sizeof(big) - 2] = 'a';
+    big[sizeof(big) - 1] = '\0';
+    logAdd("deduplog", "long %s\n", big);
+    logAdd("deduplog", "long %s\n", big);
+    big[sizeof(big) - 2] = 'b';
+    logAdd("deduplog", "long %s\n", big);
+    logAdd("deduplog", "other\n");
+    if(2 != (lines = _grepLines("./logs/deduplog.out", "long ")) || 1 != _grepLines("./logs/deduplog.out", "last message repeated 1 times"))
+        logShow("logSetDedup err: %d of 2 distinct long records written\n", lines);
+
+    /* 格式化字串按内容比较, 同一地址的内容改变时不会被合并 */
+    strcpy(stack, "stack a %d\n");
+    logAdd("deduplog", stack, 1);
+    strcpy(stack, "stack b %d\n");
+    logAdd("deduplog", stack, 1);
+    logAdd("deduplog", "other\n");
+    if(1 != _grepLines("./logs/deduplog.out", "stack a 1") || 1 != _grepLines("./logs/deduplog.out", "stack b 1"))
+        logShow("logSetDedup err: changed format at the same address merged\n");
+
+    /* 多线程: 摘要总是紧跟在它合并的记录之后, 记录数加上合并数等于调用次数 */
+    logCreate("dedupmt", "./logs/dedupmt.out", MUTE);
+    logFlieEmpty("dedupmt");
+    logSetDedup("dedupmt", 60000);
+    for(i = 0; i < 4; i++)
+        pthread_create(&pthreads[i], NULL, _dedupFunc, NULL);
+    for(i = 0; i < 4; i++)
+        pthread_join(pthreads[i], NULL);
+    logSetDedup("dedupmt", 0);
+    total = prev = 0;
+    if((fp = fopen("./logs/dedupmt.out", "r")))
+    {
+        while(fgets(line, sizeof(line), fp))
+            if((p = strstr(line, "last message repeated ")))
+            {
+                if(1 != prev)   total = -1000000;   // 摘要之前不是被合并的记录
+                total += atoi(p + strlen("last message repeated "));
+                prev   = 2;
+            }
+            else if(strstr(line, "] dedupmt "))
+            {
+                total++;
+                prev = 1;
+            }
+        fclose(fp);
+    }
+    if(8000 != total)
+        logShow("logSetDedup err: %d of 8000 records accounted for across threads\n", total);
+
+    /* 重复超时时由定时线程写入摘要, 之后的重复重新计数 */
+    logSetDedup("deduplog", 50);
+    for(i = 0; i < 5; i++)
+        logAdd("deduplog", "timeout\n");
+    usleep(200 * 1000);
+    if(1 != _grepLines("./logs/deduplog.out", "last message repeated 4 times"))
+        logShow("logSetDedup err: summary not written after timeout\n");
+    for(i = 0; i < 3; i++)
+        logAdd("deduplog", "timeout\n");
+    logFlush("deduplog");
+    if(1 != _grepLines("./logs/deduplog.out", "timeout") || 1 != _grepLines("./logs/deduplog.out", "last message repeated 3 times"))
+        logShow("logSetDedup err: repeated records after timeout not merged\n");
+
+    /* 关闭后每条都写入 */
+    logSetDedup("deduplog", 0);
+    for(i = 0; i < 5; i++)
+        logAdd("deduplog", "plain\n");
+    if(5 != (lines = _grepLines("./logs/deduplog.out", "plain")))
+        logShow("logSetDedup err: %d of 5 written after disabled\n", lines);
+
+    logsysRelease();
+}
+
+/* 把 stderr 重定向到 fd, 返回原来的 stderr */
+static int _redirectStderr(int fd)
+{
+    int saved;
+
+    fflush(stderr);
+    saved = dup(STDERR_FILENO);
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+    return saved;
+}
+static void _restoreStderr(int saved)
+{
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+}
+
+static void* _consoleFunc(void* arg)
+{
+    for(int i = 0; i < 1000; i++)
+        logAddNMute("consolelog", "console %ld %d\n", (long)arg, i);
+    return arg;
+}
+
+/* 把管道中的内容写入文件, 直到管道关闭 */
+static void* _consoleReader(void* arg)
+{
+    int fd = (int)(long)arg, out = open("./logs/consolepipe.out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char buf[4096];
+    ssize_t n;
+
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+        if(write(out, buf, n) != n) break;
+    close(out);
+    close(fd);
+    return arg;
+}
+
+void consoleTest()
+{
+    pthread_t pthreads[4], reader;
+    int saved, fds[2], last[4] = {-1, -1, -1, -1}, lines = 0, t, i;
+    char line[256], * p, * huge;
+    FILE* fp;
+
+    logShow("异步控制台输出测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+    logCreate("consolelog", "./logs/consolelog.out", MUTE);
+    logFlieEmpty("consolelog");
+
+    /* 多个线程的输出全部写出, 每个线程内的顺序不变 */
+    saved = _redirectStderr(open("./logs/console.out", O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    logsysSetConsoleAsync(true);
+    for(t = 0; t < 4; t++)
+        pthread_create(&pthreads[t], NULL, _consoleFunc, (void*)(long)t);
+    for(t = 0; t < 4; t++)
+        pthread_join(pthreads[t], NULL);
+    logsysSetConsoleAsync(false);   // 停止前写完缓冲区中的输出
+    _restoreStderr(saved);
+
+    if((fp = fopen("./logs/console.out", "r")))
+    {
+        while(fgets(line, sizeof(line), fp))
+            if((p = strstr(line, "[consolelog] :console ")) && 2 == sscanf(p, "[consolelog] :console %d %d", &t, &i)
+               && t >= 0 && t < 4 && i == last[t] + 1)
+            {
+                last[t] = i;
+                lines++;
+            }
+        fclose(fp);
+    }
+    if(4000 != lines)
+        logShow("logsysSetConsoleAsync err: %d of 4000 lines written in order\n", lines);
+
+    /* 控制台阻塞时不阻塞调用者, 超出缓冲区的输出被丢弃并报告 */
+    if(pipe(fds))   return;
+    saved = _redirectStderr(fds[1]);
+    logsysSetConsoleAsync(true);
+    for(i = 0; i < 20000; i++)      // 远超过管道和缓冲区的容量, 此时没有线程读取管道
+        logAddNMute("consolelog", "pipe %d ................................................................................\n", i);
+    if((huge = malloc(DF_CONSOLE_BUF_SIZE + 2)))
+    {   /* 超过缓冲区大小的输出同样丢弃, 调用者不会直接写入阻塞的控制台 */
+        memset(huge, 'x', DF_CONSOLE_BUF_SIZE + 1);
+        huge[DF_CONSOLE_BUF_SIZE + 1] = '\0';
+        logAddNMute("consolelog", "%s\n", huge);
+        free(huge);
+    }
+    pthread_create(&reader, NULL, _consoleReader, (void*)(long)fds[0]);
+    logsysSetConsoleAsync(false);
+    _restoreStderr(saved);          // 关闭管道的写端, 读取线程随之退出
+    pthread_join(reader, NULL);
+
+    lines = _grepLines("./logs/consolepipe.out", "pipe ");
+    if(lines <= 0 || lines >= 20000 || 1 > _grepLines("./logs/consolepipe.out", "outputs dropped"))
+        logShow("logsysSetConsoleAsync err: %d of 20000 lines written to a blocked console\n", lines);
+    if(20000 != (lines = _grepLines("./logs/consolelog.out", "pipe ")))
+        logShow("logsysSetConsoleAsync err: %d of 20000 lines written to file\n", lines);
+
+    logsysRelease();
+}
+
+void fanoutTest()
+{
+    char fline[2048], cline[2048], big[1500], * p;
+    int saved, i, lines = 0, diffs = 0;
+    FILE* ffp, * cfp;
+
+    logShow("单次渲染测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+    logCreate("fanlog", "./logs/fanlog.out", NMUTE);
+    logFlieEmpty("fanlog");
+
+    /* 控制台输出和文件内容相同(只多了 "[fanlog] :"), 时间前缀也相同, 过长的记录使用堆内存 */
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    saved = _redirectStderr(open("./logs/fanout.out", O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    for(i = 0; i < 100; i++)
+    {
+        logAdd("fanlog", "fan %d %s\n", i, "text");
+        logErr("fanlog", "fan err %d\n", i);
+    }
+    logAdd("fanlog", "%s\n", big);
+    _restoreStderr(saved);
+
+    ffp = fopen("./logs/fanlog.out", "r");
+    cfp = fopen("./logs/fanout.out", "r");
+    while(ffp && cfp && fgets(fline, sizeof(fline), ffp) && fgets(cline, sizeof(cline), cfp))
+    {
+        lines++;
+        if(!(p = strstr(cline, "[fanlog] :")) || strncmp(fline, cline, p - cline) || strcmp(fline + (p - cline), p + strlen("[fanlog] :")))
+            diffs++;
+    }
+    if(ffp) fclose(ffp);
+    if(cfp) fclose(cfp);
+    if(201 != lines || diffs)
+        logShow("fanout err: %d lines compared, %d differ\n", lines, diffs);
+
+    logsysRelease();
+}
+
+static void* _shareFunc(void* arg)
+{
+    constr name = arg;
+    int i;
+
+    for(i = 0; i < 2000; i++)
+        logAdd(name, "%s %d ................................................................................................................................\n", name, i);
+    return arg;
+}
+
+void shareTest()
+{
+    pthread_t pthreads[2];
+    char line[512], name[16], * p, * q;
+    int last[2] = {-1, -1}, lines = 0, bad = 0, t, i;
+    LogStats sa, sb;
+    struct stat st;
+    FILE* fp;
+
+    logShow("共享文件测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+    logCreate("sharea", "./logs/share.out", MUTE);
+    logFlieEmpty("sharea");
+    logCreate("shareb", "logs/share.out", MUTE);    // 不同写法的同一文件
+
+    /* 两个日志的写入都完整, 不会交错, 各自的顺序不变 */
+    pthread_create(&pthreads[0], NULL, _shareFunc, "sharea");
+    pthread_create(&pthreads[1], NULL, _shareFunc, "shareb");
+    for(t = 0; t < 2; t++)
+        pthread_join(pthreads[t], NULL);
+    logFlush("sharea");
+
+    if((fp = fopen("./logs/share.out", "r")))
+    {
+        while(fgets(line, sizeof(line), fp))
+        {
+            if('\n' == *line)  continue;        // logCreate 写入的分隔行
+            if((p = strstr(line, "] share")) && 2 == sscanf(p, "] share%1[ab] %d", name, &i) && (q = strchr(p, '.')) && 129 == strspn(q, ".\n")
+               && i == last[*name - 'a'] + 1)
+            {
+                last[*name - 'a'] = i;
+                lines++;
+            }
+            else
+                bad++;
+        }
+        fclose(fp);
+    }
+    if(4000 != lines || bad)
+        logShow("share err: %d of 4000 lines written in order, %d broken\n", lines, bad);
+
+    /* 只有一个日志文件, 两个名称看到的文件大小相同 */
+    if(stat("./logs/share.out", &st) || (size_t)st.st_size != logFileSize("sharea") || logFileSize("shareb") != logFileSize("sharea"))
+        logShow("share err: file size %ld, sharea %zu, shareb %zu\n", (long)st.st_size, logFileSize("sharea"), logFileSize("shareb"));
+
+    /* 计数器各自独立: 各 2000 行加 logCreate 写入的分隔行, 字节数之和为文件大小加上被清空的 sharea 分隔行 */
+    if(LOG_OK != logStats("sharea", &sa) || LOG_OK != logStats("shareb", &sb)
+       || 2001 != sa.lines || 2001 != sb.lines || !sa.bytes || !sb.bytes || sa.bytes + sb.bytes != (uint64_t)st.st_size + 1)
+        logShow("share err: sharea {lines %llu, bytes %llu}, shareb {lines %llu, bytes %llu}, file size %ld\n",
+                (unsigned long long)sa.lines, (unsigned long long)sa.bytes, (unsigned long long)sb.lines, (unsigned long long)sb.bytes, (long)st.st_size);
+
+    /* 先销毁打开文件的日志, 共享者仍可写入, 之后创建的日志也共享同一个文件 */
+    logDestroy("sharea");
+    logAdd("shareb", "after destroy\n");
+    logCreate("sharec", "./logs/../logs/share.out", MUTE);
+    logAdd("sharec", "after destroy\n");
+    logFlush("shareb");
+    if(2 != _grepLines("./logs/share.out", "after destroy") || logFileSize("sharec") != logFileSize("shareb"))
+        logShow("share err: %d lines written after destroy\n", _grepLines("./logs/share.out", "after destroy"));
+
+    logsysRelease();
+}
+
+/* 把黑匣子中的记录提取到 out, 返回 logBoxExtract 的结果 */
+static int _boxExtract(constr box, constr out)
+{
+    FILE* in = fopen(box, "r"), * fp = fopen(out, "w");
+    int ret = in && fp ? logBoxExtract(in, fp) : LOG_ERR;
+
+    if(in)  fclose(in);
+    if(fp)  fclose(fp);
+    return ret;
+}
+
+/* 比较两个文件的内容, 相同时返回 true */
+static bool _sameFile(constr a, constr b)
+{
+    FILE* fa = fopen(a, "r"), * fb = fopen(b, "r");
+    int ca = 0, cb = 0;
+
+    while(fa && fb && (ca = getc(fa)) == (cb = getc(fb)) && EOF != ca);
+    if(fa)  fclose(fa);
+    if(fb)  fclose(fb);
+    return fa && fb && ca == cb;
+}
+
+void blackboxTest()
+{
+    char line[256], * p;
+    int i, first = -1, last = -1, lines = 0, bad = 0, status;
+    pid_t pid;
+    FILE* fp;
+
+    logShow("黑匣子测试: 以下不应输出任何提示\n");
+
+    logsysRelease();
+    logsysInit();
+    unlink("./logs/boxlog.out.box");
+    logCreate("boxlog", "./logs/boxlog.out", MUTE);
+    logFlieEmpty("boxlog");
+    logSetBlackBox("boxlog", 1);
+
+    /* 未回绕时黑匣子和文件的内容完全相同 */
+    for(i = 0; i < 100; i++)
+        logAdd("boxlog", "box %d %s\n", i, "text");
+    logFlush("boxlog");
+    if(LOG_OK != _boxExtract("./logs/boxlog.out.box", "./logs/boxlog.extract") || !_sameFile("./logs/boxlog.out", "./logs/boxlog.extract"))
+        logShow("logSetBlackBox err: extracted content differs from file\n");
+
+    /* 二进制记录在黑匣子中为文本, 异步模式下入队时写入 */
+    logSetBinary("boxlog", true);
+    logAdd("boxlog", "box %d %s\n", i, "binary");
+    logSetBinary("boxlog", false);
+    logsysSetAsync(true);
+    logAdd("boxlog", "box %d %s\n", i, "async");
+    logsysSetAsync(false);
+    _boxExtract("./logs/boxlog.out.box", "./logs/boxlog.extract");
+    if(102 != _grepLines("./logs/boxlog.extract", "] box ") || 1 != _grepLines("./logs/boxlog.extract", "binary") || 1 != _grepLines("./logs/boxlog.extract", "async"))
+        logShow("logSetBlackBox err: %d of 102 lines extracted\n", _grepLines("./logs/boxlog.extract", "] box "));
+
+    /* 回绕后从最旧的完整记录开始按顺序输出, 直到最后一条 */
+    logFlieEmpty("boxlog");
+    for(i = 0; i < 20000; i++)
+        logAdd("boxlog", "wrap %d ................................................................................\n", i);
+    _boxExtract("./logs/boxlog.out.box", "./logs/boxlog.extract");
+    if((fp = fopen("./logs/boxlog.extract", "r")))
+    {
+        while(fgets(line, sizeof(line), fp))
+            if((p = strstr(line, "] wrap ")) && 1 == sscanf(p, "] wrap %d", &i) && (-1 == last || i == last + 1) && strchr(p, '\n'))
+            {
+                if(-1 == last)  first = i;
+                last = i;
+                lines++;
+            }
+            else
+                bad++;
+        fclose(fp);
+    }
+    if(19999 != last || first <= 0 || lines < 8000 || bad)
+        logShow("logSetBlackBox err: wrapped extract has lines %d ~ %d, %d broken\n", first, last, bad);
+
+    /* 被 SIGKILL 的进程中还没有写出到文件的记录保留在黑匣子中, 大小不变时重新设置会保留它们 */
+    logSetFlush("boxlog", LOG_FLUSH_MANUAL, 0);
+    if(0 == (pid = fork()))
+    {
+        for(i = 0; i < 100; i++)
+            logAdd("boxlog", "crash %d\n", i);
+        kill(getpid(), SIGKILL);
+    }
+    if(pid > 0)
+        waitpid(pid, &status, 0);
+    logSetBlackBox("boxlog", 1);
+    _boxExtract("./logs/boxlog.out.box", "./logs/boxlog.extract");
+    if(pid <= 0 || 100 != _grepLines("./logs/boxlog.extract", "] crash ") || _grepLines("./logs/boxlog.out", "] crash "))
+        logShow("logSetBlackBox err: %d of 100 lines survived SIGKILL\n", _grepLines("./logs/boxlog.extract", "] crash "));
+
+    /* 改变大小时重新创建, 关闭后不再写入 */
+    logSetBlackBox("boxlog", 2);
+    logAdd("boxlog", "resized\n");
+    logSetBlackBox("boxlog", 0);
+    logAdd("boxlog", "closed\n");
+    _boxExtract("./logs/boxlog.out.box", "./logs/boxlog.extract");
+    if(1 != _grepLines("./logs/boxlog.extract", "resized") || _grepLines("./logs/boxlog.extract", "closed") || _grepLines("./logs/boxlog.extract", "wrap "))
+        logShow("logSetBlackBox err: resize or close failed\n");
+
+    logsysRelease();
+}
 
 /* 使用示例 */
 void normalTest()
@@ -2,10 +2,29 @@
 #define LOGTEST
 
 #include "log.h"
+#include <signal.h>     // kill
+#include <sys/wait.h>   // waitpid
 
 void logTest();         // 基本API测试
 void logERRTest();      // ERR 宏测试
 void mutexTest();       // 多线程稳定性测试
+void asyncTest();       // 异步模式测试
+void rotateTest();      // 文件轮转测试
+void handleTest();      // 句柄API测试
+void levelTest();       // 调式级别测试
+void flushTest();       // fflush 策略测试
+void directTest();      // 直接写入引擎测试
+void mmapTest();        // mmap 写入引擎测试
+void uringTest();       // io_uring 写入引擎测试
+void binaryTest();      // 二进制记录测试
+void counterTest();     // 计数器测试
+void statsTest();       // 统计测试
+void siteTest();        // 调用点过滤测试
+void dedupTest();       // 重复记录合并测试
+void consoleTest();     // 异步控制台输出测试
+void fanoutTest();      // 单次渲染测试
+void shareTest();       // 共享文件测试
+void blackboxTest();    // 黑匣子测试
 void normalTest();      // 正常使用示例
 
 